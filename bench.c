@@ -0,0 +1,2442 @@
+/*
+ * Host benchmarks for the GPIO/SPI paths.
+ *
+ * Built with `make bench` using the host compiler. The binary is linked
+ * with -Wl,--wrap for the file syscalls so every open/read/write/ioctl
+ * issued by the code under test is counted, and it runs against a fake
+ * sysfs tree created under /tmp instead of /sys/class/gpio.
+ *
+ * Usage: ./bench [name...]   (no argument runs every benchmark)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <semaphore.h>
+
+#include "led.h"
+#include "spi.h"
+#include "sample_ring.h"
+#include "capture.h"
+#include "filter.h"
+#include "max7219.h"
+#include "scroll.h"
+#include "frame_sched.h"
+#include "sensor.h"
+#include "tsc.h"
+#include "stats.h"
+#include "rt.h"
+#include "measlog.h"
+
+#define BENCH_ITERATIONS 100000
+#define BENCH_FRAMES 20000
+
+/****************************************************************
+ * Syscall counting
+ ****************************************************************/
+
+static unsigned long bench_syscalls;
+
+/*
+ * Stand-in spidev device: an fd on /dev/null whose SPI_IOC_MESSAGE ioctls
+ * still cost a real syscall but report every transfer as sent.
+ */
+static int bench_spi_fd = -1;
+
+/*
+ * Simulated echo line for the edges and bothedge benchmarks, hooked into
+ * the pread/pwrite wraps below; the fds are -1 while it is not running.
+ * A write of 0 to the trigger pin posts echo_sim_go.
+ */
+static int echo_sim_fd = -1;		/* stands in for the value attribute */
+static int echo_sim_edge_fd = -1;	/* edge attribute of the echo pin */
+static int echo_sim_trig_fd = -1;	/* value attribute of the trigger pin */
+static int echo_sim_run;
+static unsigned long long echo_sim_actual_ns;	/* of the last pulse */
+static sem_t echo_sim_go, echo_sim_done;	/* trigger fired, pulse over */
+static void echo_sim_pwrite(int fd, const char *buf, size_t count);
+static ssize_t echo_sim_pread(char *buf);
+
+/*
+ * Stand-in gpiochip: /dev/gpiochip* opens /dev/null, a line request
+ * hands out another /dev/null fd, and the request and line ioctls still
+ * cost a real syscall but succeed. Reads come back all low.
+ */
+#define BENCH_FDS 1024
+#define BENCH_FD_CHIP 1
+#define BENCH_FD_LINE 2
+static unsigned char bench_fd_kind[BENCH_FDS];
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int __real_ioctl(int fd, unsigned long request, ...);
+long __real_syscall(long number, ...);
+
+int __wrap_open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+	int fd;
+
+	if(flags & O_CREAT)
+	{
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	bench_syscalls++;
+	if(strncmp(path, "/dev/gpiochip", 13) == 0)
+	{
+		fd = __real_open("/dev/null", flags);
+		if(fd >= 0 && fd < BENCH_FDS)
+			bench_fd_kind[fd] = BENCH_FD_CHIP;
+		return fd;
+	}
+	return __real_open(path, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+	bench_syscalls++;
+	if(fd >= 0 && fd < BENCH_FDS)
+		bench_fd_kind[fd] = 0;
+	return __real_close(fd);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	bench_syscalls++;
+	return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+	bench_syscalls++;
+	return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	bench_syscalls++;
+	if(fd == echo_sim_fd && count > 0)
+		return echo_sim_pread(buf);
+	return __real_pread(fd, buf, count, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	bench_syscalls++;
+	if(fd >= 0 && (fd == echo_sim_edge_fd || fd == echo_sim_trig_fd))
+		echo_sim_pwrite(fd, buf, count);
+	return __real_pwrite(fd, buf, count, offset);
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	void *arg;
+	va_list ap;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	bench_syscalls++;
+	if(fd == bench_spi_fd && _IOC_TYPE(request) == SPI_IOC_MAGIC &&
+		_IOC_NR(request) == 0)
+	{
+		const struct spi_ioc_transfer *tr = arg;
+		unsigned int i, n = _IOC_SIZE(request) / sizeof(*tr);
+		int len = 0;
+
+		__real_ioctl(fd, request, arg);
+		for(i = 0; i < n; i++)
+			len += tr[i].len;
+		return len;
+	}
+	if(fd >= 0 && fd < BENCH_FDS && bench_fd_kind[fd] == BENCH_FD_CHIP &&
+		request == GPIO_V2_GET_LINE_IOCTL)
+	{
+		struct gpio_v2_line_request *req = arg;
+
+		__real_ioctl(fd, request, arg);
+		req->fd = __real_open("/dev/null", O_RDWR);
+		if(req->fd >= 0 && req->fd < BENCH_FDS)
+			bench_fd_kind[req->fd] = BENCH_FD_LINE;
+		return 0;
+	}
+	if(fd >= 0 && fd < BENCH_FDS && bench_fd_kind[fd] == BENCH_FD_LINE)
+	{
+		__real_ioctl(fd, request, arg);
+		return 0;
+	}
+	return __real_ioctl(fd, request, arg);
+}
+
+/* Raw syscalls such as io_uring_enter(), up to six arguments */
+long __wrap_syscall(long number, ...)
+{
+	long a[6];
+	va_list ap;
+	int i;
+
+	va_start(ap, number);
+	for(i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+	bench_syscalls++;
+	return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/****************************************************************
+ * Helpers
+ ****************************************************************/
+
+static unsigned long long bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_report(const char *what, unsigned long ops,
+	unsigned long syscalls, unsigned long long ns)
+{
+	printf("  %-28s %8.2f syscalls/op %10.1f ns/op\n", what,
+		(double)syscalls / ops, (double)ns / ops);
+}
+
+static char fake_root[] = "/tmp/gpio-bench-XXXXXX";
+
+static void fake_touch(const char *path, const char *content)
+{
+	int fd = __real_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if(fd >= 0)
+	{
+		__real_write(fd, content, strlen(content));
+		__real_close(fd);
+	}
+}
+
+/*
+ * Creates a fake sysfs gpio tree with the given pins already exported and
+ * points gpio.c at it.
+ */
+static int fake_sysfs_create(const unsigned int *pins, int n)
+{
+	char buf[GPIO_PATH_MAX];
+	int i;
+
+	if(mkdtemp(fake_root) == NULL)
+	{
+		perror("mkdtemp");
+		return -1;
+	}
+
+	snprintf(buf, sizeof(buf), "%s/export", fake_root);
+	fake_touch(buf, "");
+	snprintf(buf, sizeof(buf), "%s/unexport", fake_root);
+	fake_touch(buf, "");
+
+	for(i = 0; i < n; i++)
+	{
+		snprintf(buf, sizeof(buf), "%s/gpio%u", fake_root, pins[i]);
+		mkdir(buf, 0755);
+		snprintf(buf, sizeof(buf), "%s/gpio%u/value", fake_root, pins[i]);
+		fake_touch(buf, "0");
+		snprintf(buf, sizeof(buf), "%s/gpio%u/direction", fake_root, pins[i]);
+		fake_touch(buf, "in");
+		snprintf(buf, sizeof(buf), "%s/gpio%u/edge", fake_root, pins[i]);
+		fake_touch(buf, "none");
+	}
+
+	return gpio_set_root(fake_root);
+}
+
+static void fake_sysfs_destroy(void)
+{
+	char cmd[GPIO_PATH_MAX];
+
+	gpio_handle_close_all();
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", fake_root);
+	if(system(cmd) != 0)
+		fprintf(stderr, "could not remove %s\n", fake_root);
+	strcpy(fake_root, "/tmp/gpio-bench-XXXXXX");
+}
+
+/****************************************************************
+ * Benchmarks
+ ****************************************************************/
+
+/* The original gpio_set_value: path formatting plus open/write/close. */
+static int legacy_set_value(unsigned int gpio, unsigned int value)
+{
+	int fd;
+	char buf[GPIO_PATH_MAX];
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/value", fake_root, gpio);
+	fd = open(buf, O_WRONLY);
+	if(fd < 0)
+		return fd;
+	write(fd, value ? "1" : "0", 1);
+	close(fd);
+	return 0;
+}
+
+static int bench_gpio(void)
+{
+	static const unsigned int pins[] = { 15 };
+	unsigned long long t0;
+	unsigned long s0;
+	struct gpio_handle *h;
+	int i;
+
+	if(fake_sysfs_create(pins, 1) < 0)
+		return -1;
+
+	printf("gpio toggle, %d iterations on %s\n", BENCH_ITERATIONS, fake_root);
+
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_ITERATIONS; i++)
+		legacy_set_value(15, i & 1);
+	bench_report("open/write/close", BENCH_ITERATIONS,
+		bench_syscalls - s0, bench_now_ns() - t0);
+
+	gpio_set_value(15, 0);	/* open the handle outside the timed loop */
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_ITERATIONS; i++)
+		gpio_set_value(15, i & 1);
+	bench_report("gpio_set_value (cached)", BENCH_ITERATIONS,
+		bench_syscalls - s0, bench_now_ns() - t0);
+
+	h = gpio_handle_open(15);
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_ITERATIONS; i++)
+		gpio_handle_write(h, i & 1);
+	bench_report("gpio_handle_write", BENCH_ITERATIONS,
+		bench_syscalls - s0, bench_now_ns() - t0);
+
+	fake_sysfs_destroy();
+	return 0;
+}
+
+static void bench_frame_fill(struct spi_frame *frame, int k)
+{
+	int row;
+
+	for(row = 1; row <= 8; row++)
+		spi_frame_add(frame, row, (uint8_t)(row * 31 + k));
+}
+
+static int bench_spi(void)
+{
+	static const unsigned int pins[] = { 15 };
+	static struct spi_frame frame;
+	struct spi_ioc_transfer tr;
+	uint8_t tx[2];
+	unsigned long long t0;
+	unsigned long s0;
+	int i, row;
+
+	if(fake_sysfs_create(pins, 1) < 0)
+		return -1;
+	bench_spi_fd = __real_open("/dev/null", O_RDWR);
+
+	printf("8 row frame push, %d frames, stand-in spidev\n", BENCH_FRAMES);
+
+	/* one ioctl per register, chip select via open/write/close */
+	memset(&tr, 0, sizeof(tr));
+	tr.tx_buf = (unsigned long)tx;
+	tr.len = 2;
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_FRAMES; i++)
+	{
+		for(row = 1; row <= 8; row++)
+		{
+			tx[0] = row;
+			tx[1] = (uint8_t)(row * 31 + i);
+			legacy_set_value(15, 0);
+			ioctl(bench_spi_fd, SPI_IOC_MESSAGE(1), &tr);
+			legacy_set_value(15, 1);
+		}
+	}
+	bench_report("per-register + sysfs CS", BENCH_FRAMES,
+		bench_syscalls - s0, bench_now_ns() - t0);
+
+	spi_frame_init(&frame, bench_spi_fd, 15);
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_FRAMES; i++)
+	{
+		bench_frame_fill(&frame, i);
+		spi_frame_submit(&frame);
+	}
+	bench_report("spi_frame, GPIO CS", BENCH_FRAMES,
+		bench_syscalls - s0, bench_now_ns() - t0);
+
+	spi_frame_init(&frame, bench_spi_fd, SPI_CS_NATIVE);
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_FRAMES; i++)
+	{
+		bench_frame_fill(&frame, i);
+		spi_frame_submit(&frame);
+	}
+	bench_report("spi_frame, native CS", BENCH_FRAMES,
+		bench_syscalls - s0, bench_now_ns() - t0);
+
+	__real_close(bench_spi_fd);
+	bench_spi_fd = -1;
+	fake_sysfs_destroy();
+	return 0;
+}
+
+/*
+ * Recorded-event stand-in for a gpiochip line: every trigger makes a
+ * thread write a rising and a falling gpio_v2_line_event record into a
+ * pipe. Each record is stamped the way the kernel stamps it in its
+ * interrupt handler, at the edge plus the interrupt entry latency, which
+ * is drawn per edge: a fixed part, an exponential tail, and now and then
+ * a section run with interrupts off. Both capture paths are scored
+ * against the width actually emitted: stamping each wakeup, which is
+ * what the sysfs+rdtsc path measures, and echo_measure() on the events.
+ */
+#define EDGE_PULSES 2000
+#define EDGE_WIDTH_NS 580000	/* ~10 cm echo */
+#define EDGE_IRQ_NS 1000	/* interrupt entry, same for both edges */
+#define EDGE_IRQ_TAIL_NS 300	/* mean of the exponential tail */
+#define EDGE_IRQ_OFF_NS 20000	/* longest interrupts-off section */
+#define EDGE_IRQ_OFF_RATE 100	/* one edge in this many hits one */
+
+static unsigned long long edge_rand_state = 0x9e3779b97f4a7c15ULL;
+
+static double edge_rand(void)
+{
+	edge_rand_state ^= edge_rand_state << 13;
+	edge_rand_state ^= edge_rand_state >> 7;
+	edge_rand_state ^= edge_rand_state << 17;
+	return ((edge_rand_state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static unsigned long long edge_irq_latency_ns(void)
+{
+	double ns = EDGE_IRQ_NS - EDGE_IRQ_TAIL_NS * log(edge_rand());
+
+	if(edge_rand() * EDGE_IRQ_OFF_RATE < 1.0)
+		ns += edge_rand() * EDGE_IRQ_OFF_NS;
+	return (unsigned long long)ns;
+}
+
+static void edge_emit_at(int fd, int rising, unsigned long long timestamp_ns,
+	unsigned int seqno)
+{
+	struct gpio_v2_line_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.timestamp_ns = timestamp_ns;
+	ev.id = rising ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+	ev.line_seqno = seqno;
+	__real_write(fd, &ev, sizeof(ev));
+}
+
+static void edge_emit(int fd, int rising)
+{
+	edge_emit_at(fd, rising, bench_now_ns(), 0);
+}
+
+static void *edge_writer(void *arg)
+{
+	struct timespec width = { 0, EDGE_WIDTH_NS };
+	unsigned long long rise, fall;
+	unsigned int seqno = 0;
+	int fd = *(int *)arg;
+
+	while(1)
+	{
+		sem_wait(&echo_sim_go);
+		if(!__atomic_load_n(&echo_sim_run, __ATOMIC_ACQUIRE))
+			break;
+		rise = bench_now_ns();
+		edge_emit_at(fd, 1, rise + edge_irq_latency_ns(), ++seqno);
+		nanosleep(&width, NULL);
+		fall = bench_now_ns();
+		edge_emit_at(fd, 0, fall + edge_irq_latency_ns(), ++seqno);
+		echo_sim_actual_ns = fall - rise;
+		sem_post(&echo_sim_done);
+	}
+	return NULL;
+}
+
+/* Each edge stamped when the reader wakes up for it */
+static int edge_measure_wakeup(struct echo_sensor *s, struct echo_pulse *p)
+{
+	struct gpio_edge ev[GPIO_EDGE_BATCH];
+	unsigned long long wake;
+	int i, n;
+
+	memset(p, 0, sizeof(*p));
+	echo_trigger(s);
+	while((n = gpio_cdev_read_edges(s->line_fd, ev, GPIO_EDGE_BATCH, 1000)) > 0)
+	{
+		wake = bench_now_ns();
+		for(i = 0; i < n; i++)
+		{
+			if(ev[i].rising)
+			{
+				p->rise = wake;
+				continue;
+			}
+			p->fall = wake;
+			p->width_ns = p->fall - p->rise;
+			p->valid = 1;
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void edge_run(const char *what, struct echo_sensor *s,
+	int (*measure)(struct echo_sensor *, struct echo_pulse *))
+{
+	static double err[EDGE_PULSES];
+	double sum = 0, sq = 0, max = 0;
+	struct echo_pulse p;
+	int i, k = 0;
+
+	for(i = 0; i < EDGE_PULSES; i++)
+	{
+		measure(s, &p);
+		sem_wait(&echo_sim_done);
+		if(p.valid)
+			err[k++] = (double)p.width_ns - (double)echo_sim_actual_ns;
+	}
+	for(i = 0; i < k; i++)
+	{
+		sum += err[i];
+		sq += err[i] * err[i];
+		if(fabs(err[i]) > max)
+			max = fabs(err[i]);
+	}
+	if(k == 0)
+	{
+		printf("  %-28s no valid pulse\n", what);
+		return;
+	}
+	printf("  %-28s mean %9.1f ns  stddev %9.1f ns  max %9.1f ns  %4d valid\n", what,
+		sum / k, sqrt(sq / k - (sum / k) * (sum / k)), max, k);
+}
+
+static int bench_edges(void)
+{
+	static const unsigned int pins[] = { 23 };
+	struct echo_sensor s;
+	pthread_t writer;
+	int pfd[2];
+
+	if(tsc_calibrate() < 0 || fake_sysfs_create(pins, 1) < 0)
+		return -1;
+	if(pipe(pfd) < 0)
+	{
+		fake_sysfs_destroy();
+		return -1;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.trig_gpio = 23;
+	s.use_cdev = 1;
+	s.value_fd = -1;
+	s.line_fd = pfd[0];
+	s.rt_cpu = -1;
+	gpio_set_value(23, GPIO_VALUE_LOW);
+	echo_sim_trig_fd = gpio_handle_open(23)->value_fd;
+	echo_sim_run = 1;
+	sem_init(&echo_sim_go, 0, 0);
+	sem_init(&echo_sim_done, 0, 0);
+	pthread_create(&writer, NULL, edge_writer, &pfd[1]);
+
+	printf("echo width error, %d pulses of %d ns, recorded-event stand-in,\n"
+		"interrupt entry %d ns + exp(%d ns), 1 in %d edges up to %d ns later\n",
+		EDGE_PULSES, EDGE_WIDTH_NS, EDGE_IRQ_NS, EDGE_IRQ_TAIL_NS,
+		EDGE_IRQ_OFF_RATE, EDGE_IRQ_OFF_NS);
+	edge_run("stamped at wakeup (sysfs)", &s, edge_measure_wakeup);
+	edge_run("event timestamps (cdev)", &s, echo_measure);
+
+	__atomic_store_n(&echo_sim_run, 0, __ATOMIC_RELEASE);
+	sem_post(&echo_sim_go);
+	pthread_join(writer, NULL);
+	echo_sim_trig_fd = -1;
+	__real_close(pfd[0]);
+	__real_close(pfd[1]);
+	sem_destroy(&echo_sim_go);
+	sem_destroy(&echo_sim_done);
+	fake_sysfs_destroy();
+	return 0;
+}
+
+/*
+ * Sample ring stress: one thread publishes as fast as it can, the other
+ * pops, peeks at the latest sample and copies the recent history. Every
+ * field is derived from the sequence number so a torn copy shows up, and
+ * every gap in the popped sequence must be accounted for in ring->lost.
+ */
+#define RING_SAMPLES 2000000ULL
+
+static struct sample_ring bench_ring;
+static volatile int ring_done;
+
+static void ring_fill(struct sample *s, unsigned long long seq)
+{
+	s->rise = seq * 3;
+	s->fall = s->rise + (seq & 0xffff);
+	s->distance_um = seq * 7;
+	s->valid = seq & 1;
+	s->timestamp_ns = 0;
+}
+
+static int ring_torn(const struct sample *s)
+{
+	struct sample ref;
+
+	ring_fill(&ref, s->seq);
+	return ref.rise != s->rise || ref.fall != s->fall ||
+		ref.distance_um != s->distance_um || ref.valid != s->valid;
+}
+
+static void *ring_producer(void *arg)
+{
+	struct sample s;
+	unsigned long long seq;
+
+	for(seq = 1; seq <= RING_SAMPLES; seq++)
+	{
+		ring_fill(&s, seq);
+		sample_ring_publish(&bench_ring, &s);
+	}
+	ring_done = 1;
+	return NULL;
+}
+
+static int bench_ring_stress(void)
+{
+	static struct sample recent[8];
+	struct sample s;
+	unsigned long long last = 0, popped = 0, gaps = 0, torn = 0, latest = 0;
+	unsigned long long t0 = bench_now_ns();
+	pthread_t producer;
+	int i, n;
+
+	sample_ring_init(&bench_ring);
+	ring_done = 0;
+	pthread_create(&producer, NULL, ring_producer, NULL);
+
+	while(!ring_done || bench_ring.tail != bench_ring.head)
+	{
+		while(sample_ring_pop(&bench_ring, &s))
+		{
+			torn += ring_torn(&s);
+			gaps += s.seq - last - 1;
+			last = s.seq;
+			popped++;
+		}
+		if(sample_ring_latest(&bench_ring, &s) == 0)
+		{
+			torn += ring_torn(&s);
+			latest++;
+		}
+		n = sample_ring_recent(&bench_ring, recent, 8);
+		for(i = 0; i < n; i++)
+			torn += ring_torn(&recent[i]);
+	}
+	pthread_join(producer, NULL);
+
+	printf("sample ring stress, %llu samples in %.1f ms\n", RING_SAMPLES,
+		(bench_now_ns() - t0) / 1e6);
+	printf("  popped %llu, overwritten %llu, unaccounted gaps %llu, torn %llu, latest reads %llu\n",
+		popped, bench_ring.lost, gaps - bench_ring.lost, torn, latest);
+
+	return (torn || gaps != bench_ring.lost ||
+		popped + bench_ring.lost != RING_SAMPLES) ? -1 : 0;
+}
+
+/*
+ * Capture engine scaling: N simulated sensors whose echo lines are pipes
+ * carrying gpio_v2_line_event records. A simulator thread emits a 1 ms
+ * echo on every line each 5 ms; the engine triggers each sensor as soon
+ * as it is idle. Reported is engine thread CPU time per sample.
+ */
+#define CAPTURE_BENCH_MS 1000
+
+static int sim_fd[CAPTURE_MAX_SENSORS];
+static int sim_count;
+static volatile int sim_stop;
+
+static void *capture_simulator(void *arg)
+{
+	struct timespec echo = { 0, 1000000 }, gap = { 0, 4000000 };
+	int i;
+
+	while(!sim_stop)
+	{
+		for(i = 0; i < sim_count; i++)
+			edge_emit(sim_fd[i], 1);
+		nanosleep(&echo, NULL);
+		for(i = 0; i < sim_count; i++)
+			edge_emit(sim_fd[i], 0);
+		nanosleep(&gap, NULL);
+	}
+	return NULL;
+}
+
+static unsigned long long bench_samples;
+
+static void capture_count(struct capture_engine *eng, struct capture_sensor *s,
+	const struct echo_pulse *p)
+{
+	if(p->valid)
+		bench_samples++;
+}
+
+static int bench_capture(void)
+{
+	static const unsigned int pins[] = { 100, 101, 102, 103, 104, 105, 106, 107 };
+	static struct capture_engine eng;
+	static const int sizes[] = { 1, 2, 4, 8 };
+	struct timespec c0, c1;
+	unsigned long long t0, cpu;
+	pthread_t sim;
+	int pfd[CAPTURE_MAX_SENSORS][2];
+	int k, i;
+
+	if(fake_sysfs_create(pins, CAPTURE_MAX_SENSORS) < 0)
+		return -1;
+
+	printf("capture engine, %d ms per run, simulated edge sources\n",
+		CAPTURE_BENCH_MS);
+
+	for(k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++)
+	{
+		capture_init(&eng, capture_count, NULL);
+		sim_count = sizes[k];
+		for(i = 0; i < sim_count; i++)
+		{
+			if(pipe(pfd[i]) < 0)
+				return -1;
+			sim_fd[i] = pfd[i][1];
+			capture_add_fd(&eng, pins[i], pfd[i][0], 1);
+			eng.sensor[i].period_ns = 0;
+		}
+
+		bench_samples = 0;
+		sim_stop = 0;
+		pthread_create(&sim, NULL, capture_simulator, NULL);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+		t0 = bench_now_ns();
+		while(bench_now_ns() - t0 < CAPTURE_BENCH_MS * 1000000ULL)
+			capture_run_once(&eng);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+		sim_stop = 1;
+		pthread_join(sim, NULL);
+
+		cpu = (c1.tv_sec - c0.tv_sec) * 1000000000ULL + c1.tv_nsec - c0.tv_nsec;
+		printf("  %d sensors: %6llu samples/s  %8.1f us CPU/sample  %5.1f%% of a core\n",
+			sim_count, bench_samples * 1000 / CAPTURE_BENCH_MS,
+			bench_samples ? cpu / 1000.0 / bench_samples : 0.0,
+			cpu / (CAPTURE_BENCH_MS * 10000.0));
+
+		capture_close(&eng);
+		for(i = 0; i < sim_count; i++)
+			__real_close(pfd[i][1]);
+	}
+
+	fake_sysfs_destroy();
+	return 0;
+}
+
+/*
+ * Trigger scheduler on a simulated array, in virtual time: four sensors
+ * in a row where neighbours hear each other, each with its own echo time
+ * of flight, the default max range window and recovery time.
+ */
+#define SCHED_SENSORS 4
+#define SCHED_SECONDS 10ULL
+
+static const unsigned long long sched_tof_ns[SCHED_SENSORS] = {
+	3000000, 6000000, 12000000, 20000000,
+};
+
+static unsigned long long sched_simulate(struct capture_engine *eng,
+	unsigned long long *crosstalk)
+{
+	unsigned long long now = 0, wake, next, end = SCHED_SECONDS * 1000000000ULL;
+	unsigned long long done_at[SCHED_SENSORS];
+	unsigned long long total = 0;
+	unsigned int i, j, fire;
+
+	*crosstalk = 0;
+	while(now < end)
+	{
+		fire = capture_plan(eng, now, &wake);
+		for(i = 0; i < eng->count; i++)
+		{
+			if(!(fire & (1U << i)))
+				continue;
+			for(j = 0; j < eng->count; j++)
+			{
+				if(j != i && eng->sensor[j].busy_until_ns > now &&
+					(eng->sensor[i].conflicts & (1U << j)))
+					(*crosstalk)++;
+			}
+			capture_fired(&eng->sensor[i], now);
+			done_at[i] = now + sched_tof_ns[i];
+		}
+
+		next = wake;
+		for(i = 0; i < eng->count; i++)
+			if(eng->sensor[i].state != CAPTURE_IDLE && done_at[i] < next)
+				next = done_at[i];
+		if(next == ~0ULL)
+			break;
+		now = next;
+
+		for(i = 0; i < eng->count; i++)
+		{
+			if(eng->sensor[i].state != CAPTURE_IDLE && done_at[i] <= now)
+			{
+				capture_done(&eng->sensor[i], now);
+				eng->sensor[i].samples++;
+				total++;
+			}
+		}
+	}
+	return total;
+}
+
+static void sched_setup(struct capture_engine *eng, int with_conflicts)
+{
+	unsigned int i;
+
+	memset(eng, 0, sizeof(*eng));
+	eng->count = SCHED_SENSORS;
+	for(i = 0; i < SCHED_SENSORS; i++)
+	{
+		eng->sensor[i].id = i;
+		eng->sensor[i].timeout_ns = echo_timeout_ns(ECHO_MAX_RANGE_CM);
+		eng->sensor[i].recovery_ns = ECHO_RECOVERY_NS;
+	}
+	if(with_conflicts)
+		for(i = 0; i + 1 < SCHED_SENSORS; i++)
+			capture_set_conflict(eng, i, i + 1);
+}
+
+static int bench_sched(void)
+{
+	static struct capture_engine eng;
+	unsigned long long total, crosstalk, cycle = 0;
+	unsigned int i;
+
+	printf("trigger scheduler, %d sensors, neighbours conflict, %llu s simulated\n",
+		SCHED_SENSORS, SCHED_SECONDS);
+
+	/* the old way: one after the other, echo then a 600 ms sleep */
+	for(i = 0; i < SCHED_SENSORS; i++)
+		cycle += sched_tof_ns[i] + 600000000ULL;
+	printf("  round robin + usleep(600000): %.2f samples/s per sensor, %.2f total\n",
+		1e9 / cycle, SCHED_SENSORS * 1e9 / cycle);
+
+	sched_setup(&eng, 0);
+	total = sched_simulate(&eng, &crosstalk);
+	printf("  all sensors free running:     %.2f samples/s total (ignores crosstalk)\n",
+		(double)total / SCHED_SECONDS);
+
+	sched_setup(&eng, 1);
+	total = sched_simulate(&eng, &crosstalk);
+	printf("  staggered schedule:           %.2f samples/s total, %llu overlapping fires\n",
+		(double)total / SCHED_SECONDS, crosstalk);
+	for(i = 0; i < SCHED_SENSORS; i++)
+		printf("    sensor %u: %.2f samples/s\n", i,
+			(double)eng.sensor[i].samples / SCHED_SECONDS);
+
+	return crosstalk ? -1 : 0;
+}
+
+/*
+ * Filter pipeline on a synthetic walk trace: a target oscillating between
+ * 30 and 150 cm at 40 cm/s, sampled at 40 Hz with 1 cm gaussian noise and
+ * 3% wild readings. Direction flips of the old raw-difference logic and
+ * of the filter are compared with the true number of turns.
+ */
+#define TRACE_HZ 40
+#define TRACE_SECONDS 120
+#define TRACE_LEN (TRACE_HZ * TRACE_SECONDS)
+
+static unsigned long long trace_rng = 88172645463325252ULL;
+
+static double trace_uniform(void)
+{
+	trace_rng ^= trace_rng << 13;
+	trace_rng ^= trace_rng >> 7;
+	trace_rng ^= trace_rng << 17;
+	return (trace_rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double trace_gauss(void)
+{
+	double u = trace_uniform() + 1e-12, v = trace_uniform();
+
+	return sqrt(-2.0 * log(u)) * cos(2 * M_PI * v);
+}
+
+/*
+ * Fills @trace and returns the number of real direction changes.
+ */
+static int trace_make(struct sample *trace, char *truth)
+{
+	double pos = 150.0, vel = -40.0, z;
+	int i, turns = 0;
+
+	for(i = 0; i < TRACE_LEN; i++)
+	{
+		pos += vel / TRACE_HZ;
+		if((pos < 30.0 && vel < 0) || (pos > 150.0 && vel > 0))
+		{
+			vel = -vel;
+			turns++;
+		}
+		truth[i] = (vel > 0) ? 'R' : 'L';
+
+		z = pos + trace_gauss();
+		if(trace_uniform() < 0.03)
+			z = trace_uniform() * 400.0;
+
+		memset(&trace[i], 0, sizeof(trace[i]));
+		trace[i].seq = i + 1;
+		trace[i].timestamp_ns = (unsigned long long)i * (1000000000ULL / TRACE_HZ);
+		trace[i].distance_um = (unsigned long long)(z * 10000.0);
+		trace[i].valid = 1;
+	}
+	return turns;
+}
+
+static int bench_filter(void)
+{
+	static struct sample trace[TRACE_LEN];
+	static char truth[TRACE_LEN];
+	struct filter_config cfg;
+	struct filter f;
+	double prev = 0, cur, diff, thr;
+	char dir = 'L', last;
+	int i, k, turns, flips_raw = 0, flips_filt = 0, wrong_raw = 0, wrong_filt = 0;
+	unsigned long long t0;
+
+	turns = trace_make(trace, truth);
+	printf("filter pipeline, %d s synthetic walk at %d Hz, %d real turns\n",
+		TRACE_SECONDS, TRACE_HZ, turns);
+
+	/* the old logic: 10% threshold on consecutive raw readings */
+	for(i = 0; i < TRACE_LEN; i++)
+	{
+		cur = trace[i].distance_um / 10000.0;
+		diff = cur - prev;
+		thr = cur / 10.0;
+		last = dir;
+		if(diff > thr)
+			dir = 'R';
+		else if(diff < -thr)
+			dir = 'L';
+		flips_raw += (dir != last);
+		wrong_raw += (dir != truth[i]);
+		prev = cur;
+	}
+
+	filter_default_config(&cfg);
+	filter_init(&f, &cfg);
+	for(i = 0; i < TRACE_LEN; i++)
+	{
+		last = f.direction;
+		filter_update(&f, &trace[i]);
+		flips_filt += (f.direction != last);
+		wrong_filt += (f.direction != truth[i]);
+	}
+
+	printf("  raw difference:  %5d direction flips, wrong %5.1f%% of the time\n",
+		flips_raw, 100.0 * wrong_raw / TRACE_LEN);
+	printf("  median+kalman:   %5d direction flips, wrong %5.1f%% of the time\n",
+		flips_filt, 100.0 * wrong_filt / TRACE_LEN);
+
+	t0 = bench_now_ns();
+	for(k = 0; k < 50; k++)
+	{
+		filter_init(&f, &cfg);
+		for(i = 0; i < TRACE_LEN; i++)
+			filter_update(&f, &trace[i]);
+	}
+	printf("  cost: %.1f ns/sample\n", (double)(bench_now_ns() - t0) / (50.0 * TRACE_LEN));
+	return 0;
+}
+
+static int bench_stats(void)
+{
+	unsigned long long t0, v, lo, a, b;
+	double err, worst = 0;
+	int i;
+
+	if(tsc_calibrate() < 0)
+		return -1;
+	stats_reset(stats);
+	printf("stats, %d records\n", BENCH_ITERATIONS);
+
+	/* every bucket must start within 1/STATS_SUB of what it holds */
+	for(v = 1; v < (1ULL << 36); v += v / 7 + 1)
+	{
+		lo = stats_bucket_ns(stats_bucket(v));
+		err = (double)(v - lo) / v;
+		if(lo > v || err > 1.0 / STATS_SUB)
+		{
+			printf("  bucket of %llu starts at %llu\n", v, lo);
+			return -1;
+		}
+		if(err > worst)
+			worst = err;
+	}
+	printf("  %d buckets, worst bucket error %.1f%%\n", STATS_BUCKETS, worst * 100);
+
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_ITERATIONS; i++)
+		stats_record_ns(STAT_PULSE_WIDTH, 1000 + i);
+	printf("  stats_record_ns         %6.1f ns/op\n",
+		(double)(bench_now_ns() - t0) / BENCH_ITERATIONS);
+
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		a = stats_stamp();
+		b = stats_stamp();
+		stats_record_ticks(STAT_FRAME_PUSH, a, b);
+	}
+	printf("  2 stamps + record       %6.1f ns/op\n",
+		(double)(bench_now_ns() - t0) / BENCH_ITERATIONS);
+
+	t0 = bench_now_ns();
+	for(i = 0; i < BENCH_ITERATIONS; i++)
+		stats_count(STAT_FRAMES);
+	printf("  stats_count             %6.1f ns/op\n",
+		(double)(bench_now_ns() - t0) / BENCH_ITERATIONS);
+	stats_print(stdout, stats);
+	return 0;
+}
+
+/* The board pin table of main.c */
+static const struct gpio_pin_cfg startup_pins[] = {
+	{ 11, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 13, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 14, GPIO_DIRECTION_IN, GPIO_VALUE_KEEP },
+	{ 32, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 34, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 16, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 77, GPIO_DIRECTION_KEEP, GPIO_VALUE_LOW },
+	{ 76, GPIO_DIRECTION_KEEP, GPIO_VALUE_LOW },
+	{ 64, GPIO_DIRECTION_KEEP, GPIO_VALUE_LOW },
+	{ 72, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 44, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 46, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 15, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 24, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 42, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 30, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 25, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 43, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 31, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+};
+
+#define STARTUP_PINS (sizeof(startup_pins) / sizeof(startup_pins[0]))
+
+/* The original sysfs helpers: path formatting plus open/write/close. */
+static void legacy_attr(const char *path, const char *str)
+{
+	int fd = open(path, O_WRONLY);
+
+	if(fd >= 0)
+	{
+		write(fd, str, strlen(str));
+		close(fd);
+	}
+}
+
+/* The original init_sequence(): export, direction and value, every pin */
+static void legacy_init_sequence(void)
+{
+	const struct gpio_pin_cfg *p;
+	char buf[GPIO_PATH_MAX], num[16];
+	unsigned int i;
+
+	for(i = 0; i < STARTUP_PINS; i++)
+	{
+		p = &startup_pins[i];
+		snprintf(buf, sizeof(buf), "%s/export", fake_root);
+		snprintf(num, sizeof(num), "%u", p->gpio);
+		legacy_attr(buf, num);
+		if(p->dir != GPIO_DIRECTION_KEEP)
+		{
+			snprintf(buf, sizeof(buf), "%s/gpio%u/direction", fake_root, p->gpio);
+			legacy_attr(buf, (p->dir == GPIO_DIRECTION_IN) ? "in" : "out");
+		}
+		if(p->value != GPIO_VALUE_KEEP)
+			legacy_set_value(p->gpio, p->value);
+	}
+}
+
+static int bench_startup(void)
+{
+	static const uint8_t legacy_regs[][2] = {
+		{ 0x0F, 0x01 }, { 0x0F, 0x00 }, { 0x09, 0x00 },
+		{ 0x0A, 0x00 }, { 0x0B, 0x07 }, { 0x0C, 0x01 },
+	};
+	static struct spi_frame frame;
+	static struct max7219_chain display;
+	unsigned int pins[STARTUP_PINS], i;
+	unsigned long long t0;
+	unsigned long s0;
+	int changed;
+
+	for(i = 0; i < STARTUP_PINS; i++)
+		pins[i] = startup_pins[i].gpio;
+	if(fake_sysfs_create(pins, STARTUP_PINS) < 0)
+		return -1;
+	bench_spi_fd = __real_open("/dev/null", O_RDWR);
+
+	printf("start up, %u board pins and MAX7219 setup\n", (unsigned int)STARTUP_PINS);
+
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	legacy_init_sequence();
+	bench_report("init_sequence (old)", 1, bench_syscalls - s0, bench_now_ns() - t0);
+
+	/* cold: every pin as a fresh export leaves it, input and low */
+	fake_sysfs_destroy();
+	if(fake_sysfs_create(pins, STARTUP_PINS) < 0)
+		return -1;
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	changed = gpio_apply(startup_pins, STARTUP_PINS);
+	bench_report("gpio_apply, cold", 1, bench_syscalls - s0, bench_now_ns() - t0);
+	printf("    %d pins changed\n", changed);
+
+	/* warm: a restart, pins already right, no cached fds */
+	while(gpio_apply(startup_pins, STARTUP_PINS) > 0)
+		;
+	gpio_handle_close_all();
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	changed = gpio_apply(startup_pins, STARTUP_PINS);
+	bench_report("gpio_apply, warm restart", 1, bench_syscalls - s0, bench_now_ns() - t0);
+	printf("    %d pins changed\n", changed);
+
+	spi_frame_init(&frame, bench_spi_fd, 15);
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < sizeof(legacy_regs) / sizeof(legacy_regs[0]); i++)
+	{
+		spi_frame_add(&frame, legacy_regs[i][0], legacy_regs[i][1]);
+		spi_frame_submit(&frame);
+	}
+	bench_frame_fill(&frame, 0);
+	spi_frame_submit(&frame);
+	bench_report("MAX7219 setup (old)", 1, bench_syscalls - s0, bench_now_ns() - t0);
+	printf("    plus %d ms of usleep\n", (int)(sizeof(legacy_regs) / sizeof(legacy_regs[0])) * 100);
+
+	max7219_chain_init(&display, &frame, 1, MAX7219_FULL_REFRESH);
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	max7219_chain_start(&display);
+	bench_report("max7219_chain_start", 1, bench_syscalls - s0, bench_now_ns() - t0);
+
+	__real_close(bench_spi_fd);
+	bench_spi_fd = -1;
+	fake_sysfs_destroy();
+	return 0;
+}
+
+#define FRAMES_PERIOD_NS 10000000ULL	/* 100 fps */
+#define FRAMES_COUNT 300
+#define FRAMES_FAR_NS 600000000ULL	/* the display's near/far periods */
+#define FRAMES_NEAR_NS 60000000ULL
+
+/* Stand-in for preparing and pushing a frame: 0 to 3 ms of CPU */
+static void frames_work(int i)
+{
+	unsigned long long end = bench_now_ns() + (i * 7919ULL % 3000) * 1000;
+
+	while(bench_now_ns() < end)
+		;
+}
+
+static void frames_report(const char *what, const unsigned long long *t, int missed)
+{
+	double mean = (double)(t[FRAMES_COUNT - 1] - t[0]) / (FRAMES_COUNT - 1);
+	double err, sum = 0, sq = 0;
+	int i;
+
+	/* jitter: distance of each frame from its ideal slot */
+	for(i = 0; i < FRAMES_COUNT; i++)
+	{
+		err = (double)(t[i] - t[0]) - (double)i * FRAMES_PERIOD_NS;
+		sum += err;
+		sq += err * err;
+	}
+	printf("  %-16s period %8.3f ms, drift %8.2f ms after %d frames, "
+		"slot error sd %7.1f us, %d missed\n", what, mean / 1e6,
+		(double)(t[FRAMES_COUNT - 1] - t[0]) / 1e6 -
+		(double)(FRAMES_COUNT - 1) * FRAMES_PERIOD_NS / 1e6, FRAMES_COUNT,
+		sqrt(sq / FRAMES_COUNT - (sum / FRAMES_COUNT) * (sum / FRAMES_COUNT)) / 1e3,
+		missed);
+}
+
+/*
+ * Period change between two ticks, as display_frame() makes it: the very
+ * next wakeup must come @to_ns after the last one, not @from_ns.
+ */
+static int frames_switch(unsigned long long from_ns, unsigned long long to_ns)
+{
+	struct frame_sched fs;
+	unsigned long long t0, gap;
+
+	frame_sched_init(&fs, from_ns);
+	frame_sched_wait(&fs);
+	frame_sched_wait(&fs);
+	t0 = bench_now_ns();
+	frame_sched_set_period(&fs, to_ns);
+	frame_sched_wait(&fs);
+	gap = bench_now_ns() - t0;
+	printf("  %3llu -> %3llu ms period, next wakeup after %7.1f ms\n",
+		from_ns / 1000000, to_ns / 1000000, gap / 1e6);
+	return (gap + 1000000 < to_ns || gap > to_ns + 5000000) ? -1 : 0;
+}
+
+static int bench_frames(void)
+{
+	static unsigned long long t[FRAMES_COUNT];
+	struct frame_sched fs;
+	int i, missed = 0;
+
+	printf("frame pacing at %llu fps with 0-3 ms of work per frame\n",
+		1000000000ULL / FRAMES_PERIOD_NS);
+
+	for(i = 0; i < FRAMES_COUNT; i++)
+	{
+		t[i] = bench_now_ns();
+		frames_work(i);
+		usleep(FRAMES_PERIOD_NS / 1000);
+	}
+	frames_report("usleep(period)", t, 0);
+
+	frame_sched_init(&fs, FRAMES_PERIOD_NS);
+	for(i = 0; i < FRAMES_COUNT; i++)
+	{
+		missed += frame_sched_wait(&fs);
+		t[i] = bench_now_ns();
+		frames_work(i);
+	}
+	frames_report("frame_sched", t, missed);
+	printf("  frame_sched worst wakeup %.1f us late\n", fs.max_late_ns / 1e3);
+
+	return (frames_switch(FRAMES_FAR_NS, FRAMES_NEAR_NS) < 0 ||
+		frames_switch(FRAMES_NEAR_NS, FRAMES_FAR_NS) < 0) ? -1 : 0;
+}
+
+#define TRIGGER_PULSES 2000
+
+static const unsigned long long trigger_bins_us[] = { 11, 13, 15, 20, 30, 50, 100, 1000 };
+#define TRIGGER_BINS (sizeof(trigger_bins_us) / sizeof(trigger_bins_us[0]))
+
+static volatile int trigger_hog_run;
+
+/* Competing CPU load at normal priority */
+static void *trigger_hog(void *arg)
+{
+	while(trigger_hog_run)
+		;
+	return NULL;
+}
+
+static void trigger_report(const char *what, unsigned long long *w)
+{
+	unsigned int bins[TRIGGER_BINS + 1] = { 0 };
+	unsigned long long max = 0;
+	unsigned int i, b;
+
+	for(i = 0; i < TRIGGER_PULSES; i++)
+	{
+		for(b = 0; b < TRIGGER_BINS && w[i] >= trigger_bins_us[b] * 1000; b++)
+			;
+		bins[b]++;
+		if(w[i] > max)
+			max = w[i];
+	}
+	printf("  %-22s", what);
+	for(b = 0; b <= TRIGGER_BINS; b++)
+		printf(" %5u", bins[b]);
+	printf("   max %8.1f us\n", max / 1e3);
+}
+
+/* The old pulse: high, usleep, low, timed like echo_trigger() */
+static unsigned long long trigger_usleep(unsigned int gpio)
+{
+	unsigned long long t0, t1, t2, t3;
+
+	t0 = my_rdtsc();
+	gpio_set_value(gpio, GPIO_VALUE_HIGH);
+	t1 = my_rdtsc();
+	usleep(ECHO_TRIGGER_NS / 1000);
+	t2 = my_rdtsc();
+	gpio_set_value(gpio, GPIO_VALUE_LOW);
+	t3 = my_rdtsc();
+	return tsc_to_ns((t2 + t3) / 2 - (t0 + t1) / 2);
+}
+
+static int bench_trigger(void)
+{
+	static const unsigned int pins[] = { 11 };
+	static unsigned long long w[TRIGGER_PULSES];
+	struct echo_sensor s;
+	pthread_t hog;
+	unsigned int i, b;
+	int load;
+
+	if(tsc_calibrate() < 0 || fake_sysfs_create(pins, 1) < 0)
+		return -1;
+	memset(&s, 0, sizeof(s));
+	s.trig_gpio = 11;
+	s.rt_cpu = -1;
+	gpio_set_value(11, GPIO_VALUE_LOW);
+
+	printf("trigger pulse width, %d pulses of %llu us, histogram by us:\n  %-22s",
+		TRIGGER_PULSES, ECHO_TRIGGER_NS / 1000, "");
+	for(b = 0; b < TRIGGER_BINS; b++)
+		printf(" <%-4llu", trigger_bins_us[b]);
+	printf(" more\n");
+
+	for(load = 0; load < 2; load++)
+	{
+		if(load)
+		{
+			trigger_hog_run = 1;
+			pthread_create(&hog, NULL, trigger_hog, NULL);
+			printf(" with a CPU hog:\n");
+		}
+
+		for(i = 0; i < TRIGGER_PULSES; i++)
+			w[i] = trigger_usleep(11);
+		trigger_report("usleep", w);
+
+		echo_set_trigger_rt(&s, 0, -1);
+		for(i = 0; i < TRIGGER_PULSES; i++)
+			w[i] = echo_trigger(&s);
+		trigger_report("tsc spin", w);
+
+		echo_set_trigger_rt(&s, 1, 0);
+		for(i = 0; i < TRIGGER_PULSES; i++)
+			w[i] = echo_trigger(&s);
+		trigger_report(s.rt_trigger ? "tsc spin, SCHED_FIFO" : "tsc spin, no FIFO", w);
+
+		if(load)
+		{
+			trigger_hog_run = 0;
+			pthread_join(hog, NULL);
+		}
+	}
+
+	fake_sysfs_destroy();
+	return 0;
+}
+
+#define CYCLIC_LOOPS 3000
+#define CYCLIC_PERIOD_NS 1000000ULL
+
+static unsigned long long cyclic_lat[CYCLIC_LOOPS];
+static volatile int cyclic_load_run;
+
+/* Background load: spins and keeps faulting in fresh memory */
+static void *cyclic_load(void *arg)
+{
+	char *buf;
+
+	while(cyclic_load_run)
+	{
+		buf = malloc(1 << 20);
+		if(buf != NULL)
+		{
+			memset(buf, 1, 1 << 20);
+			free(buf);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * cyclictest on the capture loop's wait: epoll on a timerfd armed for an
+ * absolute deadline every CYCLIC_PERIOD_NS, latency is wakeup - deadline.
+ */
+static void *cyclic_loop(void *arg)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct itimerspec its;
+	unsigned long long next, now, expirations;
+	int i, tfd, epfd;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+	memset(&its, 0, sizeof(its));
+
+	next = capture_now_ns() + CYCLIC_PERIOD_NS;
+	for(i = 0; i < CYCLIC_LOOPS; i++)
+	{
+		its.it_value.tv_sec = next / 1000000000ULL;
+		its.it_value.tv_nsec = next % 1000000000ULL;
+		timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+		while(epoll_wait(epfd, &ev, 1, -1) < 1)
+			;
+		now = capture_now_ns();
+		read(tfd, &expirations, sizeof(expirations));
+		cyclic_lat[i] = now - next;
+		next += CYCLIC_PERIOD_NS;
+	}
+	close(epfd);
+	close(tfd);
+	return NULL;
+}
+
+static int cyclic_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void cyclic_run(const char *what, struct rt_thread *t, int profile,
+	int load)
+{
+	pthread_t hog;
+	unsigned long long sum = 0;
+	int i;
+
+	if(load)
+	{
+		cyclic_load_run = 1;
+		pthread_create(&hog, NULL, cyclic_load, NULL);
+	}
+	if(rt_thread_start(t, profile) > -2)
+		pthread_join(t->id, NULL);
+	if(load)
+	{
+		cyclic_load_run = 0;
+		pthread_join(hog, NULL);
+	}
+
+	for(i = 0; i < CYCLIC_LOOPS; i++)
+		sum += cyclic_lat[i];
+	qsort(cyclic_lat, CYCLIC_LOOPS, sizeof(cyclic_lat[0]), cyclic_cmp);
+	printf("  %-26s %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f\n", what,
+		cyclic_lat[0] / 1e3, (double)sum / CYCLIC_LOOPS / 1e3,
+		cyclic_lat[CYCLIC_LOOPS / 2] / 1e3,
+		cyclic_lat[CYCLIC_LOOPS * 99 / 100] / 1e3,
+		cyclic_lat[CYCLIC_LOOPS * 999 / 1000] / 1e3,
+		cyclic_lat[CYCLIC_LOOPS - 1] / 1e3);
+}
+
+static int bench_cyclic(void)
+{
+	static const struct rt_thread_cfg cfg = {
+		.name = "cyclic", .policy = SCHED_FIFO, .priority = 80, .cpu = 0,
+	};
+	struct rt_thread t = { .cfg = &cfg, .fn = cyclic_loop };
+
+	printf("capture loop wakeup latency, %d cycles of %llu us (us):\n", CYCLIC_LOOPS,
+		CYCLIC_PERIOD_NS / 1000);
+	printf("  %-26s %8s %8s %8s %8s %8s %9s\n", "", "min", "avg", "p50", "p99",
+		"p99.9", "max");
+	cyclic_run("default", &t, 0, 0);
+	cyclic_run("default, loaded", &t, 0, 1);
+
+	/* from here on the whole process stays locked */
+	rt_lock_memory();
+	cyclic_run("rt profile", &t, 1, 0);
+	cyclic_run("rt profile, loaded", &t, 1, 1);
+	return 0;
+}
+
+#define MEASLOG_BENCH_RECORDS 2000000
+#define MEASLOG_BENCH_RATE_NS 200000ULL	/* 5000 samples/s */
+#define MEASLOG_BENCH_PACED 10000
+
+static struct measlog bench_log;
+static unsigned long long measlog_cost[MEASLOG_BENCH_PACED];
+
+static void measlog_cost_report(const char *what)
+{
+	qsort(measlog_cost, MEASLOG_BENCH_PACED, sizeof(measlog_cost[0]), cyclic_cmp);
+	printf("  %-30s p50 %8.0f ns  p99 %8.0f ns  max %9.0f ns\n", what,
+		tsc_to_ns(measlog_cost[MEASLOG_BENCH_PACED / 2]) * 1.0,
+		tsc_to_ns(measlog_cost[MEASLOG_BENCH_PACED * 99 / 100]) * 1.0,
+		tsc_to_ns(measlog_cost[MEASLOG_BENCH_PACED - 1]) * 1.0);
+}
+
+/* Per-sample cost at 5000 samples/s, paced on absolute deadlines */
+static void measlog_paced(FILE *text)
+{
+	struct timespec ts;
+	unsigned long long next = capture_now_ns(), t0, d;
+	int i;
+
+	for(i = 0; i < MEASLOG_BENCH_PACED; i++)
+	{
+		next += MEASLOG_BENCH_RATE_NS;
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		d = 100000 + i % 4000000;
+		t0 = my_rdtsc();
+		if(text != NULL)
+			fprintf(text, "Distance is %0.2f \n", d / 10000.0);
+		else
+			measlog_append(&bench_log, 0, t0, t0 + 480000, t0 + 480000 + d * 100 / 17, d,
+				MEASLOG_VALID);
+		measlog_cost[i] = my_rdtsc() - t0;
+	}
+}
+
+static int bench_measlog(void)
+{
+	static const char path[] = "/tmp/bench.mlog";
+	pthread_t flusher;
+	unsigned long long t0;
+	FILE *text;
+	int i;
+
+	if(tsc_calibrate() < 0 || measlog_open(&bench_log, path, MEASLOG_RECORDS) < 0)
+		return -1;
+	pthread_create(&flusher, NULL, measlog_flusher, &bench_log);
+
+	printf("measurement log, %d slots, flushed every %d ms:\n", MEASLOG_RECORDS,
+		MEASLOG_FLUSH_MS);
+	t0 = bench_now_ns();
+	for(i = 0; i < MEASLOG_BENCH_RECORDS; i++)
+		measlog_append(&bench_log, i & 7, t0 + i, t0 + i + 480000, t0 + i + 485800,
+			i & 0xfffff, MEASLOG_VALID);
+	printf("  append, back to back          %8.1f ns/record, %.1f M records/s\n",
+		(double)(bench_now_ns() - t0) / MEASLOG_BENCH_RECORDS,
+		MEASLOG_BENCH_RECORDS * 1e3 / (bench_now_ns() - t0));
+
+	printf(" per sample at %llu samples/s:\n", 1000000000ULL / MEASLOG_BENCH_RATE_NS);
+	/* a terminal is line buffered too, and slower than /dev/null */
+	text = fopen("/dev/null", "w");
+	setvbuf(text, NULL, _IOLBF, 0);
+	measlog_paced(text);
+	measlog_cost_report("printf, line buffered");
+	fclose(text);
+
+	measlog_paced(NULL);
+	measlog_cost_report("measlog_append");
+
+	bench_log.stop = 1;
+	pthread_join(flusher, NULL);
+	printf("  %llu records written, log in %s\n", bench_log.next - 1, path);
+	measlog_close(&bench_log);
+	return 0;
+}
+
+/*
+ * Frame push time against chain length, every row changing every frame.
+ * The per-device push is what single device code costs on a chain: each
+ * register write is a full length message, the other devices padded with
+ * no-ops, so every device row is its own latch. Wire time is what the
+ * frame takes on the bus at SPI_SPEED_HZ and is the same either way.
+ */
+#define CHAIN_FRAMES 2000
+
+static const unsigned int chain_lengths[] = { 1, 2, 4, 8, 16, 32 };
+
+static void chain_fill(struct max7219_chain *chain, int k)
+{
+	unsigned int i, d;
+
+	for(d = 0; d < chain->n; d++)
+		for(i = 1; i <= MAX7219_DIGITS; i++)
+			max7219_chain_set_digit(chain, d, i, (uint8_t)(i * 31 + d + k));
+}
+
+static int bench_chain(void)
+{
+	static const unsigned int pins[] = { 15 };
+	static uint8_t pad[MAX7219_DIGITS][MAX7219_CHAIN_MAX * 2];
+	static struct max7219_chain chain;
+	static struct spi_frame frame;
+	unsigned long long t0, per_dev, gpio_cs, native_cs;
+	unsigned long s0, sc_dev, sc_gpio, sc_native;
+	unsigned int c, n, d, i;
+	int k;
+
+	if(fake_sysfs_create(pins, 1) < 0)
+		return -1;
+	bench_spi_fd = __real_open("/dev/null", O_RDWR);
+
+	printf("wall frame push, %d frames, all rows changing, stand-in spidev\n",
+		CHAIN_FRAMES);
+	printf("  %7s %8s  %-22s %-22s %-22s\n", "devices", "wire us",
+		"per-device, GPIO CS", "chain, GPIO CS", "chain, native CS");
+
+	for(c = 0; c < sizeof(chain_lengths) / sizeof(chain_lengths[0]); c++)
+	{
+		n = chain_lengths[c];
+
+		spi_frame_init(&frame, bench_spi_fd, 15);
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < CHAIN_FRAMES; k++)
+		{
+			for(d = 0; d < n; d++)
+			{
+				spi_frame_reset(&frame);
+				for(i = 0; i < MAX7219_DIGITS; i++)
+				{
+					memset(pad[i], MAX7219_REG_NOOP, n * 2);
+					pad[i][2 * (n - 1 - d)] = i + 1;
+					pad[i][2 * (n - 1 - d) + 1] = (uint8_t)((i + 1) * 31 + d + k);
+					spi_frame_add_buf(&frame, pad[i], n * 2);
+				}
+				spi_frame_submit(&frame);
+			}
+		}
+		per_dev = bench_now_ns() - t0;
+		sc_dev = bench_syscalls - s0;
+
+		max7219_chain_init(&chain, &frame, n, 0);
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < CHAIN_FRAMES; k++)
+		{
+			chain_fill(&chain, k);
+			max7219_chain_flush(&chain);
+		}
+		gpio_cs = bench_now_ns() - t0;
+		sc_gpio = bench_syscalls - s0;
+
+		spi_frame_init(&frame, bench_spi_fd, SPI_CS_NATIVE);
+		max7219_chain_init(&chain, &frame, n, 0);
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < CHAIN_FRAMES; k++)
+		{
+			chain_fill(&chain, k);
+			max7219_chain_flush(&chain);
+		}
+		native_cs = bench_now_ns() - t0;
+		sc_native = bench_syscalls - s0;
+
+		printf("  %7u %8.1f  %6.1f us %5.0f sc/f    %6.1f us %5.0f sc/f    "
+			"%6.1f us %5.0f sc/f\n", n,
+			MAX7219_DIGITS * n * 2 * 8 * 1e6 / SPI_SPEED_HZ,
+			per_dev / 1e3 / CHAIN_FRAMES, (double)sc_dev / CHAIN_FRAMES,
+			gpio_cs / 1e3 / CHAIN_FRAMES, (double)sc_gpio / CHAIN_FRAMES,
+			native_cs / 1e3 / CHAIN_FRAMES, (double)sc_native / CHAIN_FRAMES);
+	}
+
+	__real_close(bench_spi_fd);
+	bench_spi_fd = -1;
+	fake_sysfs_destroy();
+	return 0;
+}
+
+/*
+ * Marquee render cost per frame, the SPI push left out. The per-pixel
+ * renderer draws the same text through max7219_chain_set_pixel(), one
+ * pixel at a time with a bit test in the rendered text for each. The
+ * reading is taken to change every frame, so the text is re-rendered
+ * each time, which is the worst case; the last column is the usual
+ * frame that only moves the window.
+ */
+#define SCROLL_BENCH_FRAMES 20000
+#define SCROLL_BENCH_BUDGET_NS 16666667ULL
+
+static const unsigned int scroll_lengths[] = { 1, 8, 32 };
+
+static void scroll_text(char *text, size_t size, int k)
+{
+	snprintf(text, size, "%d.%dcm ", 20 + k % 380, k % 10);
+}
+
+/* Per pixel marquee on the same font, for comparison */
+static void scroll_per_pixel(struct max7219_chain *chain, const char *text,
+	unsigned int pos)
+{
+	static uint64_t bits[SCROLL_STRIP_WORDS];
+	unsigned int x, y, c, len, width = max7219_chain_width(chain);
+
+	memset(bits, 0, sizeof(bits));
+	len = font_render(bits, SCROLL_STRIP_WORDS, 0, text) + SCROLL_GAP;
+	if(len < width)
+		len = width;
+	for(x = 0; x < width; x++)
+	{
+		c = (x + pos) % len;
+		for(y = 0; y < 8; y++)
+			max7219_chain_set_pixel(chain, x, y,
+				(bits[c / 8] >> ((c % 8) * 8 + y)) & 1);
+	}
+}
+
+static int bench_scroll(void)
+{
+	static struct max7219_chain chain;
+	static struct scroll scroll;
+	static struct spi_frame frame;
+	uint64_t cols[MAX7219_CHAIN_MAX];
+	unsigned long long t0, pixel, packed, moved;
+	char text[SCROLL_TEXT_MAX + 1];
+	unsigned int c, n;
+	int k;
+
+	printf("marquee render per frame, %d frames, new reading every frame\n",
+		SCROLL_BENCH_FRAMES);
+	printf("  %7s %18s %18s %18s\n", "devices", "per pixel", "packed",
+		"packed, same text");
+
+	for(c = 0; c < sizeof(scroll_lengths) / sizeof(scroll_lengths[0]); c++)
+	{
+		n = scroll_lengths[c];
+		max7219_chain_init(&chain, &frame, n, 0);
+
+		t0 = bench_now_ns();
+		for(k = 0; k < SCROLL_BENCH_FRAMES; k++)
+		{
+			scroll_text(text, sizeof(text), k);
+			scroll_per_pixel(&chain, text, k);
+		}
+		pixel = bench_now_ns() - t0;
+
+		scroll_init(&scroll, max7219_chain_width(&chain));
+		t0 = bench_now_ns();
+		for(k = 0; k < SCROLL_BENCH_FRAMES; k++)
+		{
+			scroll_text(text, sizeof(text), k);
+			scroll_set_text(&scroll, text);
+			scroll_window(&scroll, cols, n);
+			scroll_step(&scroll, 1);
+			max7219_chain_load(&chain, cols);
+		}
+		packed = bench_now_ns() - t0;
+
+		t0 = bench_now_ns();
+		for(k = 0; k < SCROLL_BENCH_FRAMES; k++)
+		{
+			scroll_window(&scroll, cols, n);
+			scroll_step(&scroll, 1);
+			max7219_chain_load(&chain, cols);
+		}
+		moved = bench_now_ns() - t0;
+
+		printf("  %7u %15.0f ns %15.0f ns %15.0f ns\n", n,
+			(double)pixel / SCROLL_BENCH_FRAMES,
+			(double)packed / SCROLL_BENCH_FRAMES,
+			(double)moved / SCROLL_BENCH_FRAMES);
+	}
+	printf("  a 60 fps frame is %.1f ms\n", SCROLL_BENCH_BUDGET_NS / 1e6);
+	return 0;
+}
+
+/*
+ * Batches of independent sysfs accesses: N value writes, and a
+ * gpio_apply() pass over N output pins that all have to flip. Both are
+ * timed through gpio.c one pin at a time and as gpio_batch submits; the
+ * first batch of each kind, which opens and registers the fds, is left
+ * out.
+ */
+#define URING_ROUNDS 2000
+#define URING_PIN_BASE 64
+
+static const unsigned int uring_sizes[] = { 8, 16, 32 };
+
+static void uring_report(const char *what, unsigned int n, unsigned long syscalls,
+	unsigned long long ns)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%u pins, %s", n, what);
+	bench_report(name, URING_ROUNDS, syscalls, ns);
+}
+
+static int bench_uring(void)
+{
+	static struct gpio_pin_cfg cfg[32];
+	static struct gpio_batch batch;
+	struct gpio_handle *h[32];
+	unsigned int pins[32], c, n, i;
+	unsigned long long t0;
+	unsigned long s0;
+	int k;
+
+	printf("batched sysfs access, %d batches, io_uring %s\n", URING_ROUNDS,
+		gpio_uring_available() ? "in use" : "unavailable, plain writes");
+
+	for(c = 0; c < sizeof(uring_sizes) / sizeof(uring_sizes[0]); c++)
+	{
+		n = uring_sizes[c];
+		for(i = 0; i < n; i++)
+			pins[i] = URING_PIN_BASE + i;
+		if(fake_sysfs_create(pins, n) < 0)
+			return -1;
+		for(i = 0; i < n; i++)
+			h[i] = gpio_handle_open(pins[i]);
+
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < URING_ROUNDS; k++)
+			for(i = 0; i < n; i++)
+				gpio_handle_write(h[i], k & 1);
+		uring_report("pwrite each", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		for(k = -1; k < URING_ROUNDS; k++)
+		{
+			if(k == 0)
+			{
+				s0 = bench_syscalls;
+				t0 = bench_now_ns();
+			}
+			gpio_batch_reset(&batch);
+			for(i = 0; i < n; i++)
+				gpio_batch_write(&batch, h[i]->value_fd, (k & 1) ? "1" : "0");
+			gpio_batch_submit(&batch);
+		}
+		uring_report("gpio_batch", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		for(i = 0; i < n; i++)
+		{
+			cfg[i].gpio = pins[i];
+			cfg[i].dir = GPIO_DIRECTION_OUT;
+		}
+		for(k = -1; k < URING_ROUNDS; k++)
+		{
+			if(k == 0)
+			{
+				s0 = bench_syscalls;
+				t0 = bench_now_ns();
+			}
+			for(i = 0; i < n; i++)
+				cfg[i].value = k & 1;
+			gpio_sysfs_apply(cfg, n);
+		}
+		uring_report("gpio_sysfs_apply", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		for(k = -1; k < URING_ROUNDS; k++)
+		{
+			if(k == 0)
+			{
+				s0 = bench_syscalls;
+				t0 = bench_now_ns();
+			}
+			for(i = 0; i < n; i++)
+				cfg[i].value = k & 1;
+			gpio_uring_apply(cfg, n);
+		}
+		uring_report("gpio_uring_apply", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		fake_sysfs_destroy();
+	}
+	return 0;
+}
+
+/*
+ * Both-edge sysfs capture against the old per-cycle edge rewrite, on a
+ * simulated echo line. The value attribute is an AF_UNIX socket: an edge
+ * the edge attribute selects sends it an out-of-band byte, which polls
+ * as POLLPRI until the next read, as sysfs_notify() does, so edges that
+ * come before a read wake the reader once. A thread plays the sensor,
+ * answering each trigger with a pulse of the given width. The old path
+ * loses a fall that comes before its rewrite to "falling" took, and
+ * then waits out the echo timeout.
+ */
+#define BOTH_PULSES 200
+#define BOTH_SETUP_NS 100000	/* trigger to echo rise, shortened */
+#define BOTH_TIMEOUT_MS ((int)((echo_timeout_ns(ECHO_MAX_RANGE_CM) + 999999) / 1000000))
+
+static const unsigned int both_width_us[] = { 120, 300, 1000 };	/* 2, 5, 17 cm */
+
+static int echo_sim_peer = -1;
+static int echo_sim_level;
+static int echo_sim_mode;	/* bit 0 rising, bit 1 falling */
+static unsigned int echo_sim_width_ns;
+
+static void echo_sim_pwrite(int fd, const char *buf, size_t count)
+{
+	int mode;
+
+	if(count == 0)
+		return;
+	if(fd == echo_sim_trig_fd)
+	{
+		if(buf[0] == '0')
+			sem_post(&echo_sim_go);
+		return;
+	}
+	mode = (buf[0] == 'r') ? 1 : (buf[0] == 'f') ? 2 : (buf[0] == 'b') ? 3 : 0;
+	__atomic_store_n(&echo_sim_mode, mode, __ATOMIC_RELEASE);
+}
+
+static ssize_t echo_sim_pread(char *buf)
+{
+	char oob;
+
+	recv(echo_sim_fd, &oob, 1, MSG_OOB | MSG_DONTWAIT);
+	buf[0] = __atomic_load_n(&echo_sim_level, __ATOMIC_ACQUIRE) ? '1' : '0';
+	return 1;
+}
+
+static void echo_sim_edge(int level)
+{
+	__atomic_store_n(&echo_sim_level, level, __ATOMIC_RELEASE);
+	if(__atomic_load_n(&echo_sim_mode, __ATOMIC_ACQUIRE) & (level ? 1 : 2))
+		send(echo_sim_peer, "e", 1, MSG_OOB);
+}
+
+static void *echo_sim_sensor(void *arg)
+{
+	struct timespec setup = { 0, BOTH_SETUP_NS }, width = { 0, 0 };
+	unsigned long long t0;
+
+	while(1)
+	{
+		sem_wait(&echo_sim_go);
+		if(!__atomic_load_n(&echo_sim_run, __ATOMIC_ACQUIRE))
+			break;
+		nanosleep(&setup, NULL);
+		width.tv_nsec = echo_sim_width_ns;
+		t0 = bench_now_ns();
+		echo_sim_edge(1);
+		nanosleep(&width, NULL);
+		echo_sim_edge(0);
+		echo_sim_actual_ns = bench_now_ns() - t0;
+		sem_post(&echo_sim_done);
+	}
+	return NULL;
+}
+
+/* The original sysfs capture: the edge attribute rewritten twice a cycle */
+static int legacy_measure_sysfs(struct echo_sensor *s, struct echo_pulse *p)
+{
+	struct pollfd pfd = { s->value_fd, POLLPRI, 0 };
+	char ch;
+
+	memset(p, 0, sizeof(*p));
+	pread(s->value_fd, &ch, 1, 0);
+	gpio_set_edge(s->echo_gpio, "rising");
+	echo_trigger(s);
+
+	if(poll(&pfd, 1, BOTH_TIMEOUT_MS) <= 0)
+		return 0;
+	p->rise = my_rdtsc();
+	pread(s->value_fd, &ch, 1, 0);
+	pfd.revents = 0;
+	gpio_set_edge(s->echo_gpio, "falling");
+
+	if(poll(&pfd, 1, BOTH_TIMEOUT_MS) <= 0)
+		return 0;
+	p->fall = my_rdtsc();
+	pread(s->value_fd, &ch, 1, 0);
+	p->width_ns = tsc_to_ns(p->fall - p->rise);
+	p->valid = 1;
+	return 0;
+}
+
+static void both_run(const char *what, struct echo_sensor *s,
+	int (*measure)(struct echo_sensor *, struct echo_pulse *))
+{
+	struct echo_pulse p;
+	unsigned long long t0, s0, err = 0;
+	unsigned int i, valid = 0;
+
+	s->missed_edges = s->spurious_edges = 0;
+	s0 = bench_syscalls;
+	t0 = bench_now_ns();
+	for(i = 0; i < BOTH_PULSES; i++)
+	{
+		measure(s, &p);
+		sem_wait(&echo_sim_done);
+		if(p.valid)
+		{
+			valid++;
+			err += (p.width_ns > echo_sim_actual_ns) ?
+				p.width_ns - echo_sim_actual_ns : echo_sim_actual_ns - p.width_ns;
+		}
+	}
+	printf("  %-6s %4u us %6.1f%% valid %6.2f syscalls/op %7.1f us err %7.2f ms/op %4llu missed\n",
+		what, echo_sim_width_ns / 1000, 100.0 * valid / BOTH_PULSES,
+		(double)(bench_syscalls - s0) / BOTH_PULSES, valid ? err / 1e3 / valid : 0.0,
+		(bench_now_ns() - t0) / 1e6 / BOTH_PULSES, s->missed_edges);
+}
+
+static int bench_bothedge(void)
+{
+	static const unsigned int pins[] = { 23, 24 };
+	struct echo_sensor s;
+	pthread_t sensor, hog;
+	int sv[2], load;
+	unsigned int w;
+
+	if(tsc_calibrate() < 0 || fake_sysfs_create(pins, 2) < 0)
+		return -1;
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+	{
+		perror("socketpair");
+		fake_sysfs_destroy();
+		return -1;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.trig_gpio = 23;
+	s.echo_gpio = 24;
+	s.value_fd = sv[0];
+	s.line_fd = -1;
+	s.rt_cpu = -1;
+	gpio_set_value(23, GPIO_VALUE_LOW);
+	gpio_set_edge(24, "none");
+	echo_sim_trig_fd = gpio_handle_open(23)->value_fd;
+	echo_sim_edge_fd = gpio_handle_open(24)->edge_fd;
+	echo_sim_fd = sv[0];
+	echo_sim_peer = sv[1];
+	echo_sim_run = 1;
+	sem_init(&echo_sim_go, 0, 0);
+	sem_init(&echo_sim_done, 0, 0);
+	pthread_create(&sensor, NULL, echo_sim_sensor, NULL);
+
+	printf("sysfs echo capture, %d pulses per width, simulated line:\n", BOTH_PULSES);
+	for(load = 0; load < 2; load++)
+	{
+		if(load)
+		{
+			trigger_hog_run = 1;
+			pthread_create(&hog, NULL, trigger_hog, NULL);
+			printf(" with a CPU hog:\n");
+		}
+		for(w = 0; w < sizeof(both_width_us) / sizeof(both_width_us[0]); w++)
+		{
+			echo_sim_width_ns = both_width_us[w] * 1000;
+			both_run("rewrite", &s, legacy_measure_sysfs);
+			gpio_set_edge(24, "both");
+			both_run("both", &s, echo_measure);
+		}
+		if(load)
+		{
+			trigger_hog_run = 0;
+			pthread_join(hog, NULL);
+		}
+	}
+
+	__atomic_store_n(&echo_sim_run, 0, __ATOMIC_RELEASE);
+	sem_post(&echo_sim_go);
+	pthread_join(sensor, NULL);
+	echo_sim_fd = echo_sim_edge_fd = echo_sim_trig_fd = -1;
+	__real_close(sv[0]);
+	__real_close(sv[1]);
+	sem_destroy(&echo_sim_go);
+	sem_destroy(&echo_sim_done);
+	fake_sysfs_destroy();
+	return 0;
+}
+
+/*
+ * Many pins at once: N outputs written and read back pin by pin through
+ * the cached sysfs handles, against gpio_set_values()/gpio_get_values()
+ * on one line request holding all N. The gpiochip is the stand-in above,
+ * so an ioctl costs its syscall but no driver work. The first group
+ * call, which requests the lines, is left out. A pin list outside the
+ * chip shows the sysfs fallback.
+ */
+#define LINES_ROUNDS 20000
+#define LINES_SYSFS_BASE 64	/* pins past the stand-in chip */
+
+static const unsigned int lines_sizes[] = { 8, 16, 32 };
+
+static void lines_report(const char *what, unsigned int n, unsigned long syscalls,
+	unsigned long long ns)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%u pins, %s", n, what);
+	bench_report(name, LINES_ROUNDS, syscalls, ns);
+}
+
+static int bench_lines(void)
+{
+	unsigned int pins[64], values[32], c, n, i;
+	char buf[GPIO_PATH_MAX];
+	unsigned long long t0;
+	unsigned long s0;
+	int k;
+
+	printf("multi-pin GPIO, %d rounds, stand-in gpiochip\n", LINES_ROUNDS);
+	for(c = 0; c < sizeof(lines_sizes) / sizeof(lines_sizes[0]); c++)
+	{
+		n = lines_sizes[c];
+		for(i = 0; i < n; i++)
+		{
+			pins[i] = i;
+			pins[n + i] = LINES_SYSFS_BASE + i;
+		}
+		if(fake_sysfs_create(pins, 2 * n) < 0)
+			return -1;
+		snprintf(buf, sizeof(buf), "%s/gpiochip0", fake_root);
+		mkdir(buf, 0755);
+		snprintf(buf, sizeof(buf), "%s/gpiochip0/base", fake_root);
+		fake_touch(buf, "0");
+		snprintf(buf, sizeof(buf), "%s/gpiochip0/ngpio", fake_root);
+		fake_touch(buf, "64");
+		snprintf(buf, sizeof(buf), "%s/gpiochip0/device", fake_root);
+		mkdir(buf, 0755);
+		snprintf(buf, sizeof(buf), "%s/gpiochip0/device/gpiochip0", fake_root);
+		mkdir(buf, 0755);
+
+		for(i = 0; i < n; i++)
+			gpio_set_value(pins[n + i], GPIO_VALUE_LOW);
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < LINES_ROUNDS; k++)
+			for(i = 0; i < n; i++)
+				gpio_set_value(pins[n + i], k & 1);
+		lines_report("gpio_set_value each", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		for(k = -1; k < LINES_ROUNDS; k++)
+		{
+			if(k == 0)
+			{
+				s0 = bench_syscalls;
+				t0 = bench_now_ns();
+			}
+			for(i = 0; i < n; i++)
+				values[i] = k & 1;
+			gpio_set_values(pins, values, n);
+		}
+		lines_report("gpio_set_values", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		for(k = -1; k < LINES_ROUNDS; k++)
+		{
+			if(k == 0)
+			{
+				s0 = bench_syscalls;
+				t0 = bench_now_ns();
+			}
+			for(i = 0; i < n; i++)
+				values[i] = k & 1;
+			gpio_set_values(&pins[n], values, n);
+		}
+		lines_report("sysfs fallback", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < LINES_ROUNDS; k++)
+			for(i = 0; i < n; i++)
+				gpio_get_value(pins[n + i], &values[i]);
+		lines_report("gpio_get_value each", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		s0 = bench_syscalls;
+		t0 = bench_now_ns();
+		for(k = 0; k < LINES_ROUNDS; k++)
+			gpio_get_values(pins, values, n);
+		lines_report("gpio_get_values", n, bench_syscalls - s0, bench_now_ns() - t0);
+
+		fake_sysfs_destroy();
+	}
+	return 0;
+}
+
+/*
+ * Latency compensation on recorded traces: the display pipeline of
+ * main.c run offline. Frames are staged on a frame_sched timeline and
+ * each goes out one period after it was staged; the distance it shows
+ * is the model as of the last sample, as before, or the model carried
+ * forward to the time it goes out. The reference is the trace itself
+ * smoothed without lag, a centred median then a centred mean. The
+ * effective latency is the delay that best lines the shown distance up
+ * with the reference, so it covers sample age and frame pacing alike.
+ */
+#define PREDICT_NEAR_NS 60000000ULL	/* main.c frame periods */
+#define PREDICT_FAR_NS 600000000ULL
+#define PREDICT_TEXT_NS 16666667ULL
+#define PREDICT_SMOOTH 7		/* reference windows, odd */
+#define PREDICT_LAG_MIN_MS (-500)
+#define PREDICT_LAG_MAX_MS 1500
+#define PREDICT_MAX (MEASLOG_RECORDS > TRACE_LEN ? MEASLOG_RECORDS : TRACE_LEN)
+
+static struct sample predict_trace[PREDICT_MAX];
+static double predict_ref[PREDICT_MAX];
+static unsigned long long predict_show[PREDICT_MAX];
+static double predict_shown[PREDICT_MAX];
+
+/* Valid samples of sensor 0 of a measurement log, stamped at the fall */
+static int predict_load(const char *path, struct sample *trace)
+{
+	struct measlog_header hdr;
+	struct measlog_record *rec;
+	long i, count;
+	int n = 0;
+
+	count = measlog_load(path, &hdr, &rec, NULL);
+	if(count < 0)
+		return -1;
+	for(i = 0; i < count && n < PREDICT_MAX; i++)
+	{
+		if(rec[i].sensor_id != 0 || !(rec[i].flags & MEASLOG_VALID))
+			continue;
+		memset(&trace[n], 0, sizeof(trace[n]));
+		trace[n].seq = n + 1;
+		trace[n].timestamp_ns = measlog_stamp_ns(&hdr, &rec[i], rec[i].fall);
+		trace[n].distance_um = rec[i].distance_um;
+		trace[n].valid = 1;
+		n++;
+	}
+	free(rec);
+	return n;
+}
+
+static int predict_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Centred median, then centred mean, of the trace */
+static void predict_reference(const struct sample *tr, int n, double *ref)
+{
+	static double med[PREDICT_MAX];
+	double win[PREDICT_SMOOTH], sum;
+	int i, j, k, h = PREDICT_SMOOTH / 2;
+
+	for(i = 0; i < n; i++)
+	{
+		for(j = i - h, k = 0; j <= i + h; j++)
+			if(j >= 0 && j < n)
+				win[k++] = tr[j].distance_um / 10000.0;
+		qsort(win, k, sizeof(win[0]), predict_cmp);
+		med[i] = win[k / 2];
+	}
+	for(i = 0; i < n; i++)
+	{
+		for(j = i - h, k = 0, sum = 0; j <= i + h; j++)
+			if(j >= 0 && j < n)
+			{
+				sum += med[j];
+				k++;
+			}
+		ref[i] = sum / k;
+	}
+}
+
+/* Reference at @t, linear between samples */
+static double predict_ref_at(const struct sample *tr, const double *ref, int n,
+	long long t)
+{
+	int lo = 0, hi = n - 1, mid;
+	double a;
+
+	if(t <= (long long)tr[0].timestamp_ns)
+		return ref[0];
+	if(t >= (long long)tr[n - 1].timestamp_ns)
+		return ref[n - 1];
+	while(hi - lo > 1)
+	{
+		mid = (lo + hi) / 2;
+		if((long long)tr[mid].timestamp_ns <= t)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	a = (double)(t - (long long)tr[lo].timestamp_ns) /
+		(tr[hi].timestamp_ns - tr[lo].timestamp_ns);
+	return ref[lo] + a * (ref[hi] - ref[lo]);
+}
+
+/*
+ * Runs the display over the trace, paced near/far like main.c, or at
+ * @fixed_ns if not 0. Prints effective latency, error at the time each
+ * frame shows, and how often the near and direction decisions disagree
+ * with the reference where it is clear of the dead bands.
+ */
+static void predict_run(const char *what, const struct sample *tr, int n,
+	unsigned long long fixed_ns, int predict)
+{
+	struct filter_config cfg;
+	struct filter f, d;
+	struct motion m;
+	struct motion_prediction p;
+	unsigned long long t, period, ahead = 0;
+	double ref, err, sq, best_sq = -1, v_ref;
+	int i = 0, k = 0, j, lag, best_lag = 0, near_n = 0, near_bad = 0, dir_n = 0, dir_bad = 0;
+
+	filter_default_config(&cfg);
+	filter_init(&f, &cfg);
+	filter_init(&d, &cfg);
+	period = fixed_ns ? fixed_ns : PREDICT_FAR_NS;
+
+	for(t = tr[0].timestamp_ns; t < tr[n - 1].timestamp_ns; )
+	{
+		while(i < n && tr[i].timestamp_ns <= t)
+			filter_update(&f, &tr[i++]);
+		filter_motion(&f, &m);
+		motion_predict(&m, predict ? t + period : m.timestamp_ns, cfg.predict_max_s, &p);
+		filter_decide(&d, &p);
+		if(!fixed_ns && period != (d.near ? PREDICT_NEAR_NS : PREDICT_FAR_NS))
+		{
+			/* as frame_sched: the frame being staged takes the new period */
+			period = d.near ? PREDICT_NEAR_NS : PREDICT_FAR_NS;
+			if(predict)
+				motion_predict(&m, t + period, cfg.predict_max_s, &p);
+		}
+
+		predict_show[k] = t + period;
+		predict_shown[k] = p.distance_cm;
+		ahead += predict_show[k] - m.timestamp_ns;
+		ref = predict_ref_at(tr, predict_ref, n, predict_show[k]);
+		if(fabs(ref - cfg.near_cm) > cfg.near_hyst_cm)
+		{
+			near_n++;
+			near_bad += (d.near != (ref < cfg.near_cm));
+		}
+		v_ref = (predict_ref_at(tr, predict_ref, n, predict_show[k] + 50000000) -
+			predict_ref_at(tr, predict_ref, n, predict_show[k] - 50000000)) / 0.1;
+		if(fabs(v_ref) > cfg.vel_enter)
+		{
+			dir_n++;
+			dir_bad += (d.direction != (v_ref > 0 ? 'R' : 'L'));
+		}
+		k++;
+
+		t += period;
+	}
+
+	for(lag = PREDICT_LAG_MIN_MS; lag <= PREDICT_LAG_MAX_MS; lag += 5)
+	{
+		for(j = 0, sq = 0; j < k; j++)
+		{
+			err = predict_shown[j] - predict_ref_at(tr, predict_ref, n,
+				(long long)predict_show[j] - lag * 1000000LL);
+			sq += err * err;
+		}
+		if(best_sq < 0 || sq < best_sq)
+		{
+			best_sq = sq;
+			best_lag = lag;
+		}
+	}
+	for(j = 0, sq = 0; j < k; j++)
+	{
+		err = predict_shown[j] - predict_ref_at(tr, predict_ref, n, predict_show[j]);
+		sq += err * err;
+	}
+
+	printf("  %-24s %5d %7.0f ms %6.0f ms %6.1f cm %6.1f%% %6.1f%%\n", what, k,
+		ahead / 1e6 / k, (double)best_lag, sqrt(sq / k),
+		near_n ? 100.0 * near_bad / near_n : 0.0, dir_n ? 100.0 * dir_bad / dir_n : 0.0);
+}
+
+static void predict_trace_run(const struct sample *tr, int n)
+{
+	predict_reference(tr, n, predict_ref);
+	printf("  %-24s %5s %10s %9s %9s %7s %7s\n", "", "frames", "sample age",
+		"latency", "rms err", "near", "dir");
+	predict_run("near/far pacing, last", tr, n, 0, 0);
+	predict_run("near/far pacing, predicted", tr, n, 0, 1);
+	predict_run("60 fps, last", tr, n, PREDICT_TEXT_NS, 0);
+	predict_run("60 fps, predicted", tr, n, PREDICT_TEXT_NS, 1);
+}
+
+static int bench_predict(void)
+{
+	static char truth[TRACE_LEN];
+	int n;
+
+	n = predict_load(MEASLOG_PATH, predict_trace);
+	if(n > 1)
+	{
+		printf("display latency, %d samples recorded in %s:\n", n, MEASLOG_PATH);
+		predict_trace_run(predict_trace, n);
+	}
+	else
+	{
+		printf("display latency, no usable log in %s\n", MEASLOG_PATH);
+	}
+
+	trace_make(predict_trace, truth);
+	printf("display latency, %d s synthetic walk at %d Hz:\n", TRACE_SECONDS, TRACE_HZ);
+	predict_trace_run(predict_trace, TRACE_LEN);
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(void);
+} benchmarks[] = {
+	{ "gpio", bench_gpio },
+	{ "spi", bench_spi },
+	{ "edges", bench_edges },
+	{ "ring", bench_ring_stress },
+	{ "capture", bench_capture },
+	{ "sched", bench_sched },
+	{ "filter", bench_filter },
+	{ "stats", bench_stats },
+	{ "startup", bench_startup },
+	{ "frames", bench_frames },
+	{ "trigger", bench_trigger },
+	{ "cyclic", bench_cyclic },
+	{ "measlog", bench_measlog },
+	{ "chain", bench_chain },
+	{ "scroll", bench_scroll },
+	{ "uring", bench_uring },
+	{ "bothedge", bench_bothedge },
+	{ "lines", bench_lines },
+	{ "predict", bench_predict },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int j, ret = 0;
+
+	for(i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+	{
+		if(argc > 1)
+		{
+			for(j = 1; j < argc; j++)
+				if(strcmp(argv[j], benchmarks[i].name) == 0)
+					break;
+			if(j == argc)
+				continue;
+		}
+		if(benchmarks[i].fn() < 0)
+			ret = 1;
+	}
+	return ret;
+}
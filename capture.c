@@ -0,0 +1,616 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "led.h"
+#include "tsc.h"
+#include "stats.h"
+#include "capture.h"
+
+
+#define CAPTURE_TAG_TIMER 1
+#define CAPTURE_EVENTS (2 * CAPTURE_MAX_SENSORS)
+
+/***********************************************************************
+* capture_now_ns - Function to read the scheduling clock.
+*
+* Returns CLOCK_MONOTONIC in nanoseconds.
+*
+* Description: Function to read the scheduling clock used for trigger
+* 	times and deadlines.
+***********************************************************************/
+unsigned long long capture_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/***********************************************************************
+* capture_init - Function to create an empty capture engine.
+* @eng: Engine
+* @done: Callback for finished measurements
+* @arg: Stored in eng->arg for the callback
+*
+* Returns 0 on success.
+*
+* Description: Function to create an empty capture engine.
+***********************************************************************/
+int capture_init(struct capture_engine *eng, capture_cb done, void *arg)
+{
+	memset(eng, 0, sizeof(*eng));
+	eng->done = done;
+	eng->arg = arg;
+	eng->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(eng->epfd < 0)
+	{
+		perror("capture/epoll");
+		return -1;
+	}
+	return 0;
+}
+
+/***********************************************************************
+* capture_close - Function to release every sensor and the engine.
+* @eng: Engine
+*
+* Returns nothing.
+*
+* Description: Function to release every sensor and the engine.
+***********************************************************************/
+void capture_close(struct capture_engine *eng)
+{
+	unsigned int i;
+
+	for(i = 0; i < eng->count; i++)
+	{
+		echo_close(&eng->sensor[i].echo);
+		close(eng->sensor[i].timer_fd);
+	}
+	close(eng->epfd);
+	eng->count = 0;
+}
+
+/*
+ * Registers the echo fd and a fresh deadline timer of the sensor being
+ * added with epoll.
+ */
+static int capture_register(struct capture_engine *eng, struct capture_sensor *s)
+{
+	struct epoll_event ev;
+	int echo_fd = s->echo.use_cdev ? s->echo.line_fd : s->echo.value_fd;
+
+	s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(s->timer_fd < 0)
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = s->echo.use_cdev ? EPOLLIN : EPOLLPRI;
+	ev.data.u64 = (unsigned long long)s->id << 1;
+	if(epoll_ctl(eng->epfd, EPOLL_CTL_ADD, echo_fd, &ev) < 0)
+		goto err;
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = ((unsigned long long)s->id << 1) | CAPTURE_TAG_TIMER;
+	if(epoll_ctl(eng->epfd, EPOLL_CTL_ADD, s->timer_fd, &ev) < 0)
+		goto err;
+
+	s->state = CAPTURE_IDLE;
+	s->range_cm = ECHO_MAX_RANGE_CM;
+	s->timeout_ns = echo_timeout_ns(s->range_cm);
+	s->recovery_ns = ECHO_RECOVERY_NS;
+	s->period_ns = 0;
+	eng->count++;
+	return s->id;
+
+err:
+	perror("capture/register");
+	close(s->timer_fd);
+	return -1;
+}
+
+/***********************************************************************
+* capture_add - Function to add a sensor by its pins.
+* @eng: Engine
+* @trig_gpio: GPIO wired to TRIG
+* @echo_gpio: GPIO wired to ECHO
+*
+* Returns sensor id on success, negative on failure.
+*
+* Description: Function to add a sensor by its pins. The echo line is
+* 	opened by echo_open(), so it uses kernel edge timestamps when
+* 	the GPIO character device is available.
+***********************************************************************/
+int capture_add(struct capture_engine *eng, unsigned int trig_gpio,
+	unsigned int echo_gpio)
+{
+	struct capture_sensor *s;
+
+	if(eng->count >= CAPTURE_MAX_SENSORS)
+		return -ENOSPC;
+
+	s = &eng->sensor[eng->count];
+	memset(s, 0, sizeof(*s));
+	s->id = eng->count;
+	if(echo_open(&s->echo, trig_gpio, echo_gpio) < 0)
+		return -1;
+	return capture_register(eng, s);
+}
+
+/***********************************************************************
+* capture_add_fd - Function to add a sensor on an already open echo fd.
+* @eng: Engine
+* @trig_gpio: GPIO wired to TRIG
+* @echo_fd: sysfs value fd, or a line fd delivering gpio_v2_line_event
+* @use_cdev: Non zero if @echo_fd is a line fd
+*
+* Returns sensor id on success, negative on failure.
+*
+* Description: Function to add a sensor on an already open echo fd, for
+* 	simulated edge sources.
+***********************************************************************/
+int capture_add_fd(struct capture_engine *eng, unsigned int trig_gpio,
+	int echo_fd, int use_cdev)
+{
+	struct capture_sensor *s;
+
+	if(eng->count >= CAPTURE_MAX_SENSORS)
+		return -ENOSPC;
+
+	s = &eng->sensor[eng->count];
+	memset(s, 0, sizeof(*s));
+	s->id = eng->count;
+	s->echo.trig_gpio = trig_gpio;
+	if(gpio_set_value(trig_gpio, GPIO_VALUE_LOW) < 0)
+		return -1;
+	s->echo.use_cdev = use_cdev;
+	s->echo.line_fd = use_cdev ? echo_fd : -1;
+	s->echo.value_fd = use_cdev ? -1 : echo_fd;
+	return capture_register(eng, s);
+}
+
+/***********************************************************************
+* capture_set_conflict - Function to keep two sensors from overlapping.
+* @eng: Engine
+* @a: Sensor id
+* @b: Sensor id
+*
+* Returns 0 on success.
+*
+* Description: Function to mark two sensors as able to hear each other's
+* 	ping. The scheduler never lets their max range windows overlap;
+* 	sensors without a conflict between them fire concurrently.
+***********************************************************************/
+int capture_set_conflict(struct capture_engine *eng, unsigned int a,
+	unsigned int b)
+{
+	if(a >= eng->count || b >= eng->count || a == b)
+		return -EINVAL;
+
+	eng->sensor[a].conflicts |= 1U << b;
+	eng->sensor[b].conflicts |= 1U << a;
+	return 0;
+}
+
+/***********************************************************************
+* capture_set_range - Function to set the max range of a sensor.
+* @eng: Engine
+* @id: Sensor id
+* @range_cm: Farthest distance of interest
+*
+* Returns 0 on success.
+*
+* Description: Function to set the max range of a sensor. The echo
+* 	deadline follows from it, so a shorter range gives up on lost
+* 	echoes sooner and raises the achievable sample rate.
+***********************************************************************/
+int capture_set_range(struct capture_engine *eng, unsigned int id,
+	unsigned int range_cm)
+{
+	if(id >= eng->count || range_cm == 0)
+		return -EINVAL;
+
+	eng->sensor[id].range_cm = range_cm;
+	eng->sensor[id].timeout_ns = echo_timeout_ns(range_cm);
+	return 0;
+}
+
+/***********************************************************************
+* capture_set_pacing - Function to set how often a sensor may fire.
+* @eng: Engine
+* @id: Sensor id
+* @period_ns: Minimum time between two triggers
+* @recovery_ns: Quiet time after a cycle ends
+*
+* Returns 0 on success.
+*
+* Description: Function to set how often a sensor may fire. Real
+* 	sensors need ECHO_RECOVERY_NS for their ping to die out; a replay
+* 	running as fast as possible sets both to 0.
+***********************************************************************/
+int capture_set_pacing(struct capture_engine *eng, unsigned int id,
+	unsigned long long period_ns, unsigned long long recovery_ns)
+{
+	if(id >= eng->count)
+		return -EINVAL;
+
+	eng->sensor[id].period_ns = period_ns;
+	eng->sensor[id].recovery_ns = recovery_ns;
+	return 0;
+}
+
+static void capture_arm(struct capture_sensor *s, unsigned long long ns)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ns / 1000000000ULL;
+	its.it_value.tv_nsec = ns % 1000000000ULL;
+	timerfd_settime(s->timer_fd, 0, &its, NULL);
+}
+
+/*
+ * Ends the current cycle of @s and reports it, invalid ones as timeouts.
+ */
+static void capture_finish(struct capture_engine *eng, struct capture_sensor *s,
+	int valid)
+{
+	capture_arm(s, 0);
+	capture_done(s, capture_now_ns());
+	s->pulse.valid = valid;
+	if(valid)
+	{
+		s->samples++;
+		stats_count(STAT_SAMPLES);
+		stats_record_ns(STAT_PULSE_WIDTH, s->pulse.width_ns);
+	}
+	else
+	{
+		s->timeouts++;
+		stats_count(STAT_TIMEOUTS);
+	}
+	if(eng->done)
+		eng->done(eng, s, &s->pulse);
+}
+
+/*
+ * Ends the current cycle of @s without a width because its edges were
+ * lost. The caller has counted them already, so it is no timeout.
+ */
+static void capture_lost(struct capture_engine *eng, struct capture_sensor *s)
+{
+	capture_arm(s, 0);
+	capture_done(s, capture_now_ns());
+	s->pulse.valid = 0;
+	if(eng->done)
+		eng->done(eng, s, &s->pulse);
+}
+
+/***********************************************************************
+* capture_trigger - Function to start a measurement on one sensor.
+* @eng: Engine
+* @id: Sensor id
+*
+* Returns 0 on success, -EBUSY if the sensor is still measuring.
+*
+* Description: Function to start a measurement on one sensor: clear
+* 	stale echo edges, pulse the trigger and start the deadline timer.
+***********************************************************************/
+int capture_trigger(struct capture_engine *eng, unsigned int id)
+{
+	struct capture_sensor *s = &eng->sensor[id];
+	struct gpio_edge ev[GPIO_EDGE_BATCH];
+	int n;
+
+	if(s->state != CAPTURE_IDLE)
+		return -EBUSY;
+
+	memset(&s->pulse, 0, sizeof(s->pulse));
+	if(s->echo.use_cdev)
+	{
+		while((n = gpio_cdev_read_edges(s->echo.line_fd, ev, GPIO_EDGE_BATCH, 0)) > 0)
+			s->echo.last_seqno = ev[n - 1].seqno;
+	}
+	else
+	{
+		echo_arm(&s->echo);
+	}
+
+	s->state = CAPTURE_TRIGGERED;
+	capture_arm(s, s->timeout_ns);
+	echo_trigger(&s->echo);
+	s->trigger_stamp = s->echo.use_cdev ? capture_now_ns() : stats_stamp();
+	return 0;
+}
+
+/*
+ * sysfs echo of @s signalled an edge; the level read after it tells
+ * which. A low level while waiting for the rise means the whole pulse
+ * went by before the read, and the cycle ends at once without a width.
+ * Edges in any other state are counted and dropped.
+ */
+static void capture_sysfs_edge(struct capture_engine *eng, struct capture_sensor *s)
+{
+	unsigned long long now = my_rdtsc();
+	int level = echo_level(&s->echo);
+
+	if(level < 0)
+	{
+		stats_count(STAT_POLL_ERRORS);
+		return;
+	}
+
+	if(s->state == CAPTURE_TRIGGERED && level)
+	{
+		s->pulse.rise = now;
+		s->state = CAPTURE_HIGH;
+		stats_record_ticks(STAT_TRIGGER_ECHO, s->trigger_stamp, now);
+	}
+	else if(s->state == CAPTURE_TRIGGERED && s->echo.stale_high)
+	{
+		s->echo.stale_high = 0;		/* the last ping ended */
+	}
+	else if(s->state == CAPTURE_TRIGGERED)
+	{
+		echo_edge_error(&s->echo, 0);
+		capture_lost(eng, s);
+	}
+	else if(s->state == CAPTURE_HIGH && !level)
+	{
+		s->pulse.fall = now;
+		s->pulse.width_ns = tsc_to_ns(now - s->pulse.rise);
+		s->pulse.distance_um = tsc_to_um(now - s->pulse.rise);
+		capture_finish(eng, s, s->pulse.width_ns < s->timeout_ns);
+	}
+	else
+	{
+		echo_edge_error(&s->echo, 1);
+	}
+}
+
+/*
+ * Echo fd of @s is readable: advance its state machine.
+ */
+static void capture_echo_event(struct capture_engine *eng, struct capture_sensor *s)
+{
+	struct gpio_edge ev[GPIO_EDGE_BATCH];
+	int i, n;
+
+	if(!s->echo.use_cdev)
+	{
+		capture_sysfs_edge(eng, s);
+		return;
+	}
+
+	n = gpio_cdev_read_edges(s->echo.line_fd, ev, GPIO_EDGE_BATCH, 0);
+	if(n < 0)
+		stats_count(STAT_POLL_ERRORS);
+	for(i = 0; i < n; i++)
+	{
+		echo_check_seqno(&s->echo, ev[i].seqno);
+		if(s->state == CAPTURE_TRIGGERED && ev[i].rising)
+		{
+			s->pulse.rise = ev[i].timestamp_ns;
+			s->state = CAPTURE_HIGH;
+			if(s->pulse.rise > s->trigger_stamp)
+				stats_record_ns(STAT_TRIGGER_ECHO, s->pulse.rise - s->trigger_stamp);
+		}
+		else if(s->state == CAPTURE_HIGH && !ev[i].rising)
+		{
+			s->pulse.fall = ev[i].timestamp_ns;
+			s->pulse.width_ns = s->pulse.fall - s->pulse.rise;
+			s->pulse.distance_um = ECHO_NS_TO_UM(s->pulse.width_ns);
+			capture_finish(eng, s, s->pulse.width_ns < s->timeout_ns);
+		}
+		else
+		{
+			echo_edge_error(&s->echo, 1);
+		}
+	}
+}
+
+/***********************************************************************
+* capture_poll - Function to wait for and dispatch echo/timer events.
+* @eng: Engine
+* @timeout_ms: epoll_wait timeout
+*
+* Returns number of events handled, negative on error.
+*
+* Description: Function to wait for and dispatch echo/timer events of
+* 	all sensors. Finished and timed out cycles are reported through
+* 	the engine callback.
+***********************************************************************/
+int capture_poll(struct capture_engine *eng, int timeout_ms)
+{
+	struct epoll_event ev[CAPTURE_EVENTS];
+	struct capture_sensor *s;
+	unsigned long long expirations;
+	int i, n;
+
+	n = epoll_wait(eng->epfd, ev, CAPTURE_EVENTS, timeout_ms);
+	if(n < 0)
+	{
+		if(errno == EINTR)
+			return 0;
+		stats_count(STAT_POLL_ERRORS);
+		printf("Poll Error Ocurred\n");
+		return -1;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		s = &eng->sensor[ev[i].data.u64 >> 1];
+		if(ev[i].data.u64 & CAPTURE_TAG_TIMER)
+		{
+			if(read(s->timer_fd, &expirations, sizeof(expirations)) > 0 &&
+				s->state != CAPTURE_IDLE)
+				capture_finish(eng, s, 0);
+		}
+		else
+		{
+			capture_echo_event(eng, s);
+		}
+	}
+	return n;
+}
+
+/***********************************************************************
+* capture_plan - Function to decide which sensors fire now.
+* @eng: Engine
+* @now: Current time, CLOCK_MONOTONIC ns
+* @wake: Filled with when the plan can next change
+*
+* Returns bitmask of the sensors to trigger now.
+*
+* Description: Function to decide which sensors fire now. A sensor can
+* 	fire again once its last cycle ended and its recovery time passed.
+* 	Towards other sensors it stays busy for its whole max range window
+* 	(timeout_ns) though, even if its own echo came back early, since
+* 	its ping can still reach a neighbour. Due sensors are taken oldest
+* 	first; one that is blocked by a busy conflicting sensor reserves
+* 	its own conflicts so that it is not starved by them. Sensors with
+* 	no conflict between them share the same time slot. Only reads the
+* 	engine, which keeps it usable on a simulated array.
+***********************************************************************/
+unsigned int capture_plan(struct capture_engine *eng, unsigned long long now,
+	unsigned long long *wake)
+{
+	struct capture_sensor *s;
+	unsigned int i, best, busy = 0, reserved = 0, fire = 0, done = 0;
+
+	*wake = ~0ULL;
+	for(i = 0; i < eng->count; i++)
+	{
+		s = &eng->sensor[i];
+		if(s->busy_until_ns > now)
+		{
+			busy |= 1U << i;
+			if(s->busy_until_ns < *wake)
+				*wake = s->busy_until_ns;
+		}
+		if(s->state != CAPTURE_IDLE)
+			done |= 1U << i;
+	}
+
+	while(1)
+	{
+		best = eng->count;
+		for(i = 0; i < eng->count; i++)
+		{
+			s = &eng->sensor[i];
+			if(done & (1U << i))
+				continue;
+			if(s->next_trigger_ns > now)
+			{
+				if(s->next_trigger_ns < *wake)
+					*wake = s->next_trigger_ns;
+				continue;
+			}
+			if(best == eng->count ||
+				s->next_trigger_ns < eng->sensor[best].next_trigger_ns)
+				best = i;
+		}
+		if(best == eng->count)
+			break;
+
+		s = &eng->sensor[best];
+		done |= 1U << best;
+		if((s->conflicts & (busy | fire)) || (reserved & (1U << best)))
+		{
+			reserved |= s->conflicts;
+			continue;
+		}
+		fire |= 1U << best;
+	}
+	return fire;
+}
+
+/***********************************************************************
+* capture_fired - Function to book a trigger in the schedule.
+* @s: Sensor
+* @now: Trigger time, CLOCK_MONOTONIC ns
+*
+* Returns nothing.
+*
+* Description: Function to book a trigger in the schedule: the sensor is
+* 	measuring, and busy for its neighbours for its max range window.
+***********************************************************************/
+void capture_fired(struct capture_sensor *s, unsigned long long now)
+{
+	s->state = CAPTURE_TRIGGERED;
+	s->busy_until_ns = now + s->timeout_ns;
+	s->next_trigger_ns = now + s->period_ns;
+}
+
+/***********************************************************************
+* capture_done - Function to book the end of a cycle in the schedule.
+* @s: Sensor
+* @now: Time the echo finished or timed out, CLOCK_MONOTONIC ns
+*
+* Returns nothing.
+*
+* Description: Function to book the end of a cycle in the schedule: the
+* 	sensor is due again as soon as its recovery time has passed.
+***********************************************************************/
+void capture_done(struct capture_sensor *s, unsigned long long now)
+{
+	s->state = CAPTURE_IDLE;
+	if(s->next_trigger_ns < now + s->recovery_ns)
+		s->next_trigger_ns = now + s->recovery_ns;
+}
+
+/***********************************************************************
+* capture_print_rates - Function to print the achieved sample rates.
+* @eng: Engine
+* @elapsed_ns: Time the counters cover
+*
+* Returns nothing.
+*
+* Description: Function to print the achieved sample rate, the
+* 	timeouts and the edges that did not fit of every sensor.
+***********************************************************************/
+void capture_print_rates(struct capture_engine *eng, unsigned long long elapsed_ns)
+{
+	unsigned int i;
+
+	for(i = 0; i < eng->count; i++)
+	{
+		printf("sensor %u: %.2f samples/s, %llu timeouts, %llu missed and "
+			"%llu spurious edges\n", i,
+			eng->sensor[i].samples * 1e9 / elapsed_ns,
+			eng->sensor[i].timeouts, eng->sensor[i].echo.missed_edges,
+			eng->sensor[i].echo.spurious_edges);
+	}
+}
+
+/***********************************************************************
+* capture_run_once - Function to run one pass of the capture loop.
+* @eng: Engine
+*
+* Returns number of events handled, negative on error.
+*
+* Description: Function to run one pass of the capture loop: trigger
+* 	the sensors capture_plan() picks, then wait for events until the
+* 	plan can next change.
+***********************************************************************/
+int capture_run_once(struct capture_engine *eng)
+{
+	unsigned long long now = capture_now_ns(), wake;
+	unsigned int i, fire;
+	int timeout_ms = -1;
+
+	fire = capture_plan(eng, now, &wake);
+	for(i = 0; i < eng->count; i++)
+	{
+		if((fire & (1U << i)) && capture_trigger(eng, i) == 0)
+			capture_fired(&eng->sensor[i], now);
+	}
+
+	if(wake != ~0ULL)
+		timeout_ms = (wake - now + 999999) / 1000000;
+	return capture_poll(eng, timeout_ms);
+}
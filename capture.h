@@ -0,0 +1,94 @@
+#ifndef __CAPTURE_FUNC_H__
+#define __CAPTURE_FUNC_H__
+
+#include "sensor.h"
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define CAPTURE_MAX_SENSORS 8
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * Per-sensor measurement state. A trigger moves IDLE to TRIGGERED, the
+ * rising echo edge to HIGH and the falling edge back to IDLE with a
+ * finished pulse. The sensor's timerfd fires if the echo does not
+ * finish within the time a target at range_cm needs, which also ends in
+ * IDLE, with an invalid pulse. The sensor may fire again recovery_ns
+ * after either outcome.
+ */
+enum capture_state {
+	CAPTURE_IDLE,
+	CAPTURE_TRIGGERED,
+	CAPTURE_HIGH,
+};
+
+struct capture_sensor {
+	unsigned int id;
+	struct echo_sensor echo;
+	int timer_fd;
+	enum capture_state state;
+	unsigned int range_cm;			/* max range of interest */
+	unsigned long long timeout_ns;		/* echo deadline, from range_cm */
+	unsigned long long recovery_ns;		/* quiet time after a cycle */
+	unsigned long long period_ns;		/* minimum trigger spacing */
+	unsigned long long next_trigger_ns;	/* CLOCK_MONOTONIC */
+	unsigned long long busy_until_ns;	/* end of the max range window */
+	unsigned int conflicts;			/* sensors that must not overlap */
+	struct echo_pulse pulse;
+	unsigned long long trigger_stamp;	/* in the clock of pulse.rise */
+	unsigned long long samples;
+	unsigned long long timeouts;
+};
+
+struct capture_engine;
+
+/* Called from capture_poll() for every finished or timed out cycle */
+typedef void (*capture_cb)(struct capture_engine *eng,
+	struct capture_sensor *s, const struct echo_pulse *p);
+
+/*
+ * Single threaded capture engine: the echo fds and deadline timers of
+ * every sensor are multiplexed through one epoll instance.
+ */
+struct capture_engine {
+	int epfd;
+	unsigned int count;
+	struct capture_sensor sensor[CAPTURE_MAX_SENSORS];
+	capture_cb done;
+	void *arg;
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+int capture_init(struct capture_engine *eng, capture_cb done, void *arg);
+void capture_close(struct capture_engine *eng);
+int capture_add(struct capture_engine *eng, unsigned int trig_gpio,
+	unsigned int echo_gpio);
+int capture_add_fd(struct capture_engine *eng, unsigned int trig_gpio,
+	int echo_fd, int use_cdev);
+int capture_set_conflict(struct capture_engine *eng, unsigned int a,
+	unsigned int b);
+int capture_set_range(struct capture_engine *eng, unsigned int id,
+	unsigned int range_cm);
+int capture_set_pacing(struct capture_engine *eng, unsigned int id,
+	unsigned long long period_ns, unsigned long long recovery_ns);
+int capture_trigger(struct capture_engine *eng, unsigned int id);
+unsigned int capture_plan(struct capture_engine *eng, unsigned long long now,
+	unsigned long long *wake);
+void capture_fired(struct capture_sensor *s, unsigned long long now);
+void capture_done(struct capture_sensor *s, unsigned long long now);
+void capture_print_rates(struct capture_engine *eng, unsigned long long elapsed_ns);
+int capture_poll(struct capture_engine *eng, int timeout_ms);
+int capture_run_once(struct capture_engine *eng);
+unsigned long long capture_now_ns(void);
+
+
+#endif /* __CAPTURE_FUNC_H__ */
@@ -0,0 +1,326 @@
+#include <string.h>
+#include <math.h>
+#include "filter.h"
+
+
+/***********************************************************************
+* filter_default_config - Function to fill in the default tuning.
+* @cfg: Configuration
+*
+* Returns nothing.
+*
+* Description: Function to fill in the default tuning, picked for a
+* 	person walking in front of an HC-SR04 at 20-60 samples/s.
+***********************************************************************/
+void filter_default_config(struct filter_config *cfg)
+{
+	cfg->median_window = 5;
+	cfg->accel_var = 2500.0;	/* 50 cm/s^2 */
+	cfg->meas_var = 1.0;		/* 1 cm */
+	cfg->vel_enter = 15.0;
+	cfg->near_cm = 35.0;
+	cfg->near_hyst_cm = 3.0;
+	cfg->predict_max_s = 1.0;
+	cfg->predict_sigma_max = 15.0;
+}
+
+/***********************************************************************
+* filter_init - Function to reset a filter.
+* @f: Filter
+* @cfg: Configuration, copied
+*
+* Returns nothing.
+*
+* Description: Function to reset a filter. The first valid sample
+* 	initialises the Kalman state.
+***********************************************************************/
+void filter_init(struct filter *f, const struct filter_config *cfg)
+{
+	memset(f, 0, sizeof(*f));
+	f->cfg = *cfg;
+	if(f->cfg.median_window < 1)
+		f->cfg.median_window = 1;
+	if(f->cfg.median_window > FILTER_MEDIAN_MAX)
+		f->cfg.median_window = FILTER_MEDIAN_MAX;
+	f->direction = 'L';
+}
+
+/*
+ * Pushes @z into the sliding window and returns the window median. The
+ * sorted copy is kept up to date by removing the oldest value and
+ * inserting the new one, both O(window).
+ */
+static double filter_median(struct filter *f, double z)
+{
+	unsigned int w = f->cfg.median_window, i, n = f->fill;
+	double old;
+
+	if(n == w)
+	{
+		old = f->win[f->head];
+		for(i = 0; i < n && f->sorted[i] != old; i++)
+			;
+		memmove(&f->sorted[i], &f->sorted[i + 1], (n - i - 1) * sizeof(double));
+		n--;
+	}
+	else
+	{
+		f->fill++;
+	}
+
+	f->win[f->head] = z;
+	f->head = (f->head + 1) % w;
+
+	for(i = n; i > 0 && f->sorted[i - 1] > z; i--)
+		f->sorted[i] = f->sorted[i - 1];
+	f->sorted[i] = z;
+
+	return f->sorted[f->fill / 2];
+}
+
+/*
+ * Constant velocity Kalman step with a measurement of @z cm taken @dt
+ * seconds after the previous one.
+ */
+static void filter_kalman(struct filter *f, double z, double dt)
+{
+	double q = f->cfg.accel_var, dt2 = dt * dt;
+	double s, k0, k1, y, p00, p01;
+
+	/* predict */
+	f->x += f->v * dt;
+	p00 = f->p00 + dt * (f->p10 + f->p01) + dt2 * f->p11 + q * dt2 * dt2 / 4;
+	p01 = f->p01 + dt * f->p11 + q * dt2 * dt / 2;
+	f->p10 = f->p10 + dt * f->p11 + q * dt2 * dt / 2;
+	f->p11 = f->p11 + q * dt2;
+	f->p00 = p00;
+	f->p01 = p01;
+
+	/* update */
+	y = z - f->x;
+	s = f->p00 + f->cfg.meas_var;
+	k0 = f->p00 / s;
+	k1 = f->p10 / s;
+	f->x += k0 * y;
+	f->v += k1 * y;
+	p00 = f->p00;
+	p01 = f->p01;
+	f->p00 -= k0 * p00;
+	f->p01 -= k0 * p01;
+	f->p10 -= k1 * p00;
+	f->p11 -= k1 * p01;
+}
+
+/*
+ * Direction flips once the speed passes vel_enter the other way; near
+ * only changes when the distance leaves the dead band around near_cm.
+ */
+static void filter_hysteresis(struct filter *f, double x, double v)
+{
+	if(v > f->cfg.vel_enter)
+		f->direction = 'R';
+	else if(v < -f->cfg.vel_enter)
+		f->direction = 'L';
+
+	if(x < f->cfg.near_cm - f->cfg.near_hyst_cm)
+		f->near = 1;
+	else if(x > f->cfg.near_cm + f->cfg.near_hyst_cm)
+		f->near = 0;
+}
+
+/***********************************************************************
+* filter_update - Function to feed one sample through the filter.
+* @f: Filter
+* @s: Sample
+*
+* Returns 1 if the outputs changed, 0 if the sample was invalid.
+*
+* Description: Function to feed one sample through the filter and
+* 	refresh distance_cm, velocity_cm_s, direction and near. The
+* 	direction only flips once the speed passes vel_enter the other
+* 	way; near only changes when the distance leaves the dead band
+* 	around near_cm.
+***********************************************************************/
+int filter_update(struct filter *f, const struct sample *s)
+{
+	double z, dt;
+
+	if(!s->valid)
+		return 0;
+
+	z = filter_median(f, s->distance_um / 10000.0);
+
+	if(!f->started)
+	{
+		f->x = z;
+		f->v = 0;
+		f->p00 = f->cfg.meas_var;
+		f->p01 = f->p10 = 0;
+		f->p11 = 100.0 * 100.0;
+		f->started = 1;
+		f->near = (z < f->cfg.near_cm);
+	}
+	else
+	{
+		dt = (s->timestamp_ns - f->last_ns) / 1e9;
+		if(dt <= 0 || dt > 1.0)
+			dt = 1.0;
+		filter_kalman(f, z, dt);
+	}
+	f->last_ns = s->timestamp_ns;
+	f->samples++;
+
+	f->distance_cm = f->x;
+	f->velocity_cm_s = f->v;
+	filter_hysteresis(f, f->x, f->v);
+	return 1;
+}
+
+/***********************************************************************
+* filter_motion - Function to take the motion model out of a filter.
+* @f: Filter
+* @m: Filled with the model as of the last sample
+*
+* Returns nothing.
+*
+* Description: Function to take the Kalman state of a filter out as a
+* 	motion model, for another thread to predict from.
+***********************************************************************/
+void filter_motion(const struct filter *f, struct motion *m)
+{
+	m->x = f->x;
+	m->v = f->v;
+	m->p00 = f->p00;
+	m->p01 = f->p01;
+	m->p11 = f->p11;
+	m->accel_var = f->cfg.accel_var;
+	m->timestamp_ns = f->last_ns;
+	m->samples = f->samples;
+}
+
+/***********************************************************************
+* filter_decide - Function to take the display decisions from a prediction.
+* @f: Filter holding the decisions and their tuning
+* @p: Prediction for the time the decisions take effect
+*
+* Returns 1 if the decisions were revisited, 0 if they were held.
+*
+* Description: Function to refresh distance_cm and velocity_cm_s from a
+* 	prediction, and direction and near with the same hysteresis as
+* 	filter_update(). near only flips once the whole confidence band
+* 	clears the hysteresis band too, so a long extrapolation through a
+* 	turnaround does not flip it. A prediction vaguer than
+* 	predict_sigma_max, from a model gone stale, changes no decision.
+***********************************************************************/
+int filter_decide(struct filter *f, const struct motion_prediction *p)
+{
+	f->distance_cm = p->distance_cm;
+	f->velocity_cm_s = p->velocity_cm_s;
+	if(!f->started)
+	{
+		f->started = 1;
+		f->near = (p->distance_cm < f->cfg.near_cm);
+	}
+	if(p->sigma_cm > f->cfg.predict_sigma_max)
+		return 0;
+
+	if(p->velocity_cm_s > f->cfg.vel_enter)
+		f->direction = 'R';
+	else if(p->velocity_cm_s < -f->cfg.vel_enter)
+		f->direction = 'L';
+
+	if(p->distance_cm < f->cfg.near_cm - f->cfg.near_hyst_cm &&
+		p->hi_cm < f->cfg.near_cm + f->cfg.near_hyst_cm)
+		f->near = 1;
+	else if(p->distance_cm > f->cfg.near_cm + f->cfg.near_hyst_cm &&
+		p->lo_cm > f->cfg.near_cm - f->cfg.near_hyst_cm)
+		f->near = 0;
+	return 1;
+}
+
+/***********************************************************************
+* motion_publish - Function to publish a motion model.
+* @ms: Shared model
+* @m: New model
+*
+* Returns nothing.
+*
+* Description: Function to publish a motion model to another thread.
+* 	Single writer; never waits for the reader.
+***********************************************************************/
+void motion_publish(struct motion_shared *ms, const struct motion *m)
+{
+	unsigned int lock = ms->lock;
+
+	__atomic_store_n(&ms->lock, lock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&ms->m, m, sizeof(*m));
+	__atomic_store_n(&ms->lock, lock + 2, __ATOMIC_RELEASE);
+}
+
+/***********************************************************************
+* motion_read - Function to read a published motion model.
+* @ms: Shared model
+* @m: Filled with a consistent copy
+*
+* Returns 1 if a model was read, 0 if there is none yet or the writer
+* 	kept it busy.
+*
+* Description: Function to read a published motion model, retrying a
+* 	copy torn by the writer a few times.
+***********************************************************************/
+int motion_read(struct motion_shared *ms, struct motion *m)
+{
+	unsigned int l1, l2;
+	int tries;
+
+	for(tries = 0; tries < 4; tries++)
+	{
+		l1 = __atomic_load_n(&ms->lock, __ATOMIC_ACQUIRE);
+		if(l1 & 1)
+			continue;
+		memcpy(m, &ms->m, sizeof(*m));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		l2 = __atomic_load_n(&ms->lock, __ATOMIC_RELAXED);
+		if(l1 == l2)
+			return m->samples != 0;
+	}
+	return 0;
+}
+
+/***********************************************************************
+* motion_predict - Function to predict the distance at a given time.
+* @m: Motion model
+* @t_ns: Time to predict for, on the timeline of the samples
+* @max_s: Farthest to look ahead of the model's sample
+* @p: Filled with the prediction
+*
+* Returns nothing.
+*
+* Description: Function to carry a motion model forward to @t_ns at
+* 	constant velocity. The distance variance grows by the velocity
+* 	uncertainty and the process noise over the gap, which sets the
+* 	confidence bounds. A time before the sample gives the model as is.
+***********************************************************************/
+void motion_predict(const struct motion *m, unsigned long long t_ns,
+	double max_s, struct motion_prediction *p)
+{
+	double dt, dt2, var;
+
+	p->ahead_ns = (t_ns > m->timestamp_ns) ? t_ns - m->timestamp_ns : 0;
+	dt = p->ahead_ns / 1e9;
+	if(dt > max_s)
+		dt = max_s;
+	dt2 = dt * dt;
+
+	var = m->p00 + 2 * dt * m->p01 + dt2 * m->p11 + m->accel_var * dt2 * dt2 / 4;
+	p->distance_cm = m->x + m->v * dt;
+	if(p->distance_cm < 0)
+		p->distance_cm = 0;
+	p->velocity_cm_s = m->v;
+	p->sigma_cm = sqrt(var > 0 ? var : 0);
+	p->lo_cm = p->distance_cm - FILTER_PREDICT_SIGMAS * p->sigma_cm;
+	p->hi_cm = p->distance_cm + FILTER_PREDICT_SIGMAS * p->sigma_cm;
+	if(p->lo_cm < 0)
+		p->lo_cm = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef __FILTER_FUNC_H__
+#define __FILTER_FUNC_H__
+
+#include "sample_ring.h"
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define FILTER_MEDIAN_MAX 9	/* largest median window */
+#define FILTER_PREDICT_SIGMAS 2.0	/* width of the confidence bounds */
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+struct filter_config {
+	unsigned int median_window;	/* odd, 1 disables the median */
+	double accel_var;		/* Kalman process noise, (cm/s^2)^2 */
+	double meas_var;		/* Kalman measurement noise, cm^2 */
+	double vel_enter;		/* |velocity| to change direction, cm/s */
+	double near_cm;			/* fast/slow boundary */
+	double near_hyst_cm;		/* half width of the dead band */
+	double predict_max_s;		/* farthest a prediction looks ahead */
+	double predict_sigma_max;	/* no decision on a vaguer prediction, cm */
+};
+
+/*
+ * Streaming filter for one sensor: sliding median for outlier rejection,
+ * then a constant velocity Kalman filter, then hysteresis on the
+ * velocity and the distance. Fixed size state, no allocation, cost per
+ * sample bounded by the median window.
+ */
+struct filter {
+	struct filter_config cfg;
+
+	/* median: window in arrival order and the same values sorted */
+	double win[FILTER_MEDIAN_MAX];
+	double sorted[FILTER_MEDIAN_MAX];
+	unsigned int fill;
+	unsigned int head;
+
+	/* Kalman: distance, velocity, covariance */
+	double x, v;
+	double p00, p01, p10, p11;
+	unsigned long long last_ns;
+	unsigned long long samples;	/* valid ones folded in */
+	int started;
+
+	/* outputs */
+	double distance_cm;
+	double velocity_cm_s;
+	char direction;		/* 'L' closer, 'R' moving away */
+	int near;
+};
+
+/*
+ * Motion model of a target as of its last sample: distance, velocity,
+ * their covariance and the sample's timestamp. Enough to predict the
+ * distance at any later time, see motion_predict().
+ */
+struct motion {
+	double x, v;			/* cm, cm/s */
+	double p00, p01, p11;		/* covariance of x and v */
+	double accel_var;		/* process noise the model assumes */
+	unsigned long long timestamp_ns;
+	unsigned long long samples;	/* folded in so far */
+};
+
+/*
+ * A motion model published by one thread for another. @lock is odd
+ * while the model is being written, so a reader can tell a torn copy.
+ */
+struct motion_shared {
+	unsigned int lock;
+	struct motion m;
+};
+
+/* Distance predicted for a given time, with its confidence bounds */
+struct motion_prediction {
+	double distance_cm;
+	double velocity_cm_s;
+	double sigma_cm;		/* standard deviation of distance_cm */
+	double lo_cm, hi_cm;		/* +/- FILTER_PREDICT_SIGMAS sigma */
+	unsigned long long ahead_ns;	/* from the sample to the prediction */
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+void filter_default_config(struct filter_config *cfg);
+void filter_init(struct filter *f, const struct filter_config *cfg);
+int filter_update(struct filter *f, const struct sample *s);
+void filter_motion(const struct filter *f, struct motion *m);
+int filter_decide(struct filter *f, const struct motion_prediction *p);
+void motion_publish(struct motion_shared *ms, const struct motion *m);
+int motion_read(struct motion_shared *ms, struct motion *m);
+void motion_predict(const struct motion *m, unsigned long long t_ns,
+	double max_s, struct motion_prediction *p);
+
+
+#endif /* __FILTER_FUNC_H__ */
@@ -0,0 +1,100 @@
+#include <errno.h>
+#include <time.h>
+#include "stats.h"
+#include "frame_sched.h"
+
+
+static unsigned long long frame_sched_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/***********************************************************************
+* frame_sched_init - Function to start a frame timeline.
+* @fs: Scheduler
+* @period_ns: Frame period
+*
+* Returns nothing.
+*
+* Description: Function to start a frame timeline whose first deadline
+* 	is now.
+***********************************************************************/
+void frame_sched_init(struct frame_sched *fs, unsigned long long period_ns)
+{
+	fs->period_ns = period_ns;
+	fs->pending_period_ns = period_ns;
+	fs->deadline_ns = frame_sched_now_ns();
+	fs->last_tick_ns = 0;
+	fs->ticks = 0;
+	fs->missed = 0;
+	fs->max_late_ns = 0;
+}
+
+/***********************************************************************
+* frame_sched_set_period - Function to change the frame rate.
+* @fs: Scheduler
+* @period_ns: New frame period
+*
+* Returns nothing.
+*
+* Description: Function to change the frame rate from the next tick on:
+* 	the next frame_sched_wait() sleeps until @period_ns after the last
+* 	tick, not until the deadline the old period gave. May be called
+* 	from any thread; a wait already sleeping keeps its deadline.
+***********************************************************************/
+void frame_sched_set_period(struct frame_sched *fs, unsigned long long period_ns)
+{
+	if(period_ns != 0)
+		__atomic_store_n(&fs->pending_period_ns, period_ns, __ATOMIC_RELAXED);
+}
+
+/***********************************************************************
+* frame_sched_wait - Function to sleep until the next frame deadline.
+* @fs: Scheduler
+*
+* Returns number of deadlines skipped because they had already passed.
+*
+* Description: Function to sleep until the next frame deadline with an
+* 	absolute clock_nanosleep, record how late the wakeup was and
+* 	compute the following deadline. A period changed since the last
+* 	tick moves the deadline first. If frame work overran so far that
+* 	the following deadline has passed too, the overdue deadlines are
+* 	counted as missed and skipped, rather than sending a burst of
+* 	frames to catch up.
+***********************************************************************/
+int frame_sched_wait(struct frame_sched *fs)
+{
+	struct timespec ts;
+	unsigned long long now, late, period, missed = 0;
+
+	period = __atomic_load_n(&fs->pending_period_ns, __ATOMIC_RELAXED);
+	if(fs->ticks != 0 && period != fs->period_ns)
+		fs->deadline_ns = fs->last_tick_ns + period;
+	fs->period_ns = period;
+
+	ts.tv_sec = fs->deadline_ns / 1000000000ULL;
+	ts.tv_nsec = fs->deadline_ns % 1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+
+	now = frame_sched_now_ns();
+	late = (now > fs->deadline_ns) ? now - fs->deadline_ns : 0;
+	stats_record_ns(STAT_FRAME_JITTER, late);
+	if(late > fs->max_late_ns)
+		fs->max_late_ns = late;
+	fs->ticks++;
+
+	fs->deadline_ns += fs->period_ns;
+	if(fs->deadline_ns <= now)
+	{
+		missed = (now - fs->deadline_ns) / fs->period_ns + 1;
+		fs->deadline_ns += missed * fs->period_ns;
+		fs->missed += missed;
+		__atomic_fetch_add(&stats->counter[STAT_MISSED_FRAMES], missed, __ATOMIC_RELAXED);
+	}
+	fs->last_tick_ns = fs->deadline_ns - fs->period_ns;
+	return (int)missed;
+}
@@ -0,0 +1,45 @@
+#ifndef __FRAME_SCHED_H__
+#define __FRAME_SCHED_H__
+
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * Fixed rate tick source for the display. Deadlines lie on an absolute
+ * CLOCK_MONOTONIC timeline, each one period after the last, so time
+ * spent preparing and pushing a frame does not add up into drift. A
+ * new period applies from the tick after the last one: the deadline
+ * being approached moves to @last_tick_ns plus the new period.
+ */
+struct frame_sched {
+	unsigned long long period_ns;
+	unsigned long long pending_period_ns;	/* applied at the next tick */
+	unsigned long long deadline_ns;		/* next tick */
+	unsigned long long last_tick_ns;	/* slot of the last wakeup */
+	unsigned long long ticks;
+	unsigned long long missed;		/* deadlines skipped as overdue */
+	unsigned long long max_late_ns;		/* worst wakeup past a deadline */
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+void frame_sched_init(struct frame_sched *fs, unsigned long long period_ns);
+void frame_sched_set_period(struct frame_sched *fs, unsigned long long period_ns);
+int frame_sched_wait(struct frame_sched *fs);
+
+/* Deadline the next frame_sched_wait() sleeps until, new period included */
+static __inline__ unsigned long long frame_sched_next_ns(const struct frame_sched *fs)
+{
+	unsigned long long period = __atomic_load_n(&fs->pending_period_ns, __ATOMIC_RELAXED);
+
+	if(fs->ticks == 0 || period == fs->period_ns)
+		return fs->deadline_ns;
+	return fs->last_tick_ns + period;
+}
+
+
+#endif /* __FRAME_SCHED_H__ */
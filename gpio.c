@@ -4,25 +4,91 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "led.h"
 
 
+/*
+ * Root of the gpio sysfs tree, overridable so the code can be pointed at
+ * a fake directory when there is no hardware around.
+ */
+static char gpio_root[MAX_BUF] = SYSFS_GPIO_DIR;
 
+/*
+ * One cached handle per pin. The sysfs files are opened once and then
+ * accessed with pwrite/pread at offset 0, so a pin toggle is a single
+ * syscall instead of an open/write/close triple.
+ */
+static struct gpio_handle gpio_table[GPIO_MAX_PINS];
+static pthread_once_t gpio_table_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gpio_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int gpio_table_gen;	/* bumped whenever a handle fd is closed */
+
+static void gpio_group_close_all(void);
+
+static void gpio_table_init(void)
+{
+	int i;
+
+	for(i = 0; i < GPIO_MAX_PINS; i++)
+	{
+		gpio_table[i].gpio = i;
+		gpio_table[i].value_fd = -1;
+		gpio_table[i].dir_fd = -1;
+		gpio_table[i].edge_fd = -1;
+	}
+}
+
+/***********************************************************************
+* gpio_set_root - Function to change the gpio sysfs root directory.
+* @root: Directory to use instead of SYSFS_GPIO_DIR
+*
+* Returns 0 on success.
+*
+* Description: Function to change the gpio sysfs root directory. All
+* 	cached handles and pin groups are closed so that they get
+* 	reopened under the new root.
+***********************************************************************/
+int gpio_set_root(const char *root)
+{
+	if(strlen(root) >= sizeof(gpio_root))
+		return -ENAMETOOLONG;
+
+	gpio_handle_close_all();
+	gpio_group_close_all();
+	pthread_mutex_lock(&gpio_table_lock);
+	strcpy(gpio_root, root);
+	pthread_mutex_unlock(&gpio_table_lock);
+	return 0;
+}
+
+/***********************************************************************
+* gpio_get_root - Function to get the gpio sysfs root directory.
+*
+* Returns the root directory.
+*
+* Description: Function to get the gpio sysfs root directory.
+***********************************************************************/
+const char *gpio_get_root(void)
+{
+	return gpio_root;
+}
 
 /***********************************************************************
-* gpio_export - Function to export gpio pins.
+* gpio_sysfs_export - Function to export gpio pins.
 * @gpio: GPIO PIN Number
 *
 * Returns 0 on success.
 * 
 * Description: Function to export gpio pins.
 ***********************************************************************/
-int gpio_export(unsigned int gpio)
+int gpio_sysfs_export(unsigned int gpio)
 {
 	int fd, len;
-	char buf[MAX_BUF];
- 
-	fd = open("/sys/class/gpio/export", O_WRONLY);
+	char buf[GPIO_PATH_MAX];
+
+	snprintf(buf, sizeof(buf), "%s/export", gpio_root);
+	fd = open(buf, O_WRONLY);
 	if(fd < 0)
 	{
 		perror("gpio/export");
@@ -30,14 +96,18 @@ int gpio_export(unsigned int gpio)
 	}
  
 	len = snprintf(buf, sizeof(buf), "%d", gpio);
-	write(fd, buf, len);
+	if(write(fd, buf, len) != len)
+	{
+		close(fd);
+		return -1;
+	}
 	close(fd);
  
 	return 0;
 }
 
 /***********************************************************************
-* gpio_export - Function to unexport gpio pins.
+* gpio_unexport - Function to unexport gpio pins.
 * @gpio: GPIO PIN Number
 *
 * Returns 0 on success.
@@ -47,9 +117,12 @@ int gpio_export(unsigned int gpio)
 int gpio_unexport(unsigned int gpio)
 {
 	int fd, len;
-	char buf[MAX_BUF];
- 
-	fd = open("/sys/class/gpio/unexport", O_WRONLY);
+	char buf[GPIO_PATH_MAX];
+
+	gpio_handle_close(gpio);
+
+	snprintf(buf, sizeof(buf), "%s/unexport", gpio_root);
+	fd = open(buf, O_WRONLY);
 	if(fd < 0)
 	{
 		perror("gpio/export");
@@ -62,8 +135,198 @@ int gpio_unexport(unsigned int gpio)
 	return 0;
 }
 
+/*
+ * Opens the sysfs attribute @name of @gpio, exporting the pin first if
+ * its directory does not exist yet. A fresh export only becomes usable
+ * once udev has fixed up its ownership, so the open is retried every
+ * millisecond until then instead of sleeping a fixed time.
+ */
+static int gpio_attr_open(unsigned int gpio, const char *name, int flags)
+{
+	char buf[GPIO_PATH_MAX];
+	int fd, waited, exported = 0;
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d", gpio_root, gpio);
+	if(access(buf, F_OK) < 0)
+		exported = (gpio_sysfs_export(gpio) == 0);
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/%s", gpio_root, gpio, name);
+	for(waited = 0; ; waited++)
+	{
+		fd = open(buf, flags);
+		if(fd >= 0 || !exported || waited >= GPIO_EXPORT_WAIT_MS ||
+			(errno != ENOENT && errno != EACCES))
+			return fd;
+		usleep(1000);
+	}
+}
+
+/***********************************************************************
+* gpio_handle_open - Function to get the cached handle of a gpio pin.
+* @gpio: GPIO PIN Number
+*
+* Returns handle on success, NULL on failure.
+*
+* Description: Function to get the cached handle of a gpio pin. On
+* 	first use the pin is exported if needed and its value file is
+* 	opened; later calls return the same handle without any syscall.
+***********************************************************************/
+struct gpio_handle *gpio_handle_open(unsigned int gpio)
+{
+	struct gpio_handle *h;
+
+	if(gpio >= GPIO_MAX_PINS)
+		return NULL;
+
+	pthread_once(&gpio_table_once, gpio_table_init);
+	h = &gpio_table[gpio];
+	if(h->value_fd >= 0)
+		return h;
+
+	pthread_mutex_lock(&gpio_table_lock);
+	if(h->value_fd < 0)
+	{
+		h->value_fd = gpio_attr_open(gpio, "value", O_RDWR);
+		if(h->value_fd < 0)
+			perror("gpio/handle-open");
+	}
+	pthread_mutex_unlock(&gpio_table_lock);
+
+	return (h->value_fd < 0) ? NULL : h;
+}
+
+/***********************************************************************
+* gpio_handle_close - Function to close the cached handle of a gpio pin.
+* @gpio: GPIO PIN Number
+*
+* Returns 0 on success.
+*
+* Description: Function to close the cached handle of a gpio pin.
+***********************************************************************/
+int gpio_handle_close(unsigned int gpio)
+{
+	struct gpio_handle *h;
+
+	if(gpio >= GPIO_MAX_PINS)
+		return -EINVAL;
+
+	pthread_once(&gpio_table_once, gpio_table_init);
+	h = &gpio_table[gpio];
+
+	pthread_mutex_lock(&gpio_table_lock);
+	if(h->value_fd >= 0 || h->dir_fd >= 0 || h->edge_fd >= 0)
+		__atomic_add_fetch(&gpio_table_gen, 1, __ATOMIC_RELEASE);
+	if(h->value_fd >= 0)
+		close(h->value_fd);
+	if(h->dir_fd >= 0)
+		close(h->dir_fd);
+	if(h->edge_fd >= 0)
+		close(h->edge_fd);
+	h->value_fd = h->dir_fd = h->edge_fd = -1;
+	pthread_mutex_unlock(&gpio_table_lock);
+	return 0;
+}
+
+/***********************************************************************
+* gpio_handle_generation - Function to tell whether handles were closed.
+*
+* Returns a number that changes whenever a cached fd is closed.
+*
+* Description: Function to tell whether handles were closed, for users
+* 	keeping their own references to the handle fds: once it changes,
+* 	an fd number may stand for another file.
+***********************************************************************/
+unsigned int gpio_handle_generation(void)
+{
+	return __atomic_load_n(&gpio_table_gen, __ATOMIC_ACQUIRE);
+}
+
+/***********************************************************************
+* gpio_handle_close_all - Function to close every cached gpio handle.
+*
+* Returns nothing.
+*
+* Description: Function to close every cached gpio handle.
+***********************************************************************/
+void gpio_handle_close_all(void)
+{
+	unsigned int i;
+
+	for(i = 0; i < GPIO_MAX_PINS; i++)
+		gpio_handle_close(i);
+}
+
+/***********************************************************************
+* gpio_handle_write - Function to set value through a gpio handle.
+* @h: GPIO handle
+* @value: value of GPIO PIN
+*
+* Returns 0 on success.
+*
+* Description: Function to set value through a gpio handle. Costs one
+* 	pwrite.
+***********************************************************************/
+int gpio_handle_write(struct gpio_handle *h, unsigned int value)
+{
+	if(pwrite(h->value_fd, (value == GPIO_VALUE_HIGH) ? "1" : "0", 1, 0) != 1)
+	{
+		perror("gpio/handle-write");
+		return -1;
+	}
+	return 0;
+}
+
 /***********************************************************************
-* gpio_set_dir - Function to set directions for gpio pins.
+* gpio_handle_read - Function to get value through a gpio handle.
+* @h: GPIO handle
+* @value: value of GPIO PIN
+*
+* Returns 0 on success.
+*
+* Description: Function to get value through a gpio handle. Costs one
+* 	pread.
+***********************************************************************/
+int gpio_handle_read(struct gpio_handle *h, unsigned int *value)
+{
+	char ch;
+
+	if(pread(h->value_fd, &ch, 1, 0) != 1)
+	{
+		perror("gpio/handle-read");
+		return -1;
+	}
+
+	*value = (ch != '0');
+	return 0;
+}
+
+/*
+ * Writes @str to the cached attribute fd in @slot, opening it on first
+ * use. The fd is opened read/write so the attribute can also be read
+ * back by gpio_sysfs_apply().
+ */
+static int gpio_attr_write(unsigned int gpio, int *slot, const char *name,
+	const char *str)
+{
+	size_t len = strlen(str);
+
+	if(*slot < 0)
+	{
+		pthread_mutex_lock(&gpio_table_lock);
+		if(*slot < 0)
+			*slot = gpio_attr_open(gpio, name, O_RDWR);
+		pthread_mutex_unlock(&gpio_table_lock);
+		if(*slot < 0)
+			return -1;
+	}
+
+	if(pwrite(*slot, str, len, 0) != (ssize_t)len)
+		return -1;
+	return 0;
+}
+
+/***********************************************************************
+* gpio_sysfs_set_dir - Function to set directions for gpio pins.
 * @gpio: GPIO PIN Number
 * @out_flag: Directions of GPIO PIN
 *
@@ -71,31 +334,21 @@ int gpio_unexport(unsigned int gpio)
 * 
 * Description: Function to set directions for gpio pins.
 ***********************************************************************/
-int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
+int gpio_sysfs_set_dir(unsigned int gpio, unsigned int out_flag)
 {
-	int fd, len;
-	char buf[MAX_BUF];
- 
-	len = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%d/direction", gpio);
- 
-	fd = open(buf, O_WRONLY);
-	if(fd < 0)
+	struct gpio_handle *h = gpio_handle_open(gpio);
+
+	if(h == NULL || gpio_attr_write(gpio, &h->dir_fd, "direction",
+		(out_flag == 0) ? "out" : "in") < 0)
 	{
 		perror("gpio/direction");
-		return fd;
+		return -1;
 	}
- 
-	if (out_flag == 0)
-		write(fd, "out", 3);
-	else
-		write(fd, "in", 2);
- 
-	close(fd);
 	return 0;
 }
 
 /***********************************************************************
-* gpio_set_value - Function to set value for gpio pins.
+* gpio_sysfs_set_value - Function to set value for gpio pins.
 * @gpio: GPIO PIN Number
 * @value: value of GPIO PIN
 *
@@ -103,31 +356,17 @@ int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
 * 
 * Description: Function to set value for gpio pins.
 ***********************************************************************/
-int gpio_set_value(unsigned int gpio, unsigned int value)
+int gpio_sysfs_set_value(unsigned int gpio, unsigned int value)
 {
-	int fd, len;
-	char buf[MAX_BUF];
-
-	len = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%d/value", gpio);
+	struct gpio_handle *h = gpio_handle_open(gpio);
 
-	fd = open(buf, O_WRONLY);
-	if(fd < 0)
-	{
-		perror("gpio/set-value");
-		return fd;
-	}
-
-	if(value == GPIO_VALUE_HIGH)
-		write(fd, "1", 1);
-	else
-		write(fd, "0", 1);
-
-	close(fd);
-	return 0;
+	if(h == NULL)
+		return -1;
+	return gpio_handle_write(h, value);
 }
 
 /***********************************************************************
-* gpio_get_value - Function to get value for gpio pins.
+* gpio_sysfs_get_value - Function to get value for gpio pins.
 * @gpio: GPIO PIN Number
 * @value: value of GPIO PIN
 *
@@ -135,34 +374,17 @@ int gpio_set_value(unsigned int gpio, unsigned int value)
 * 
 * Description: Function to get value for gpio pins.
 ***********************************************************************/
-int gpio_get_value(unsigned int gpio, unsigned int *value)
+int gpio_sysfs_get_value(unsigned int gpio, unsigned int *value)
 {
-	int fd, len;
-	char buf[MAX_BUF];
-	char ch;
+	struct gpio_handle *h = gpio_handle_open(gpio);
 
-	len = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%d/value", gpio);
- 
-	fd = open(buf, O_RDONLY);
-	if (fd < 0) {
-		perror("gpio/get-value");
-		return fd;
-	}
- 
-	read(fd, &ch, 1);
-
-	if (ch != '0') {
-		*value = 1;
-	} else {
-		*value = 0;
-	}
- 
-	close(fd);
-	return 0;
+	if(h == NULL)
+		return -1;
+	return gpio_handle_read(h, value);
 }
 
 /***********************************************************************
-* gpio_set_edge - Function to set edge for gpio pins.
+* gpio_sysfs_set_edge - Function to set edge for gpio pins.
 * @gpio: GPIO PIN Number
 * @edge: edge of GPIO PIN
 *
@@ -170,22 +392,15 @@ int gpio_get_value(unsigned int gpio, unsigned int *value)
 * 
 * Description: Function to set edge for gpio pins.
 ***********************************************************************/
-int gpio_set_edge(unsigned int gpio, char *edge)
+int gpio_sysfs_set_edge(unsigned int gpio, char *edge)
 {
-	int fd, len;
-	char buf[MAX_BUF];
+	struct gpio_handle *h = gpio_handle_open(gpio);
 
-	len = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%d/edge", gpio);
- 
-	fd = open(buf, O_WRONLY);
-	if(fd < 0)
+	if(h == NULL || gpio_attr_write(gpio, &h->edge_fd, "edge", edge) < 0)
 	{
 		perror("gpio/set-edge");
-		return fd;
+		return -1;
 	}
- 
-	write(fd, edge, strlen(edge)+1); 
-	close(fd);
 	return 0;
 }
 
@@ -199,11 +414,11 @@ int gpio_set_edge(unsigned int gpio, char *edge)
 ***********************************************************************/
 int gpio_fd_open(unsigned int gpio)
 {
-	int fd, len;
-	char buf[MAX_BUF];
+	int fd;
+	char buf[GPIO_PATH_MAX];
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/value", gpio_root, gpio);
 
-	len = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%d/value", gpio);
- 
 	fd = open(buf, O_RDONLY | O_NONBLOCK );
 	if (fd < 0) {
 		perror("gpio/fd_open");
@@ -223,3 +438,508 @@ int gpio_fd_close(int fd)
 {
 	return close(fd);
 }
+
+/***********************************************************************
+* gpio_sysfs_edge_open - Function to open a pin for edge capture.
+* @gpio: GPIO PIN Number
+* @use_cdev: Set to 1 if the returned fd is a character device line
+*
+* Returns fd on success, negative on failure.
+*
+* Description: Function to open a pin for edge capture. The line is
+* 	first requested from the GPIO character device; that needs the
+* 	pin released from sysfs. If the request fails the pin is exported
+* 	again, set to interrupt on both edges once and for all, and its
+* 	sysfs value fd is returned for POLLPRI polling.
+***********************************************************************/
+int gpio_sysfs_edge_open(unsigned int gpio, int *use_cdev)
+{
+	char chip[MAX_BUF];
+	unsigned int offset;
+	int fd;
+
+	*use_cdev = 0;
+	if(gpio_cdev_lookup(gpio, chip, sizeof(chip), &offset) == 0)
+	{
+		gpio_unexport(gpio);
+		fd = gpio_cdev_request_edges(chip, offset, "hcsr04-echo");
+		if(fd >= 0)
+		{
+			*use_cdev = 1;
+			printf("echo: kernel edge timestamps on %s line %u\n", chip, offset);
+			return fd;
+		}
+		gpio_sysfs_export(gpio);
+	}
+
+	gpio_sysfs_set_dir(gpio, GPIO_DIRECTION_IN);
+	gpio_sysfs_set_edge(gpio, "both");
+	fd = gpio_fd_open(gpio);
+	if(fd >= 0)
+		printf("echo: sysfs both edge polling with rdtsc\n");
+	return fd;
+}
+
+/***********************************************************************
+* gpio_handle_dir_fd - Function to get the direction fd of a handle.
+* @h: GPIO handle
+*
+* Returns fd on success, negative on failure.
+*
+* Description: Function to get the direction fd of a handle, opening
+* 	it on first use.
+***********************************************************************/
+int gpio_handle_dir_fd(struct gpio_handle *h)
+{
+	if(h->dir_fd < 0)
+	{
+		pthread_mutex_lock(&gpio_table_lock);
+		if(h->dir_fd < 0)
+			h->dir_fd = gpio_attr_open(h->gpio, "direction", O_RDWR);
+		pthread_mutex_unlock(&gpio_table_lock);
+	}
+	return h->dir_fd;
+}
+
+/* Reads the direction of @h into *out_flag, opening the fd on first use */
+static int gpio_read_dir(struct gpio_handle *h, unsigned int *out_flag)
+{
+	char buf[8];
+
+	if(gpio_handle_dir_fd(h) < 0)
+		return -1;
+
+	if(pread(h->dir_fd, buf, sizeof(buf), 0) < 1)
+		return -1;
+	*out_flag = (buf[0] == 'i') ? GPIO_DIRECTION_IN : GPIO_DIRECTION_OUT;
+	return 0;
+}
+
+/*
+ * Brings one pin to @cfg, touching only what differs. An output whose
+ * direction is wrong gets "low" or "high" written to its direction,
+ * which sets both at once without a glitch on the line.
+ */
+static int gpio_apply_pin(const struct gpio_pin_cfg *cfg)
+{
+	struct gpio_handle *h = gpio_handle_open(cfg->gpio);
+	unsigned int dir, value;
+
+	if(h == NULL)
+		return -1;
+
+	if(cfg->dir != GPIO_DIRECTION_KEEP)
+	{
+		if(gpio_read_dir(h, &dir) < 0)
+			return -1;
+		if(dir != cfg->dir)
+		{
+			if(cfg->dir == GPIO_DIRECTION_IN)
+				return gpio_attr_write(h->gpio, &h->dir_fd, "direction", "in") < 0 ? -1 : 1;
+			return gpio_attr_write(h->gpio, &h->dir_fd, "direction",
+				(cfg->value == GPIO_VALUE_HIGH) ? "high" : "low") < 0 ? -1 : 1;
+		}
+	}
+
+	if(cfg->value == GPIO_VALUE_KEEP)
+		return 0;
+	if(gpio_handle_read(h, &value) < 0)
+		return -1;
+	if(value == (unsigned int)cfg->value)
+		return 0;
+	return gpio_handle_write(h, cfg->value) < 0 ? -1 : 1;
+}
+
+/***********************************************************************
+* gpio_sysfs_apply - Function to bring a set of pins to a wanted state.
+* @pins: Wanted direction and value of every pin
+* @n: Number of pins
+*
+* Returns number of pins changed, negative if any pin failed.
+*
+* Description: Function to bring a set of pins to a wanted state in one
+* 	pass. Pins are exported if needed and their current state is read
+* 	back first, so a pin that is already right costs two preads and a
+* 	second run over the same table writes nothing.
+***********************************************************************/
+int gpio_sysfs_apply(const struct gpio_pin_cfg *pins, unsigned int n)
+{
+	unsigned int i;
+	int ret, changed = 0, failed = 0;
+
+	for(i = 0; i < n; i++)
+	{
+		ret = gpio_apply_pin(&pins[i]);
+		if(ret < 0)
+		{
+			printf("gpio: can not configure gpio%u\n", pins[i].gpio);
+			failed++;
+		}
+		else
+		{
+			changed += ret;
+		}
+	}
+	return failed ? -failed : changed;
+}
+
+/*
+ * Pin groups of gpio_sysfs_set_values()/gpio_sysfs_get_values(), found
+ * again by their pin list. A group goes through one character device
+ * line request per chip it spans, so setting it costs one ioctl per
+ * chip and the lines of a chip switch at the same instant. A line some
+ * group holds already is borrowed from that request instead of being
+ * requested again, so a pin list overlapping an earlier one, or the
+ * same pins in another order, reaches them through the same request.
+ * Pins that get no request stay on their sysfs handles.
+ */
+#define GPIO_GROUP_SYSFS 0xff	/* chip_of of a pin left on sysfs */
+
+struct gpio_group {
+	unsigned int n;
+	unsigned int gpio[GPIO_GROUP_PINS];
+	int sysfs;		/* some pins are left on sysfs */
+	unsigned int chips;
+	int fd[GPIO_GROUP_CHIPS];	/* -1 if the request failed */
+	int owned[GPIO_GROUP_CHIPS];	/* requested by this group, else borrowed */
+	int output[GPIO_GROUP_CHIPS];	/* owned lines configured as outputs */
+	unsigned int lines[GPIO_GROUP_CHIPS];	/* lines in each owned request */
+	unsigned long long mask[GPIO_GROUP_CHIPS];	/* lines of it this group uses */
+	unsigned char chip_of[GPIO_GROUP_PINS];	/* request of each pin ... */
+	unsigned char bit_of[GPIO_GROUP_PINS];	/* ... and its line in it */
+};
+
+static struct gpio_group gpio_groups[GPIO_GROUPS];
+static unsigned int gpio_group_count;	/* published with release */
+static pthread_mutex_t gpio_group_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Mask of the first @n lines of a request */
+static __inline__ unsigned long long gpio_lines_mask(unsigned int n)
+{
+	return (n >= 64) ? ~0ULL : (1ULL << n) - 1;
+}
+
+/* Returns the group of exactly @pins, NULL if there is none yet */
+static struct gpio_group *gpio_group_find(const unsigned int *pins, unsigned int n)
+{
+	unsigned int i, count = __atomic_load_n(&gpio_group_count, __ATOMIC_ACQUIRE);
+
+	for(i = 0; i < count; i++)
+		if(gpio_groups[i].n == n &&
+			memcmp(gpio_groups[i].gpio, pins, n * sizeof(*pins)) == 0)
+			return &gpio_groups[i];
+	return NULL;
+}
+
+/*
+ * Returns the fd of the request some group holds @gpio in, and its line
+ * in *bit, or -1 if no group requested it. Called with gpio_group_lock.
+ */
+static int gpio_group_holder(unsigned int gpio, unsigned int *bit)
+{
+	struct gpio_group *g;
+	unsigned int i, k, c;
+
+	for(i = 0; i < gpio_group_count; i++)
+	{
+		g = &gpio_groups[i];
+		for(k = 0; k < g->n; k++)
+		{
+			c = g->chip_of[k];
+			if(g->gpio[k] == gpio && c != GPIO_GROUP_SYSFS && g->owned[c])
+			{
+				*bit = g->bit_of[k];
+				return g->fd[c];
+			}
+		}
+	}
+	return -1;
+}
+
+/* Tells whether this process drives @gpio through a cached sysfs handle */
+static int gpio_handle_cached(unsigned int gpio)
+{
+	struct gpio_handle *h;
+
+	if(gpio >= GPIO_MAX_PINS)
+		return 0;
+	pthread_once(&gpio_table_once, gpio_table_init);
+	h = &gpio_table[gpio];
+	return h->value_fd >= 0 || h->dir_fd >= 0 || h->edge_fd >= 0;
+}
+
+/*
+ * Routes the pins of @g to their requests. Lines held by an earlier
+ * group are borrowed; the others are requested, one request per chip,
+ * as outputs at @values, or as they are if @values is NULL. A read
+ * leaves pins that have a cached sysfs handle on sysfs rather than
+ * taking them away from their writer. Requested pins are released from
+ * sysfs for that, and exported again if their request fails.
+ */
+static void gpio_group_request(struct gpio_group *g, const unsigned int *values)
+{
+	char chip[GPIO_GROUP_CHIPS][MAX_BUF], path[MAX_BUF];
+	unsigned int offsets[GPIO_GROUP_CHIPS][GPIO_GROUP_PINS];
+	unsigned long long bits[GPIO_GROUP_CHIPS] = { 0 };
+	unsigned int i, c, first, offset, bit;
+	int fd;
+
+	for(i = 0; i < g->n; i++)
+	{
+		g->chip_of[i] = GPIO_GROUP_SYSFS;
+		fd = gpio_group_holder(g->gpio[i], &bit);
+		if(fd < 0)
+			continue;
+		for(c = 0; c < g->chips && g->fd[c] != fd; c++)
+			;
+		if(c == GPIO_GROUP_CHIPS)
+			continue;
+		if(c == g->chips)
+			g->fd[g->chips++] = fd;
+		g->chip_of[i] = c;
+		g->bit_of[i] = bit;
+		g->mask[c] |= 1ULL << bit;
+	}
+
+	first = g->chips;
+	for(i = 0; i < g->n; i++)
+	{
+		if(g->chip_of[i] != GPIO_GROUP_SYSFS ||
+			(values == NULL && gpio_handle_cached(g->gpio[i])) ||
+			gpio_cdev_lookup(g->gpio[i], path, sizeof(path), &offset) < 0)
+			continue;
+		for(c = first; c < g->chips && strcmp(chip[c], path) != 0; c++)
+			;
+		if(c == GPIO_GROUP_CHIPS)
+			continue;
+		if(c == g->chips)
+		{
+			strcpy(chip[c], path);
+			g->owned[c] = 1;
+			g->chips++;
+		}
+		g->chip_of[i] = c;
+		g->bit_of[i] = g->lines[c];
+		offsets[c][g->lines[c]++] = offset;
+		if(values != NULL && values[i] == GPIO_VALUE_HIGH)
+			bits[c] |= 1ULL << g->bit_of[i];
+	}
+
+	for(c = first; c < g->chips; c++)
+	{
+		for(i = 0; i < g->n; i++)
+			if(g->chip_of[i] == c)
+				gpio_unexport(g->gpio[i]);
+		fd = gpio_cdev_request_lines(chip[c], offsets[c], g->lines[c],
+			(values != NULL) ? GPIO_DIRECTION_OUT : GPIO_DIRECTION_KEEP,
+			bits[c], "hcsr04");
+		if(fd < 0)
+		{
+			for(i = 0; i < g->n; i++)
+			{
+				if(g->chip_of[i] == c)
+				{
+					g->chip_of[i] = GPIO_GROUP_SYSFS;
+					gpio_sysfs_export(g->gpio[i]);
+				}
+			}
+			g->lines[c] = 0;
+		}
+		g->fd[c] = fd;
+		g->output[c] = (values != NULL);
+		g->mask[c] = gpio_lines_mask(g->lines[c]);
+	}
+
+	for(i = 0; i < g->n; i++)
+		if(g->chip_of[i] == GPIO_GROUP_SYSFS)
+			g->sysfs = 1;
+}
+
+/*
+ * Returns the group of @pins, creating it on first use, or NULL if the
+ * group table is full. Lines a new group requests come up at @values,
+ * and *fresh is set for the caller that created it.
+ */
+static struct gpio_group *gpio_group_open(const unsigned int *pins,
+	const unsigned int *values, unsigned int n, int *fresh)
+{
+	struct gpio_group *g;
+
+	*fresh = 0;
+	if(n == 0 || n > GPIO_GROUP_PINS)
+		return NULL;
+	g = gpio_group_find(pins, n);
+	if(g != NULL)
+		return g;
+
+	pthread_mutex_lock(&gpio_group_lock);
+	g = gpio_group_find(pins, n);
+	if(g == NULL && gpio_group_count < GPIO_GROUPS)
+	{
+		g = &gpio_groups[gpio_group_count];
+		memset(g, 0, sizeof(*g));
+		g->n = n;
+		memcpy(g->gpio, pins, n * sizeof(*pins));
+		gpio_group_request(g, values);
+		*fresh = 1;
+		__atomic_store_n(&gpio_group_count, gpio_group_count + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&gpio_group_lock);
+	return g;
+}
+
+/* Releases every pin group; none may be in use */
+static void gpio_group_close_all(void)
+{
+	unsigned int i, c;
+
+	pthread_mutex_lock(&gpio_group_lock);
+	for(i = 0; i < gpio_group_count; i++)
+		for(c = 0; c < gpio_groups[i].chips; c++)
+			if(gpio_groups[i].owned[c] && gpio_groups[i].fd[c] >= 0)
+				close(gpio_groups[i].fd[c]);
+	__atomic_store_n(&gpio_group_count, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&gpio_group_lock);
+}
+
+/*
+ * Sets @pins through their sysfs handles, one pwrite each. With @fresh
+ * the pins are made outputs at @values first, the way gpio_apply()
+ * does; pins without a direction attribute only get their value.
+ */
+static int gpio_values_sysfs_set(const unsigned int *pins,
+	const unsigned int *values, unsigned int n, int fresh)
+{
+	struct gpio_pin_cfg cfg;
+	struct gpio_handle *h;
+	unsigned int i;
+	int ret, failed = 0;
+
+	for(i = 0; i < n; i++)
+	{
+		h = gpio_handle_open(pins[i]);
+		if(h == NULL)
+		{
+			ret = -1;
+		}
+		else if(fresh)
+		{
+			cfg.gpio = pins[i];
+			cfg.dir = (gpio_handle_dir_fd(h) < 0) ? GPIO_DIRECTION_KEEP : GPIO_DIRECTION_OUT;
+			cfg.value = values[i];
+			ret = gpio_apply_pin(&cfg);
+		}
+		else
+		{
+			ret = gpio_handle_write(h, values[i]);
+		}
+		if(ret < 0)
+			failed++;
+	}
+	return failed ? -failed : 0;
+}
+
+/***********************************************************************
+* gpio_sysfs_set_values - Function to set many gpio pins in one call.
+* @pins: GPIO PIN Numbers
+* @values: value of each pin
+* @n: Number of pins
+*
+* Returns 0 on success, negative if any pin failed.
+*
+* Description: Function to set many gpio pins in one call. On first use
+* 	the pins are requested from the GPIO character device as one
+* 	group, as outputs at @values; pins an earlier group holds go
+* 	through its request. Later calls with the same pin list cost one
+* 	GPIO_V2_LINE_SET_VALUES ioctl per chip, and the pins of a chip
+* 	change at the same instant. Without the character device the
+* 	pins are made outputs through sysfs and then written one pwrite
+* 	each. The pins of a group must not also be driven with
+* 	gpio_set_value().
+***********************************************************************/
+int gpio_sysfs_set_values(const unsigned int *pins, const unsigned int *values,
+	unsigned int n)
+{
+	unsigned long long bits[GPIO_GROUP_CHIPS] = { 0 };
+	struct gpio_group *g;
+	unsigned int i, c;
+	int fresh, ret, failed = 0;
+
+	g = gpio_group_open(pins, values, n, &fresh);
+	if(g == NULL)
+		return gpio_values_sysfs_set(pins, values, n, 1);
+
+	for(i = 0; i < n; i++)
+	{
+		c = g->chip_of[i];
+		if(c == GPIO_GROUP_SYSFS)
+		{
+			if(gpio_values_sysfs_set(&pins[i], &values[i], 1, fresh) < 0)
+				failed++;
+		}
+		else if(values[i] == GPIO_VALUE_HIGH)
+		{
+			bits[c] |= 1ULL << g->bit_of[i];
+		}
+	}
+	for(c = 0; c < g->chips; c++)
+	{
+		if(g->fd[c] < 0 || (fresh && g->owned[c]))
+			continue;	/* no lines, or requested at @values */
+		if(!g->owned[c] || g->output[c])
+			ret = gpio_cdev_set_values(g->fd[c], g->mask[c], bits[c]);
+		else
+			ret = gpio_cdev_set_output(g->fd[c], g->lines[c], bits[c]);
+		if(ret < 0)
+			failed++;
+		else if(g->owned[c])
+			g->output[c] = 1;
+	}
+	return failed ? -failed : 0;
+}
+
+/***********************************************************************
+* gpio_sysfs_get_values - Function to read many gpio pins in one call.
+* @pins: GPIO PIN Numbers
+* @values: Filled with the value of each pin
+* @n: Number of pins
+*
+* Returns 0 on success, negative if any pin failed.
+*
+* Description: Function to read many gpio pins in one call, through the
+* 	same groups as gpio_sysfs_set_values(). Pins some group holds are
+* 	read through its request, outputs included. Of the others, those
+* 	this process drives through sysfs are read there, and the rest
+* 	are requested as they are, without changing their direction. One
+* 	GPIO_V2_LINE_GET_VALUES ioctl per chip, one pread per sysfs pin.
+***********************************************************************/
+int gpio_sysfs_get_values(const unsigned int *pins, unsigned int *values,
+	unsigned int n)
+{
+	unsigned long long bits[GPIO_GROUP_CHIPS] = { 0 };
+	struct gpio_group *g;
+	unsigned int i, c;
+	int fresh, failed = 0;
+
+	g = gpio_group_open(pins, NULL, n, &fresh);
+	if(g == NULL)
+	{
+		for(i = 0; i < n; i++)
+			if(gpio_sysfs_get_value(pins[i], &values[i]) < 0)
+				failed++;
+		return failed ? -failed : 0;
+	}
+
+	for(c = 0; c < g->chips; c++)
+		if(g->fd[c] >= 0 && gpio_cdev_get_values(g->fd[c], g->mask[c], &bits[c]) < 0)
+			failed++;
+	for(i = 0; i < n; i++)
+	{
+		c = g->chip_of[i];
+		if(c != GPIO_GROUP_SYSFS)
+			values[i] = (bits[c] >> g->bit_of[i]) & 1;
+		else if(gpio_sysfs_get_value(pins[i], &values[i]) < 0)
+			failed++;
+	}
+	return failed ? -failed : 0;
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "led.h"
+
+/*
+ * GPIO character device (v2 uAPI) support. Needs kernel headers from
+ * Linux 5.10 or later, so it is only built with -DHAVE_GPIO_CDEV; without
+ * it every function fails with -ENOSYS and callers stay on sysfs.
+ */
+#ifdef HAVE_GPIO_CDEV
+#include <linux/gpio.h>
+
+
+/*
+ * Reads a decimal number from a sysfs attribute.
+ */
+static int gpio_cdev_read_attr(const char *dir, const char *name, long *val)
+{
+	char buf[PATH_MAX + MAX_BUF];
+	FILE *fp;
+	int ret;
+
+	snprintf(buf, sizeof(buf), "%s/%s", dir, name);
+	fp = fopen(buf, "r");
+	if(fp == NULL)
+		return -1;
+	ret = (fscanf(fp, "%ld", val) == 1) ? 0 : -1;
+	fclose(fp);
+	return ret;
+}
+
+/***********************************************************************
+* gpio_cdev_lookup - Function to map a sysfs gpio number to a chip line.
+* @gpio: GPIO PIN Number (global sysfs numbering)
+* @chip: Filled with the /dev/gpiochipN path
+* @len: Size of @chip
+* @offset: Filled with the line offset on that chip
+*
+* Returns 0 on success.
+*
+* Description: Function to map a sysfs gpio number to a chip line. The
+* 	sysfs gpiochip<base> directories give the number range of every
+* 	chip, and their device directory names the matching gpiochipN.
+***********************************************************************/
+int gpio_cdev_lookup(unsigned int gpio, char *chip, size_t len,
+	unsigned int *offset)
+{
+	char dir[PATH_MAX], dev[PATH_MAX + MAX_BUF];
+	struct dirent *de, *ce;
+	DIR *root, *devdir;
+	long base, ngpio;
+	int ret = -ENODEV;
+
+	root = opendir(gpio_get_root());
+	if(root == NULL)
+		return -errno;
+
+	while(ret < 0 && (de = readdir(root)) != NULL)
+	{
+		if(strncmp(de->d_name, "gpiochip", 8) != 0)
+			continue;
+
+		snprintf(dir, sizeof(dir), "%s/%s", gpio_get_root(), de->d_name);
+		if(gpio_cdev_read_attr(dir, "base", &base) < 0 ||
+			gpio_cdev_read_attr(dir, "ngpio", &ngpio) < 0)
+			continue;
+		if(gpio < base || gpio >= base + ngpio)
+			continue;
+
+		snprintf(dev, sizeof(dev), "%s/device", dir);
+		devdir = opendir(dev);
+		if(devdir == NULL)
+			continue;
+		while((ce = readdir(devdir)) != NULL)
+		{
+			if(strncmp(ce->d_name, "gpiochip", 8) == 0)
+			{
+				snprintf(chip, len, "/dev/%s", ce->d_name);
+				*offset = gpio - base;
+				ret = 0;
+				break;
+			}
+		}
+		closedir(devdir);
+	}
+
+	closedir(root);
+	return ret;
+}
+
+/***********************************************************************
+* gpio_cdev_request_edges - Function to request a line for edge events.
+* @chip: /dev/gpiochipN path
+* @offset: Line offset on the chip
+* @consumer: Label shown in gpioinfo
+*
+* Returns line fd on success, negative errno on failure.
+*
+* Description: Function to request a line as input with both edges
+* 	enabled. The kernel stamps each edge in its interrupt handler with
+* 	CLOCK_MONOTONIC, so the timestamps carry no userspace wakeup
+* 	latency. The line must not be exported through sysfs.
+***********************************************************************/
+int gpio_cdev_request_edges(const char *chip, unsigned int offset,
+	const char *consumer)
+{
+	struct gpio_v2_line_request req;
+	int fd, ret;
+
+	fd = open(chip, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -errno;
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = offset;
+	req.num_lines = 1;
+	req.event_buffer_size = GPIO_EDGE_BATCH * 4;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+		GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	strncpy(req.consumer, consumer, sizeof(req.consumer) - 1);
+
+	ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	ret = (ret < 0) ? -errno : req.fd;
+	close(fd);
+	return ret;
+}
+
+/***********************************************************************
+* gpio_cdev_read_edges - Function to read a batch of edge events.
+* @fd: Line fd from gpio_cdev_request_edges
+* @edges: Array filled with the events
+* @max: Size of @edges, at most GPIO_EDGE_BATCH
+* @timeout_ms: Poll timeout, -1 to block
+*
+* Returns number of events read, 0 on timeout, negative on error.
+*
+* Description: Function to read a batch of edge events. All the events
+* 	queued by the kernel, up to @max, come back from a single read.
+***********************************************************************/
+int gpio_cdev_read_edges(int fd, struct gpio_edge *edges, int max,
+	int timeout_ms)
+{
+	struct gpio_v2_line_event ev[GPIO_EDGE_BATCH];
+	struct pollfd pfd;
+	ssize_t len;
+	int i, n;
+
+	if(max > GPIO_EDGE_BATCH)
+		max = GPIO_EDGE_BATCH;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	n = poll(&pfd, 1, timeout_ms);
+	if(n <= 0)
+		return (n < 0) ? -errno : 0;
+
+	len = read(fd, ev, max * sizeof(ev[0]));
+	if(len < 0)
+		return -errno;
+
+	n = len / sizeof(ev[0]);
+	for(i = 0; i < n; i++)
+	{
+		edges[i].timestamp_ns = ev[i].timestamp_ns;
+		edges[i].rising = (ev[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+		edges[i].seqno = ev[i].line_seqno;
+	}
+	return n;
+}
+
+/***********************************************************************
+* gpio_cdev_request_lines - Function to request lines as one group.
+* @chip: /dev/gpiochipN path
+* @offsets: Line offsets on the chip
+* @n: Number of lines, at most GPIO_V2_LINES_MAX
+* @dir: GPIO_DIRECTION_OUT, _IN, or _KEEP to leave every line as it is
+* @values: Initial output levels, bit i for @offsets[i]
+* @consumer: Label shown in gpioinfo
+*
+* Returns line fd on success, negative errno on failure.
+*
+* Description: Function to request a group of lines on one chip. Outputs
+* 	come up at @values directly, without a glitch through another
+* 	level. With GPIO_DIRECTION_KEEP neither direction flag is set, so
+* 	lines driven before the request keep their level. The lines must
+* 	not be exported through sysfs.
+***********************************************************************/
+int gpio_cdev_request_lines(const char *chip, const unsigned int *offsets,
+	unsigned int n, unsigned int dir, unsigned long long values, const char *consumer)
+{
+	struct gpio_v2_line_request req;
+	unsigned int i;
+	int fd, ret;
+
+	if(n == 0 || n > GPIO_V2_LINES_MAX)
+		return -EINVAL;
+
+	fd = open(chip, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -errno;
+
+	memset(&req, 0, sizeof(req));
+	for(i = 0; i < n; i++)
+		req.offsets[i] = offsets[i];
+	req.num_lines = n;
+	if(dir == GPIO_DIRECTION_OUT)
+	{
+		req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+		req.config.num_attrs = 1;
+		req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		req.config.attrs[0].attr.values = values;
+		req.config.attrs[0].mask = (n >= 64) ? ~0ULL : (1ULL << n) - 1;
+	}
+	else if(dir == GPIO_DIRECTION_IN)
+	{
+		req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	}
+	strncpy(req.consumer, consumer, sizeof(req.consumer) - 1);
+
+	ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	ret = (ret < 0) ? -errno : req.fd;
+	close(fd);
+	return ret;
+}
+
+/***********************************************************************
+* gpio_cdev_set_output - Function to turn requested lines into outputs.
+* @fd: Line fd from gpio_cdev_request_lines
+* @n: Number of lines in the request
+* @values: Output levels, bit i for line i of the request
+*
+* Returns 0 on success, negative errno on failure.
+*
+* Description: Function to turn the lines of an input request into
+* 	outputs at @values, with one ioctl.
+***********************************************************************/
+int gpio_cdev_set_output(int fd, unsigned int n, unsigned long long values)
+{
+	struct gpio_v2_line_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	cfg.num_attrs = 1;
+	cfg.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	cfg.attrs[0].attr.values = values;
+	cfg.attrs[0].mask = (n >= 64) ? ~0ULL : (1ULL << n) - 1;
+	return (ioctl(fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &cfg) < 0) ? -errno : 0;
+}
+
+/***********************************************************************
+* gpio_cdev_set_values - Function to set requested output lines.
+* @fd: Line fd from gpio_cdev_request_lines
+* @mask: Lines to set, bit i for line i of the request
+* @bits: Their levels
+*
+* Returns 0 on success, negative errno on failure.
+*
+* Description: Function to set any number of output lines of a request
+* 	with one ioctl. The kernel drives them together where the chip
+* 	driver can, so they change at the same instant.
+***********************************************************************/
+int gpio_cdev_set_values(int fd, unsigned long long mask, unsigned long long bits)
+{
+	struct gpio_v2_line_values lv;
+
+	lv.mask = mask;
+	lv.bits = bits;
+	return (ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv) < 0) ? -errno : 0;
+}
+
+/***********************************************************************
+* gpio_cdev_get_values - Function to read requested lines.
+* @fd: Line fd from gpio_cdev_request_lines
+* @mask: Lines to read, bit i for line i of the request
+* @bits: Filled with their levels
+*
+* Returns 0 on success, negative errno on failure.
+*
+* Description: Function to read any number of lines of a request with
+* 	one ioctl.
+***********************************************************************/
+int gpio_cdev_get_values(int fd, unsigned long long mask, unsigned long long *bits)
+{
+	struct gpio_v2_line_values lv;
+
+	lv.mask = mask;
+	lv.bits = 0;
+	if(ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) < 0)
+		return -errno;
+	*bits = lv.bits;
+	return 0;
+}
+
+#else /* !HAVE_GPIO_CDEV */
+
+int gpio_cdev_lookup(unsigned int gpio, char *chip, size_t len,
+	unsigned int *offset)
+{
+	return -ENOSYS;
+}
+
+int gpio_cdev_request_edges(const char *chip, unsigned int offset,
+	const char *consumer)
+{
+	return -ENOSYS;
+}
+
+int gpio_cdev_read_edges(int fd, struct gpio_edge *edges, int max,
+	int timeout_ms)
+{
+	return -ENOSYS;
+}
+
+int gpio_cdev_request_lines(const char *chip, const unsigned int *offsets,
+	unsigned int n, unsigned int dir, unsigned long long values, const char *consumer)
+{
+	return -ENOSYS;
+}
+
+int gpio_cdev_set_output(int fd, unsigned int n, unsigned long long values)
+{
+	return -ENOSYS;
+}
+
+int gpio_cdev_set_values(int fd, unsigned long long mask, unsigned long long bits)
+{
+	return -ENOSYS;
+}
+
+int gpio_cdev_get_values(int fd, unsigned long long mask, unsigned long long *bits)
+{
+	return -ENOSYS;
+}
+
+#endif /* HAVE_GPIO_CDEV */
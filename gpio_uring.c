@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "led.h"
+
+/*
+ * Batched sysfs attribute access. With -DHAVE_GPIO_URING (Linux >= 5.6
+ * headers) a batch is one io_uring_enter() on a ring set up on first
+ * use, with the handle fds and a data arena registered once, so the
+ * kernel does not look up files or pin pages per operation. Without it,
+ * or on a kernel that refuses io_uring, a batch is a loop of preads and
+ * pwrites, exactly what gpio.c issues one pin at a time.
+ */
+#ifdef HAVE_GPIO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+
+/* The ring, shared by every batch under ring_lock; @fd < 0 if unusable */
+static struct {
+	int fd;
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_len, cq_len, sqes_len;
+	int file_fd[GPIO_URING_FILES];	/* fd registered at each index, or -1 */
+	unsigned int gen;		/* gpio_handle_generation() of file_fd[] */
+	char arena[GPIO_BATCH_MAX][GPIO_BATCH_DATA];	/* registered buffer */
+} ring = { .fd = -1 };
+
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void gpio_uring_teardown(void)
+{
+	if(ring.sqes != NULL && ring.sqes != MAP_FAILED)
+		munmap(ring.sqes, ring.sqes_len);
+	if(ring.cq_map != NULL && ring.cq_map != MAP_FAILED && ring.cq_map != ring.sq_map)
+		munmap(ring.cq_map, ring.cq_len);
+	if(ring.sq_map != NULL && ring.sq_map != MAP_FAILED)
+		munmap(ring.sq_map, ring.sq_len);
+	if(ring.fd >= 0)
+		close(ring.fd);
+	ring.sqes = NULL;
+	ring.sq_map = ring.cq_map = NULL;
+	ring.fd = -1;
+}
+
+/*
+ * Sets the ring up: maps it, registers a file table of GPIO_URING_FILES
+ * empty slots and the data arena. Any failure leaves @fd at -1.
+ */
+static void gpio_uring_setup(void)
+{
+	struct io_uring_params p;
+	struct iovec iov;
+	static int files[GPIO_URING_FILES];
+	char *sq, *cq;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = syscall(__NR_io_uring_setup, GPIO_BATCH_MAX, &p);
+	if(ring.fd < 0)
+	{
+		printf("gpio: no io_uring (%s), batches use plain writes\n", strerror(errno));
+		return;
+	}
+
+	ring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring.cq_len > ring.sq_len)
+			ring.sq_len = ring.cq_len;
+		ring.cq_len = ring.sq_len;
+	}
+	ring.sq_map = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		ring.cq_map = ring.sq_map;
+	else
+		ring.cq_map = mmap(NULL, ring.cq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+	ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if(ring.sq_map == MAP_FAILED || ring.cq_map == MAP_FAILED || ring.sqes == MAP_FAILED)
+	{
+		perror("gpio/io_uring-mmap");
+		gpio_uring_teardown();
+		return;
+	}
+
+	sq = ring.sq_map;
+	cq = ring.cq_map;
+	ring.sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned int *)(sq + p.sq_off.array);
+	ring.cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ring.cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	for(i = 0; i < GPIO_URING_FILES; i++)
+		files[i] = ring.file_fd[i] = -1;
+	iov.iov_base = ring.arena;
+	iov.iov_len = sizeof(ring.arena);
+	if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES,
+			files, GPIO_URING_FILES) < 0 ||
+		syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+	{
+		printf("gpio: io_uring registration failed (%s), batches use plain writes\n",
+			strerror(errno));
+		gpio_uring_teardown();
+		return;
+	}
+	ring.gen = gpio_handle_generation();
+}
+
+/*
+ * Puts the fds of @b into the file table, at their own number. Only fds
+ * not registered yet cost a syscall, so steady state costs none. After
+ * a gpio handle was closed an fd number may stand for another file, and
+ * every slot is refreshed on its next use.
+ */
+static void gpio_uring_files(const struct gpio_batch *b)
+{
+	struct io_uring_files_update up;
+	unsigned int i, gen = gpio_handle_generation();
+	int fd;
+
+	if(gen != ring.gen)
+	{
+		for(i = 0; i < GPIO_URING_FILES; i++)
+			ring.file_fd[i] = -1;
+		ring.gen = gen;
+	}
+
+	for(i = 0; i < b->count; i++)
+	{
+		fd = b->op[i].fd;
+		if(fd < 0 || fd >= GPIO_URING_FILES || ring.file_fd[fd] == fd)
+			continue;
+		memset(&up, 0, sizeof(up));
+		up.offset = fd;
+		up.fds = (unsigned long)&fd;
+		if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES_UPDATE,
+			&up, 1) == 1)
+			ring.file_fd[fd] = fd;
+	}
+}
+
+/* Runs @b through the ring. Returns -1 if the ring failed under it */
+static int gpio_uring_submit(struct gpio_batch *b)
+{
+	unsigned int i, idx, head, tail, n = b->count, submitted = 0, done = 0;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	pthread_mutex_lock(&ring_lock);
+	gpio_uring_files(b);
+
+	tail = *ring.sq_tail;
+	for(i = 0; i < n; i++)
+	{
+		idx = (tail + i) & *ring.sq_mask;
+		sqe = &ring.sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		if(b->op[i].write)
+		{
+			memcpy(ring.arena[i], b->op[i].data, b->op[i].len);
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->len = b->op[i].len;
+		}
+		else
+		{
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->len = GPIO_BATCH_DATA;
+		}
+		sqe->fd = b->op[i].fd;
+		if(b->op[i].fd < GPIO_URING_FILES && ring.file_fd[b->op[i].fd] == b->op[i].fd)
+			sqe->flags = IOSQE_FIXED_FILE;
+		sqe->addr = (unsigned long)ring.arena[i];
+		sqe->off = 0;
+		sqe->buf_index = 0;
+		sqe->user_data = i;
+		ring.sq_array[idx] = idx;
+	}
+	__atomic_store_n(ring.sq_tail, tail + n, __ATOMIC_RELEASE);
+
+	while(done < n)
+	{
+		ret = syscall(__NR_io_uring_enter, ring.fd, n - submitted, n - done,
+			IORING_ENTER_GETEVENTS, NULL, 0);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("gpio/io_uring-enter");
+			/* queued entries can not be taken back, drop the ring */
+			gpio_uring_teardown();
+			pthread_mutex_unlock(&ring_lock);
+			return -1;
+		}
+		submitted += ret;
+
+		head = *ring.cq_head;
+		while(head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+		{
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			i = cqe->user_data;
+			b->op[i].res = cqe->res;
+			if(!b->op[i].write && cqe->res > 0)
+				memcpy(b->op[i].data, ring.arena[i], cqe->res);
+			head++;
+			done++;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&ring_lock);
+	return 0;
+}
+
+#else /* !HAVE_GPIO_URING */
+
+static struct {
+	int fd;
+} ring = { .fd = -1 };
+
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static void gpio_uring_setup(void)
+{
+}
+
+static int gpio_uring_submit(struct gpio_batch *b)
+{
+	return -ENOSYS;
+}
+
+#endif /* HAVE_GPIO_URING */
+
+/***********************************************************************
+* gpio_uring_available - Function to tell if batches go through io_uring.
+*
+* Returns 1 if they do, 0 if they fall back to plain reads and writes.
+*
+* Description: Function to tell if batches go through io_uring, setting
+* 	the ring up on the first call.
+***********************************************************************/
+int gpio_uring_available(void)
+{
+	pthread_once(&ring_once, gpio_uring_setup);
+	return ring.fd >= 0;
+}
+
+/***********************************************************************
+* gpio_batch_reset - Function to empty a batch.
+* @b: Batch
+*
+* Returns nothing.
+*
+* Description: Function to empty a batch.
+***********************************************************************/
+void gpio_batch_reset(struct gpio_batch *b)
+{
+	b->count = 0;
+}
+
+/***********************************************************************
+* gpio_batch_read - Function to queue an attribute read.
+* @b: Batch
+* @fd: Cached gpio handle fd, see gpio_handle_open()
+*
+* Returns index of the operation in @b, negative if it is full.
+*
+* Description: Function to queue a read of up to GPIO_BATCH_DATA bytes
+* 	at offset 0.
+***********************************************************************/
+int gpio_batch_read(struct gpio_batch *b, int fd)
+{
+	if(b->count >= GPIO_BATCH_MAX)
+		return -ENOSPC;
+
+	b->op[b->count].fd = fd;
+	b->op[b->count].write = 0;
+	b->op[b->count].len = GPIO_BATCH_DATA;
+	b->op[b->count].res = 0;
+	return b->count++;
+}
+
+/***********************************************************************
+* gpio_batch_write - Function to queue an attribute write.
+* @b: Batch
+* @fd: Cached gpio handle fd, see gpio_handle_open()
+* @str: What to write, at most GPIO_BATCH_DATA bytes
+*
+* Returns index of the operation in @b, negative on failure.
+*
+* Description: Function to queue a write at offset 0. @str is copied.
+***********************************************************************/
+int gpio_batch_write(struct gpio_batch *b, int fd, const char *str)
+{
+	size_t len = strlen(str);
+
+	if(b->count >= GPIO_BATCH_MAX)
+		return -ENOSPC;
+	if(len > GPIO_BATCH_DATA)
+		return -EINVAL;
+
+	b->op[b->count].fd = fd;
+	b->op[b->count].write = 1;
+	b->op[b->count].len = len;
+	b->op[b->count].res = 0;
+	memcpy(b->op[b->count].data, str, len);
+	return b->count++;
+}
+
+/* The fallback: one syscall per operation */
+static void gpio_batch_plain(struct gpio_batch *b)
+{
+	unsigned int i;
+
+	for(i = 0; i < b->count; i++)
+	{
+		if(b->op[i].write)
+			b->op[i].res = pwrite(b->op[i].fd, b->op[i].data, b->op[i].len, 0);
+		else
+			b->op[i].res = pread(b->op[i].fd, b->op[i].data, GPIO_BATCH_DATA, 0);
+		if(b->op[i].res < 0)
+			b->op[i].res = -errno;
+	}
+}
+
+/***********************************************************************
+* gpio_batch_submit - Function to run every queued operation.
+* @b: Batch
+*
+* Returns number of operations that failed or fell short.
+*
+* Description: Function to run every queued operation and wait for all
+* 	of them. They are independent and may complete in any order. On
+* 	io_uring this is a single io_uring_enter() whatever the batch
+* 	size; otherwise each operation is its own syscall.
+***********************************************************************/
+int gpio_batch_submit(struct gpio_batch *b)
+{
+	unsigned int i;
+	int failed = 0;
+
+	if(b->count == 0)
+		return 0;
+	if(!gpio_uring_available() || gpio_uring_submit(b) < 0)
+		gpio_batch_plain(b);
+
+	for(i = 0; i < b->count; i++)
+		if(b->op[i].res < 0 || (b->op[i].write && b->op[i].res != (int)b->op[i].len))
+			failed++;
+	return failed;
+}
+
+/* gpio_uring_apply() for up to GPIO_BATCH_MAX / 2 pins */
+static int gpio_uring_apply_chunk(const struct gpio_pin_cfg *pins, unsigned int n,
+	int *failed)
+{
+	struct gpio_batch rd, wr;
+	struct gpio_handle *h;
+	int dir_op[GPIO_BATCH_MAX / 2], val_op[GPIO_BATCH_MAX / 2];
+	int bad[GPIO_BATCH_MAX / 2], wr_op[GPIO_BATCH_MAX / 2];
+	const struct gpio_pin_cfg *cfg;
+	unsigned int i, dir, value;
+	int fd, changed = 0;
+
+	/* what every pin is now, in one batch */
+	gpio_batch_reset(&rd);
+	for(i = 0; i < n; i++)
+	{
+		cfg = &pins[i];
+		dir_op[i] = val_op[i] = wr_op[i] = -1;
+		h = gpio_handle_open(cfg->gpio);
+		bad[i] = (h == NULL);
+		if(bad[i])
+			continue;
+		if(cfg->dir != GPIO_DIRECTION_KEEP)
+		{
+			fd = gpio_handle_dir_fd(h);
+			if(fd < 0)
+				bad[i] = 1;
+			else
+				dir_op[i] = gpio_batch_read(&rd, fd);
+		}
+		if(cfg->value != GPIO_VALUE_KEEP)
+			val_op[i] = gpio_batch_read(&rd, h->value_fd);
+	}
+	gpio_batch_submit(&rd);
+
+	/* what has to change, as gpio_sysfs_apply() decides it, in another */
+	gpio_batch_reset(&wr);
+	for(i = 0; i < n; i++)
+	{
+		cfg = &pins[i];
+		if(bad[i])
+			continue;
+		h = gpio_handle_open(cfg->gpio);
+		if(dir_op[i] >= 0)
+		{
+			if(rd.op[dir_op[i]].res < 1)
+			{
+				bad[i] = 1;
+				continue;
+			}
+			dir = (rd.op[dir_op[i]].data[0] == 'i') ? GPIO_DIRECTION_IN : GPIO_DIRECTION_OUT;
+			if(dir != cfg->dir)
+			{
+				if(cfg->dir == GPIO_DIRECTION_IN)
+					wr_op[i] = gpio_batch_write(&wr, h->dir_fd, "in");
+				else
+					wr_op[i] = gpio_batch_write(&wr, h->dir_fd,
+						(cfg->value == GPIO_VALUE_HIGH) ? "high" : "low");
+				continue;
+			}
+		}
+		if(val_op[i] < 0)
+			continue;
+		if(rd.op[val_op[i]].res < 1)
+		{
+			bad[i] = 1;
+			continue;
+		}
+		value = (rd.op[val_op[i]].data[0] != '0');
+		if(value != (unsigned int)cfg->value)
+			wr_op[i] = gpio_batch_write(&wr, h->value_fd,
+				(cfg->value == GPIO_VALUE_HIGH) ? "1" : "0");
+	}
+	gpio_batch_submit(&wr);
+
+	for(i = 0; i < n; i++)
+	{
+		if(!bad[i] && wr_op[i] >= 0)
+		{
+			if(wr.op[wr_op[i]].res == (int)wr.op[wr_op[i]].len)
+				changed++;
+			else
+				bad[i] = 1;
+		}
+		if(bad[i])
+		{
+			printf("gpio: can not configure gpio%u\n", pins[i].gpio);
+			(*failed)++;
+		}
+	}
+	return changed;
+}
+
+/***********************************************************************
+* gpio_uring_apply - Function to bring a set of pins to a wanted state.
+* @pins: Wanted direction and value of every pin
+* @n: Number of pins
+*
+* Returns number of pins changed, negative if any pin failed.
+*
+* Description: Function to do what gpio_sysfs_apply() does with two
+* 	batches per GPIO_BATCH_MAX / 2 pins: one reading the direction
+* 	and value of every pin, one writing those that differ. Pins are
+* 	opened, and exported if needed, the first time as before.
+***********************************************************************/
+int gpio_uring_apply(const struct gpio_pin_cfg *pins, unsigned int n)
+{
+	unsigned int i, part;
+	int changed = 0, failed = 0;
+
+	for(i = 0; i < n; i += part)
+	{
+		part = (n - i > GPIO_BATCH_MAX / 2) ? GPIO_BATCH_MAX / 2 : n - i;
+		changed += gpio_uring_apply_chunk(&pins[i], part, &failed);
+	}
+	return failed ? -failed : changed;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include "led.h"
+#include "spi.h"
+#include "hw.h"
+
+
+/* The board: sysfs GPIO, character device edges, spidev */
+const struct hw_backend hw_linux = {
+	.name = "linux",
+	.gpio_export = gpio_sysfs_export,
+	.gpio_set_dir = gpio_sysfs_set_dir,
+	.gpio_set_value = gpio_sysfs_set_value,
+	.gpio_get_value = gpio_sysfs_get_value,
+	.gpio_set_edge = gpio_sysfs_set_edge,
+	.gpio_edge_open = gpio_sysfs_edge_open,
+#ifdef HAVE_GPIO_URING
+	.gpio_apply = gpio_uring_apply,
+#else
+	.gpio_apply = gpio_sysfs_apply,
+#endif
+	.gpio_set_values = gpio_sysfs_set_values,
+	.gpio_get_values = gpio_sysfs_get_values,
+	.spi_open = spidev_open,
+	.spi_message = spidev_message,
+};
+
+const struct hw_backend *hw = &hw_linux;
+
+/***********************************************************************
+* hw_set_backend - Function to select the hardware backend.
+* @backend: Backend, e.g. &hw_linux or &hw_fake
+*
+* Returns nothing.
+*
+* Description: Function to select the hardware backend. Must be called
+* 	before any pin or device is opened.
+***********************************************************************/
+void hw_set_backend(const struct hw_backend *backend)
+{
+	hw = backend;
+	printf("hw: %s backend\n", backend->name);
+}
+
+/***********************************************************************
+* gpio_export - Function to export gpio pins.
+* @gpio: GPIO PIN Number
+*
+* Returns 0 on success.
+*
+* Description: Function to export gpio pins.
+***********************************************************************/
+int gpio_export(unsigned int gpio)
+{
+	return hw->gpio_export(gpio);
+}
+
+/***********************************************************************
+* gpio_set_dir - Function to set directions for gpio pins.
+* @gpio: GPIO PIN Number
+* @out_flag: Directions of GPIO PIN
+*
+* Returns 0 on success.
+*
+* Description: Function to set directions for gpio pins.
+***********************************************************************/
+int gpio_set_dir(unsigned int gpio, unsigned int out_flag)
+{
+	return hw->gpio_set_dir(gpio, out_flag);
+}
+
+/***********************************************************************
+* gpio_set_value - Function to set value for gpio pins.
+* @gpio: GPIO PIN Number
+* @value: value of GPIO PIN
+*
+* Returns 0 on success.
+*
+* Description: Function to set value for gpio pins.
+***********************************************************************/
+int gpio_set_value(unsigned int gpio, unsigned int value)
+{
+	return hw->gpio_set_value(gpio, value);
+}
+
+/***********************************************************************
+* gpio_get_value - Function to get value for gpio pins.
+* @gpio: GPIO PIN Number
+* @value: value of GPIO PIN
+*
+* Returns 0 on success.
+*
+* Description: Function to get value for gpio pins.
+***********************************************************************/
+int gpio_get_value(unsigned int gpio, unsigned int *value)
+{
+	return hw->gpio_get_value(gpio, value);
+}
+
+/***********************************************************************
+* gpio_set_edge - Function to set edge for gpio pins.
+* @gpio: GPIO PIN Number
+* @edge: edge of GPIO PIN
+*
+* Returns 0 on success.
+*
+* Description: Function to set edge for gpio pins.
+***********************************************************************/
+int gpio_set_edge(unsigned int gpio, char *edge)
+{
+	return hw->gpio_set_edge(gpio, edge);
+}
+
+/***********************************************************************
+* gpio_edge_open - Function to open a pin for edge capture.
+* @gpio: GPIO PIN Number
+* @use_cdev: Set to 1 if the fd delivers gpio_v2_line_event records
+*
+* Returns fd on success, negative on failure.
+*
+* Description: Function to open a pin for edge capture.
+***********************************************************************/
+int gpio_edge_open(unsigned int gpio, int *use_cdev)
+{
+	return hw->gpio_edge_open(gpio, use_cdev);
+}
+
+/***********************************************************************
+* gpio_apply - Function to bring a set of pins to a wanted state.
+* @pins: Wanted direction and value of every pin
+* @n: Number of pins
+*
+* Returns number of pins changed, negative if any pin failed.
+*
+* Description: Function to bring a set of pins to a wanted state in one
+* 	pass, leaving alone the pins that are already right.
+***********************************************************************/
+int gpio_apply(const struct gpio_pin_cfg *pins, unsigned int n)
+{
+	return hw->gpio_apply(pins, n);
+}
+
+/***********************************************************************
+* gpio_set_values - Function to set many gpio pins in one call.
+* @pins: GPIO PIN Numbers
+* @values: value of each pin
+* @n: Number of pins
+*
+* Returns 0 on success, negative if any pin failed.
+*
+* Description: Function to set many gpio pins in one call. The same pin
+* 	list is kept as one group, whose pins change together where the
+* 	backend can do it.
+***********************************************************************/
+int gpio_set_values(const unsigned int *pins, const unsigned int *values,
+	unsigned int n)
+{
+	return hw->gpio_set_values(pins, values, n);
+}
+
+/***********************************************************************
+* gpio_get_values - Function to read many gpio pins in one call.
+* @pins: GPIO PIN Numbers
+* @values: Filled with the value of each pin
+* @n: Number of pins
+*
+* Returns 0 on success, negative if any pin failed.
+*
+* Description: Function to read many gpio pins in one call.
+***********************************************************************/
+int gpio_get_values(const unsigned int *pins, unsigned int *values,
+	unsigned int n)
+{
+	return hw->gpio_get_values(pins, values, n);
+}
+
+/***********************************************************************
+* spi_open - Function to open the SPI device.
+* @device: Device node
+*
+* Returns fd on success, negative on failure.
+*
+* Description: Function to open the SPI device.
+***********************************************************************/
+int spi_open(const char *device)
+{
+	return hw->spi_open(device);
+}
@@ -0,0 +1,81 @@
+#ifndef __HW_FUNC_H__
+#define __HW_FUNC_H__
+
+#include <linux/spi/spidev.h>
+#include "led.h"
+
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * Everything the application needs from the hardware. gpio_*() and
+ * spi_open()/spi_frame_submit() go through the backend in use, so the
+ * same sensor and display code runs against sysfs/spidev on the board
+ * or against in-memory fakes on a build host.
+ *
+ * gpio_edge_open returns an fd that becomes readable on echo edges. With
+ * *use_cdev set it delivers struct gpio_v2_line_event records, otherwise
+ * it is a sysfs value fd signalling POLLPRI.
+ */
+struct hw_backend {
+	const char *name;
+	int (*gpio_export)(unsigned int gpio);
+	int (*gpio_set_dir)(unsigned int gpio, unsigned int out_flag);
+	int (*gpio_set_value)(unsigned int gpio, unsigned int value);
+	int (*gpio_get_value)(unsigned int gpio, unsigned int *value);
+	int (*gpio_set_edge)(unsigned int gpio, char *edge);
+	int (*gpio_edge_open)(unsigned int gpio, int *use_cdev);
+	int (*gpio_apply)(const struct gpio_pin_cfg *pins, unsigned int n);
+	int (*gpio_set_values)(const unsigned int *pins, const unsigned int *values,
+		unsigned int n);
+	int (*gpio_get_values)(const unsigned int *pins, unsigned int *values,
+		unsigned int n);
+	int (*spi_open)(const char *device);
+	int (*spi_message)(int fd, struct spi_ioc_transfer *tr, unsigned int n);
+};
+
+/* Counters kept by the fake backend */
+struct hw_fake_stats {
+	unsigned long long triggers;	/* trigger pulses seen */
+	unsigned long long echoes;	/* echo pulses played back */
+	unsigned long long spi_messages;
+	unsigned long long spi_transfers;
+	unsigned long long spi_bytes;
+	unsigned long long late_edges;	/* edges emitted > 100 us late */
+	unsigned long long replay_left;	/* recorded cycles not played yet */
+	unsigned long long spi_hash;	/* FNV-1a of every SPI byte sent */
+};
+
+struct measlog_header;
+struct measlog_record;
+
+/****************************************************************
+ * Globals
+ ****************************************************************/
+
+extern const struct hw_backend *hw;
+extern const struct hw_backend hw_linux;
+extern const struct hw_backend hw_fake;
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+void hw_set_backend(const struct hw_backend *backend);
+
+int hw_fake_add_sensor(unsigned int trig_gpio, unsigned int echo_gpio);
+void hw_fake_set_target(unsigned int trig_gpio,
+	unsigned long long (*distance_um)(unsigned long long now_ns, void *arg),
+	void *arg);
+void hw_fake_get_stats(struct hw_fake_stats *st);
+const unsigned char *hw_fake_spi_regs(void);
+long hw_fake_replay(unsigned int trig_gpio, const struct measlog_header *hdr,
+	const struct measlog_record *rec, unsigned long count,
+	unsigned int sensor_id, int fast);
+unsigned long long hw_fake_replay_stamp(unsigned int trig_gpio);
+int hw_fake_record_spi(const char *path);
+
+
+#endif /* __HW_FUNC_H__ */
@@ -0,0 +1,597 @@
+/*
+ * In-memory hardware backend for running the application on a build host.
+ *
+ * GPIO values live in a table. Each registered sensor pairs a trigger pin
+ * with an echo pin: the falling edge of a trigger pulse schedules an echo
+ * pulse whose width follows a target distance model, and a player thread
+ * writes its two edges as gpio_v2_line_event records into a pipe at the
+ * simulated times, exactly as the GPIO character device would. Instead of
+ * following a distance model a sensor can replay a measurement log, one
+ * recorded cycle per trigger. SPI messages are accepted instantly,
+ * counted, hashed, optionally recorded, and decoded into the MAX7219
+ * register file.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/gpio.h>
+#include "led.h"
+#include "sensor.h"
+#include "measlog.h"
+#include "hw.h"
+
+
+#define FAKE_MAX_SENSORS 8
+#define FAKE_LATE_NS 100000ULL	/* edge written this late counts as late */
+#define FAKE_LOST_NS 1000000000ULL	/* fast replay: echo that never ended */
+#define FAKE_FNV_BASIS 14695981039346656037ULL
+#define FAKE_FNV_PRIME 1099511628211ULL
+
+/* Default target: walks between 30 and 150 cm at 40 cm/s */
+#define FAKE_NEAR_UM 300000ULL
+#define FAKE_FAR_UM 1500000ULL
+#define FAKE_SPEED_UM_S 400000ULL
+
+struct fake_sensor {
+	unsigned int trig_gpio;
+	unsigned int echo_gpio;
+	int pipe[2];		/* [0] handed out as the line fd */
+	unsigned long long rise_ns;	/* pending edges, 0 when idle */
+	unsigned long long fall_ns;
+	unsigned int seqno;
+	unsigned long long (*distance_um)(unsigned long long now_ns, void *arg);
+	void *arg;
+	const struct measlog_header *hdr;	/* replay, NULL when modelled */
+	const struct measlog_record *rec;
+	unsigned long count;
+	unsigned long pos;
+	unsigned int replay_id;
+	int fast;
+	unsigned long long replay_stamp;	/* recorded time of the last cycle */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_once_t once;
+	pthread_t player;
+	unsigned char value[GPIO_MAX_PINS];
+	unsigned char dir[GPIO_MAX_PINS];
+	struct fake_sensor sensor[FAKE_MAX_SENSORS];
+	unsigned int count;
+	unsigned char regs[16];
+	FILE *spi_rec;
+	struct hw_fake_stats stats;
+} fake = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+	.stats = { .spi_hash = FAKE_FNV_BASIS },
+};
+
+static unsigned long long fake_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long fake_walk_um(unsigned long long now_ns, void *arg)
+{
+	unsigned long long span = FAKE_FAR_UM - FAKE_NEAR_UM;
+	unsigned long long pos;
+
+	now_ns += (unsigned long)arg * 1000000000ULL;
+	pos = (now_ns / 1000) * FAKE_SPEED_UM_S / 1000000 % (2 * span);
+	return FAKE_NEAR_UM + ((pos < span) ? pos : 2 * span - pos);
+}
+
+static void fake_emit(struct fake_sensor *s, unsigned long long t, int rising)
+{
+	struct gpio_v2_line_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.timestamp_ns = t;
+	ev.id = rising ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+	ev.offset = s->echo_gpio;
+	ev.seqno = ev.line_seqno = ++s->seqno;
+	write(s->pipe[1], &ev, sizeof(ev));
+	fake.value[s->echo_gpio] = rising;
+}
+
+/*
+ * Plays the next recorded cycle of a replaying sensor, triggered at @now:
+ * the echo keeps its recorded delay and width. Fast replays write both
+ * edges at once, and end an echo that never fell right away too.
+ */
+static void fake_replay_next(struct fake_sensor *s, unsigned long long now)
+{
+	const struct measlog_record *r;
+	unsigned long long rise, fall = 0;
+
+	while(s->pos < s->count && s->rec[s->pos].sensor_id != s->replay_id)
+		s->pos++;
+	if(s->pos >= s->count)
+		return;
+	r = &s->rec[s->pos++];
+	fake.stats.replay_left--;
+	s->replay_stamp = measlog_stamp_ns(s->hdr, r, r->rise ? r->rise : r->trigger);
+	if(r->rise == 0)
+		return;
+
+	rise = now + ((r->rise > r->trigger) ? measlog_stamp_ns(s->hdr, r, r->rise - r->trigger) : 0);
+	if(r->fall > r->rise)
+		fall = rise + measlog_stamp_ns(s->hdr, r, r->fall - r->rise);
+
+	if(s->fast)
+	{
+		fake_emit(s, rise, 1);
+		fake_emit(s, fall ? fall : rise + FAKE_LOST_NS, 0);
+		fake.stats.echoes++;
+		return;
+	}
+	s->rise_ns = rise;
+	s->fall_ns = fall;
+	pthread_cond_signal(&fake.cond);
+}
+
+/*
+ * Player thread: sleeps until the earliest pending edge of any sensor and
+ * writes it. Edges carry their scheduled time, like a kernel timestamp
+ * taken in the interrupt handler, so wakeup latency here only shows up as
+ * delivery latency, never as distance error.
+ */
+static void *fake_player(void *arg)
+{
+	struct fake_sensor *s, *next;
+	unsigned long long t, due, now;
+	struct timespec ts;
+	unsigned int i;
+
+	pthread_mutex_lock(&fake.lock);
+	while(1)
+	{
+		next = NULL;
+		due = 0;
+		for(i = 0; i < fake.count; i++)
+		{
+			s = &fake.sensor[i];
+			t = s->rise_ns ? s->rise_ns : s->fall_ns;
+			if(t != 0 && (next == NULL || t < due))
+			{
+				next = s;
+				due = t;
+			}
+		}
+
+		if(next == NULL)
+		{
+			pthread_cond_wait(&fake.cond, &fake.lock);
+			continue;
+		}
+
+		now = fake_now_ns();
+		if(now < due)
+		{
+			ts.tv_sec = due / 1000000000ULL;
+			ts.tv_nsec = due % 1000000000ULL;
+			pthread_cond_timedwait(&fake.cond, &fake.lock, &ts);
+			continue;
+		}
+
+		if(now - due > FAKE_LATE_NS)
+			fake.stats.late_edges++;
+		if(next->rise_ns)
+		{
+			fake_emit(next, next->rise_ns, 1);
+			next->rise_ns = 0;
+		}
+		else
+		{
+			fake_emit(next, next->fall_ns, 0);
+			next->fall_ns = 0;
+			fake.stats.echoes++;
+		}
+	}
+	return NULL;
+}
+
+static void fake_start(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&fake.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_create(&fake.player, NULL, fake_player, NULL);
+}
+
+static struct fake_sensor *fake_find(unsigned int gpio, int echo)
+{
+	unsigned int i;
+
+	for(i = 0; i < fake.count; i++)
+	{
+		if((echo ? fake.sensor[i].echo_gpio : fake.sensor[i].trig_gpio) == gpio)
+			return &fake.sensor[i];
+	}
+	return NULL;
+}
+
+/***********************************************************************
+* hw_fake_add_sensor - Function to wire a simulated HC-SR04.
+* @trig_gpio: GPIO wired to TRIG
+* @echo_gpio: GPIO wired to ECHO
+*
+* Returns 0 on success.
+*
+* Description: Function to wire a simulated HC-SR04 whose target walks
+* 	back and forth until hw_fake_set_target() says otherwise.
+***********************************************************************/
+int hw_fake_add_sensor(unsigned int trig_gpio, unsigned int echo_gpio)
+{
+	struct fake_sensor *s;
+
+	if(trig_gpio >= GPIO_MAX_PINS || echo_gpio >= GPIO_MAX_PINS)
+		return -EINVAL;
+
+	pthread_mutex_lock(&fake.lock);
+	if(fake.count >= FAKE_MAX_SENSORS)
+	{
+		pthread_mutex_unlock(&fake.lock);
+		return -ENOSPC;
+	}
+	s = &fake.sensor[fake.count];
+	memset(s, 0, sizeof(*s));
+	s->trig_gpio = trig_gpio;
+	s->echo_gpio = echo_gpio;
+	s->pipe[0] = s->pipe[1] = -1;
+	s->distance_um = fake_walk_um;
+	s->arg = (void *)(unsigned long)fake.count;
+	fake.count++;
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
+
+/***********************************************************************
+* hw_fake_set_target - Function to script the target of a sensor.
+* @trig_gpio: Trigger GPIO of the sensor
+* @distance_um: Called at each trigger with the current time
+* @arg: Passed to @distance_um
+*
+* Returns nothing.
+*
+* Description: Function to script the target of a sensor. A distance
+* 	beyond ECHO_MAX_RANGE_CM produces no echo at all.
+***********************************************************************/
+void hw_fake_set_target(unsigned int trig_gpio,
+	unsigned long long (*distance_um)(unsigned long long now_ns, void *arg),
+	void *arg)
+{
+	struct fake_sensor *s;
+
+	pthread_mutex_lock(&fake.lock);
+	s = fake_find(trig_gpio, 0);
+	if(s != NULL)
+	{
+		s->distance_um = distance_um;
+		s->arg = arg;
+	}
+	pthread_mutex_unlock(&fake.lock);
+}
+
+/***********************************************************************
+* hw_fake_replay - Function to let a sensor replay a measurement log.
+* @trig_gpio: Trigger GPIO of the sensor
+* @hdr: Header of the log
+* @rec: Records of the log, oldest first, as from measlog_load()
+* @count: Number of records
+* @sensor_id: Records of which recorded sensor to play
+* @fast: Non zero to write each echo right at its trigger
+*
+* Returns number of records the sensor will play, negative on failure.
+*
+* Description: Function to let a sensor replay a measurement log. Every
+* 	trigger plays the next cycle of @sensor_id with its recorded echo
+* 	delay and width; after the last one the sensor stays silent. The
+* 	log must stay in memory while it plays.
+***********************************************************************/
+long hw_fake_replay(unsigned int trig_gpio, const struct measlog_header *hdr,
+	const struct measlog_record *rec, unsigned long count,
+	unsigned int sensor_id, int fast)
+{
+	struct fake_sensor *s;
+	unsigned long i, n = 0;
+
+	for(i = 0; i < count; i++)
+		if(rec[i].sensor_id == sensor_id)
+			n++;
+
+	pthread_mutex_lock(&fake.lock);
+	s = fake_find(trig_gpio, 0);
+	if(s != NULL)
+	{
+		s->hdr = hdr;
+		s->rec = rec;
+		s->count = count;
+		s->pos = 0;
+		s->replay_id = sensor_id;
+		s->fast = fast;
+		fake.stats.replay_left += n;
+	}
+	pthread_mutex_unlock(&fake.lock);
+	return (s != NULL) ? (long)n : -ENODEV;
+}
+
+/***********************************************************************
+* hw_fake_replay_stamp - Function to get the recorded time of a cycle.
+* @trig_gpio: Trigger GPIO of a replaying sensor
+*
+* Returns the recorded echo rise, in ns, of the cycle played last.
+*
+* Description: Function to get the recorded time of the cycle played
+* 	last, so a fast replay can keep the recorded timeline.
+***********************************************************************/
+unsigned long long hw_fake_replay_stamp(unsigned int trig_gpio)
+{
+	struct fake_sensor *s;
+	unsigned long long t = 0;
+
+	pthread_mutex_lock(&fake.lock);
+	s = fake_find(trig_gpio, 0);
+	if(s != NULL)
+		t = s->replay_stamp;
+	pthread_mutex_unlock(&fake.lock);
+	return t;
+}
+
+/***********************************************************************
+* hw_fake_record_spi - Function to record every SPI message to a file.
+* @path: File, one line of hex bytes per message
+*
+* Returns 0 on success.
+*
+* Description: Function to record every SPI message to a file, one line
+* 	per message, transfers separated by a space, so two runs can be
+* 	compared with diff.
+***********************************************************************/
+int hw_fake_record_spi(const char *path)
+{
+	FILE *f = fopen(path, "w");
+
+	if(f == NULL)
+		return -errno;
+	pthread_mutex_lock(&fake.lock);
+	if(fake.spi_rec != NULL)
+		fclose(fake.spi_rec);
+	fake.spi_rec = f;
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
+
+/***********************************************************************
+* hw_fake_get_stats - Function to read the fake backend counters.
+* @st: Filled with the counters
+*
+* Returns nothing.
+*
+* Description: Function to read the fake backend counters.
+***********************************************************************/
+void hw_fake_get_stats(struct hw_fake_stats *st)
+{
+	pthread_mutex_lock(&fake.lock);
+	*st = fake.stats;
+	pthread_mutex_unlock(&fake.lock);
+}
+
+/***********************************************************************
+* hw_fake_spi_regs - Function to get the simulated MAX7219 registers.
+*
+* Returns the 16 registers, indexed by address.
+*
+* Description: Function to get the simulated MAX7219 registers as last
+* 	written over SPI, e.g. to check what the display shows.
+***********************************************************************/
+const unsigned char *hw_fake_spi_regs(void)
+{
+	return fake.regs;
+}
+
+static int fake_gpio_export(unsigned int gpio)
+{
+	return (gpio < GPIO_MAX_PINS) ? 0 : -EINVAL;
+}
+
+static int fake_gpio_set_dir(unsigned int gpio, unsigned int out_flag)
+{
+	if(gpio >= GPIO_MAX_PINS)
+		return -EINVAL;
+	fake.dir[gpio] = out_flag;
+	return 0;
+}
+
+/*
+ * The falling edge of a trigger pulse starts the echo of its sensor,
+ * unless one is still in flight.
+ */
+static int fake_gpio_set_value(unsigned int gpio, unsigned int value)
+{
+	struct fake_sensor *s;
+	unsigned long long now, um;
+
+	if(gpio >= GPIO_MAX_PINS)
+		return -EINVAL;
+
+	pthread_mutex_lock(&fake.lock);
+	s = fake_find(gpio, 0);
+	if(s != NULL && fake.value[gpio] && !value)
+	{
+		fake.stats.triggers++;
+		now = fake_now_ns();
+		if(s->hdr != NULL)
+		{
+			if(s->rise_ns == 0 && s->fall_ns == 0 && s->pipe[1] >= 0)
+				fake_replay_next(s, now);
+			goto out;
+		}
+		um = s->distance_um(now, s->arg);
+		if(s->rise_ns == 0 && s->fall_ns == 0 && s->pipe[1] >= 0 &&
+			um <= ECHO_MAX_RANGE_CM * 10000ULL)
+		{
+			s->rise_ns = now + ECHO_SETUP_NS;
+			s->fall_ns = s->rise_ns + ECHO_UM_TO_NS(um);
+			pthread_cond_signal(&fake.cond);
+		}
+	}
+out:
+	fake.value[gpio] = (value != 0);
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
+
+static int fake_gpio_get_value(unsigned int gpio, unsigned int *value)
+{
+	if(gpio >= GPIO_MAX_PINS)
+		return -EINVAL;
+	*value = fake.value[gpio];
+	return 0;
+}
+
+static int fake_gpio_set_edge(unsigned int gpio, char *edge)
+{
+	return (gpio < GPIO_MAX_PINS) ? 0 : -EINVAL;
+}
+
+static int fake_gpio_edge_open(unsigned int gpio, int *use_cdev)
+{
+	struct fake_sensor *s;
+	int ret = -ENODEV;
+
+	pthread_once(&fake.once, fake_start);
+
+	pthread_mutex_lock(&fake.lock);
+	s = fake_find(gpio, 1);
+	if(s != NULL && s->pipe[0] < 0)
+	{
+		if(pipe2(s->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+			ret = -errno;
+	}
+	if(s != NULL && s->pipe[0] >= 0)
+	{
+		*use_cdev = 1;
+		ret = s->pipe[0];
+	}
+	pthread_mutex_unlock(&fake.lock);
+
+	if(ret < 0)
+		printf("hw-fake: no simulated sensor on echo gpio %u\n", gpio);
+	return ret;
+}
+
+/* Pin by pin, so a trigger pin in the group still starts its echo */
+static int fake_gpio_set_values(const unsigned int *pins, const unsigned int *values,
+	unsigned int n)
+{
+	unsigned int i;
+	int failed = 0;
+
+	for(i = 0; i < n; i++)
+		if(fake_gpio_set_value(pins[i], values[i]) < 0)
+			failed++;
+	return failed ? -failed : 0;
+}
+
+static int fake_gpio_get_values(const unsigned int *pins, unsigned int *values,
+	unsigned int n)
+{
+	unsigned int i;
+	int failed = 0;
+
+	for(i = 0; i < n; i++)
+		if(fake_gpio_get_value(pins[i], &values[i]) < 0)
+			failed++;
+	return failed ? -failed : 0;
+}
+
+static int fake_gpio_apply(const struct gpio_pin_cfg *pins, unsigned int n)
+{
+	unsigned int i;
+	int changed = 0;
+
+	pthread_mutex_lock(&fake.lock);
+	for(i = 0; i < n; i++)
+	{
+		if(pins[i].gpio >= GPIO_MAX_PINS)
+		{
+			changed = -1;
+			break;
+		}
+		if(pins[i].dir != GPIO_DIRECTION_KEEP && fake.dir[pins[i].gpio] != pins[i].dir)
+		{
+			fake.dir[pins[i].gpio] = pins[i].dir;
+			changed++;
+		}
+		else if(pins[i].value != GPIO_VALUE_KEEP &&
+			fake.value[pins[i].gpio] != pins[i].value)
+		{
+			changed++;
+		}
+		if(pins[i].value != GPIO_VALUE_KEEP)
+			fake.value[pins[i].gpio] = pins[i].value;
+	}
+	pthread_mutex_unlock(&fake.lock);
+	return changed;
+}
+
+static int fake_spi_open(const char *device)
+{
+	return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+static int fake_spi_message(int fd, struct spi_ioc_transfer *tr, unsigned int n)
+{
+	const unsigned char *tx;
+	unsigned int i, j;
+
+	pthread_mutex_lock(&fake.lock);
+	fake.stats.spi_messages++;
+	fake.stats.spi_transfers += n;
+	for(i = 0; i < n; i++)
+	{
+		tx = (const unsigned char *)(unsigned long)tr[i].tx_buf;
+		fake.stats.spi_bytes += tr[i].len;
+		if(tr[i].len >= 2)
+			fake.regs[tx[tr[i].len - 2] & 0x0F] = tx[tr[i].len - 1];
+		for(j = 0; j < tr[i].len; j++)
+		{
+			fake.stats.spi_hash = (fake.stats.spi_hash ^ tx[j]) * FAKE_FNV_PRIME;
+			if(fake.spi_rec != NULL)
+				fprintf(fake.spi_rec, "%s%02x", (i && !j) ? " " : "", tx[j]);
+		}
+	}
+	if(fake.spi_rec != NULL)
+		fputc('\n', fake.spi_rec);
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
+
+const struct hw_backend hw_fake = {
+	.name = "fake",
+	.gpio_export = fake_gpio_export,
+	.gpio_set_dir = fake_gpio_set_dir,
+	.gpio_set_value = fake_gpio_set_value,
+	.gpio_get_value = fake_gpio_get_value,
+	.gpio_set_edge = fake_gpio_set_edge,
+	.gpio_edge_open = fake_gpio_edge_open,
+	.gpio_apply = fake_gpio_apply,
+	.gpio_set_values = fake_gpio_set_values,
+	.gpio_get_values = fake_gpio_get_values,
+	.spi_open = fake_spi_open,
+	.spi_message = fake_spi_message,
+};
@@ -1,30 +1,134 @@
 #ifndef __GPIO_FUNC_H__
+#define __GPIO_FUNC_H__
+
+#include <stddef.h>
 
 
  /****************************************************************
  * Constants
  ****************************************************************/
- 
+
 #define SYSFS_GPIO_DIR "/sys/class/gpio"
 #define MAX_BUF 64
+#define GPIO_MAX_PINS 128
+#define GPIO_PATH_MAX (MAX_BUF + 32)
+#define GPIO_EDGE_BATCH 16	/* edge events fetched per read */
+#define GPIO_EXPORT_WAIT_MS 1000	/* for udev to make a new export usable */
+#define GPIO_BATCH_MAX 64	/* attribute reads/writes per batch */
+#define GPIO_BATCH_DATA 8	/* bytes per read or write */
+#define GPIO_URING_FILES 1024	/* registered file table, indexed by fd */
+#define GPIO_GROUPS 8		/* pin groups kept by gpio_set_values() */
+#define GPIO_GROUP_PINS 64	/* pins per group */
+#define GPIO_GROUP_CHIPS 4	/* chips a group may span, a request each */
 
 #define GPIO_DIRECTION_IN 1
 #define GPIO_DIRECTION_OUT 0
+#define GPIO_DIRECTION_KEEP 2	/* pin has no direction attribute */
 #define GPIO_VALUE_LOW 0
 #define GPIO_VALUE_HIGH 1
+#define GPIO_VALUE_KEEP (-1)
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+struct gpio_handle {
+	unsigned int gpio;
+	int value_fd;	/* opened O_RDWR, accessed at offset 0 */
+	int dir_fd;	/* opened lazily by gpio_set_dir */
+	int edge_fd;	/* opened lazily by gpio_set_edge */
+};
+
+/* Wanted state of one pin, see gpio_apply() */
+struct gpio_pin_cfg {
+	unsigned int gpio;
+	unsigned int dir;	/* GPIO_DIRECTION_IN, _OUT or _KEEP */
+	int value;		/* GPIO_VALUE_LOW, _HIGH or _KEEP */
+};
+
+/* One edge reported by the GPIO character device */
+struct gpio_edge {
+	unsigned long long timestamp_ns;	/* kernel CLOCK_MONOTONIC */
+	int rising;
+	unsigned int seqno;			/* per line, for drop detection */
+};
+
+/*
+ * Independent reads and writes of sysfs attributes at offset 0, sent
+ * together by gpio_batch_submit(). A read leaves what it got in @data
+ * and its length in @res; @res is negative on failure.
+ */
+struct gpio_batch {
+	unsigned int count;
+	struct {
+		int fd;
+		int write;
+		unsigned int len;
+		int res;
+		char data[GPIO_BATCH_DATA];
+	} op[GPIO_BATCH_MAX];
+};
 
 /****************************************************************
  * Functions
  ****************************************************************/
 
+int gpio_set_root(const char *root);
+const char *gpio_get_root(void);
 int gpio_export(unsigned int gpio);
 int gpio_unexport(unsigned int gpio);
 int gpio_set_dir(unsigned int gpio, unsigned int out_flag);
 int gpio_set_value(unsigned int gpio, unsigned int value);
 int gpio_get_value(unsigned int gpio, unsigned int *value);
 int gpio_set_edge(unsigned int gpio, char *edge);
+int gpio_edge_open(unsigned int gpio, int *use_cdev);
+int gpio_apply(const struct gpio_pin_cfg *pins, unsigned int n);
+int gpio_set_values(const unsigned int *pins, const unsigned int *values,
+	unsigned int n);
+int gpio_get_values(const unsigned int *pins, unsigned int *values,
+	unsigned int n);
 int gpio_fd_open(unsigned int gpio);
 int gpio_fd_close(int fd);
 
+/* sysfs backend behind the functions above, see hw.h */
+int gpio_sysfs_export(unsigned int gpio);
+int gpio_sysfs_set_dir(unsigned int gpio, unsigned int out_flag);
+int gpio_sysfs_set_value(unsigned int gpio, unsigned int value);
+int gpio_sysfs_get_value(unsigned int gpio, unsigned int *value);
+int gpio_sysfs_set_edge(unsigned int gpio, char *edge);
+int gpio_sysfs_edge_open(unsigned int gpio, int *use_cdev);
+int gpio_sysfs_apply(const struct gpio_pin_cfg *pins, unsigned int n);
+int gpio_sysfs_set_values(const unsigned int *pins, const unsigned int *values,
+	unsigned int n);
+int gpio_sysfs_get_values(const unsigned int *pins, unsigned int *values,
+	unsigned int n);
+
+struct gpio_handle *gpio_handle_open(unsigned int gpio);
+int gpio_handle_close(unsigned int gpio);
+void gpio_handle_close_all(void);
+int gpio_handle_write(struct gpio_handle *h, unsigned int value);
+int gpio_handle_read(struct gpio_handle *h, unsigned int *value);
+int gpio_handle_dir_fd(struct gpio_handle *h);
+unsigned int gpio_handle_generation(void);
+
+int gpio_uring_available(void);
+void gpio_batch_reset(struct gpio_batch *b);
+int gpio_batch_read(struct gpio_batch *b, int fd);
+int gpio_batch_write(struct gpio_batch *b, int fd, const char *str);
+int gpio_batch_submit(struct gpio_batch *b);
+int gpio_uring_apply(const struct gpio_pin_cfg *pins, unsigned int n);
+
+int gpio_cdev_lookup(unsigned int gpio, char *chip, size_t len,
+	unsigned int *offset);
+int gpio_cdev_request_edges(const char *chip, unsigned int offset,
+	const char *consumer);
+int gpio_cdev_read_edges(int fd, struct gpio_edge *edges, int max,
+	int timeout_ms);
+int gpio_cdev_request_lines(const char *chip, const unsigned int *offsets,
+	unsigned int n, unsigned int dir, unsigned long long values, const char *consumer);
+int gpio_cdev_set_output(int fd, unsigned int n, unsigned long long values);
+int gpio_cdev_set_values(int fd, unsigned long long mask, unsigned long long bits);
+int gpio_cdev_get_values(int fd, unsigned long long mask, unsigned long long *bits);
+
 
 #endif /* __GPIO_FUNC_H__ */
@@ -26,6 +26,20 @@
 #include <sched.h> 
 
 #include "led.h"
+#include "hw.h"
+#include "spi.h"
+#include "max7219.h"
+#include "sprites.h"
+#include "scroll.h"
+#include "tsc.h"
+#include "sensor.h"
+#include "sample_ring.h"
+#include "capture.h"
+#include "filter.h"
+#include "stats.h"
+#include "frame_sched.h"
+#include "rt.h"
+#include "measlog.h"
 
 /**
  * Define constants using the macro
@@ -41,8 +55,13 @@
 #define GP_IO3_MUX2 64  //GPIO64 corresponds to MUX controlling IO3
 /*********************************/
 
-#define CPU_CLOCK_SPEED 400000000 //400 MHz
 #define SPI_DEVICE_NAME "/dev/spidev1.0"
+#define SPI_CS_GPIO 15	//GPIO15 is the MAX7219 LOAD/CS line
+
+/* Set to 1 to let spidev drive chip select and send a frame per ioctl */
+#ifndef SPI_NATIVE_CS
+#define SPI_NATIVE_CS 0
+#endif
 
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
@@ -51,440 +70,577 @@ static uint8_t bits = 8;
 static uint32_t speed = 500000;
 static uint16_t delay;
 
-double distance = 0;
-pthread_mutex_t lock;
+/* HC-SR04 sensors on the board, trigger and echo GPIOs */
+static const struct {
+	unsigned int trig;
+	unsigned int echo;
+} board_sensors[] = {
+	{ 11, 14 },
+};
+
+/*
+ * Every pin the application uses, with the state it needs. Outputs
+ * without a stated level come up low. The mux selects have no direction
+ * attribute.
+ */
+static const struct gpio_pin_cfg board_pins[] = {
+	/* IO2/IO3: sensor trigger and echo, level shifters and muxes */
+	{ 11, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ GP_IO2, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ GP_IO3, GPIO_DIRECTION_IN, GPIO_VALUE_KEEP },
+	{ 32, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 34, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 16, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ GP_IO2_MUX, GPIO_DIRECTION_KEEP, GPIO_VALUE_LOW },
+	{ GP_IO3_MUX1, GPIO_DIRECTION_KEEP, GPIO_VALUE_LOW },
+	{ GP_IO3_MUX2, GPIO_DIRECTION_KEEP, GPIO_VALUE_LOW },
+
+	/* SPI1 to the MAX7219 */
+	{ 72, GPIO_DIRECTION_OUT, GPIO_VALUE_LOW },
+	{ 44, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ 46, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+	{ SPI_CS_GPIO, GPIO_DIRECTION_OUT, GPIO_VALUE_HIGH },
+};
+
+/*
+ * SPI1 level shifter and pull-up selects, set as one group with
+ * gpio_set_values() so they switch together instead of one by one.
+ */
+static const unsigned int board_spi_sel[] = { 24, 42, 30, 25, 43, 31 };
+static const unsigned int board_spi_sel_values[] = {
+	GPIO_VALUE_LOW, GPIO_VALUE_LOW, GPIO_VALUE_LOW,
+	GPIO_VALUE_HIGH, GPIO_VALUE_HIGH, GPIO_VALUE_HIGH,
+};
+
+/* Process start, for the time to first frame */
+static unsigned long long start_ns;
+
+/* Sensor whose distance drives the dog animation */
+#define DISPLAY_SENSOR 0
+
+/* Animation frame period with the target near and far */
+#define FRAME_PERIOD_NEAR_NS 60000000ULL
+#define FRAME_PERIOD_FAR_NS 600000000ULL
+
+/* Daisy chained 8x8 modules on the bus, device 0 leftmost */
+#ifndef DISPLAY_DEVICES
+#define DISPLAY_DEVICES 1
+#endif
+
+/* 1 to scroll the distance as text instead of running the dog */
+#ifndef DISPLAY_TEXT
+#define DISPLAY_TEXT 0
+#endif
+#define FRAME_PERIOD_TEXT_NS 16666667ULL	/* 60 fps, a column per frame */
+
+/* Sensor thread -> display thread, lock free */
+struct sample_ring samples;
+
+/*
+ * Sensor thread: a filter per sensor, whose motion model is published
+ * after every sample for the display to predict from.
+ */
+static struct filter sensor_filt[ARRAY_SIZE(board_sensors)];
+static struct motion_shared motion[ARRAY_SIZE(board_sensors)];
+
+/* Every measurement, raw, for offline analysis with mlog2csv */
+static struct measlog mlog;
+
+#ifdef HW_FAKE
+/* Host build: how long to run the pipeline on the fake backend */
+#define HW_FAKE_SECONDS 10
+#define REPLAY_SPI_PATH "/tmp/hcsr04-replay.spi"	/* SPI recorder output */
+
+/* Replay of a measurement log, see replay_open() */
+static struct {
+	struct measlog_header hdr;
+	struct measlog_record *rec;
+	long count;
+	int fast;
+} replay;
+#endif
 
  /**
  * Thread Arguments
  */
-pthread_t thread_ID[2];    /* 1 SPI_transmit thread, 1 sensor_detect */
-pthread_attr_t thread_attr[2];
-int thread_priority[]={50,50};  
-struct sched_param param[2];
-int rerror[2]; /* to check for error in pthread creation */
-
-uint8_t array [] = {
-		0x01, 0x06,
-		0x02, 0x06,	
-		0x03, 0x06,
-		0x04, 0x03,
-		0x05, 0x7F,
-		0x06, 0xA2,
-		0x07, 0x32,
-		0x08, 0x16,
+/* Set to 0 to run every thread with default scheduling */
+#ifndef RT_PROFILE
+#define RT_PROFILE 1
+#endif
+
+/*
+ * Scheduling of the two threads. The Galileo's Quark has a single core,
+ * so both are pinned to it; the sensor thread outranks the display as
+ * an echo edge stamped late is a wrong distance, a frame pushed late is
+ * only a little jitter.
+ */
+static const struct rt_thread_cfg sensor_thread_cfg = {
+	.name = "sensor", .policy = SCHED_FIFO, .priority = 80, .cpu = 0,
+};
+static const struct rt_thread_cfg display_thread_cfg = {
+	.name = "display", .policy = SCHED_FIFO, .priority = 70, .cpu = 0,
+};
+static const struct rt_thread_cfg measlog_thread_cfg = {
+	.name = "measlog", .policy = SCHED_IDLE, .priority = 0, .cpu = -1,
 };
 
-void init_sequence(void);
+void* Func_UltrasonicDetect(void *ptr);
+void* Func_SPITransmit(void *ptr);
 
-/***********************************************************************
- * rdtsc() function is used to calulcate the number of clock ticks
- * and measure the time. TSC(time stamp counter) is incremented 
- * every cpu tick (1/CPU_HZ).
- **********************************************************************/
-static __inline__ unsigned long long my_rdtsc(void)
- {
-     unsigned long lo, hi;
-     __asm__ __volatile__ ( "rdtsc" : "=a" (lo), "=d" (hi) ); 
-     return( (unsigned long long)lo | ((unsigned long long)hi << 32) );
- }
+static struct rt_thread threads[] = {
+	{ .cfg = &measlog_thread_cfg, .fn = measlog_flusher, .arg = &mlog },
+	{ .cfg = &sensor_thread_cfg, .fn = Func_UltrasonicDetect },
+	{ .cfg = &display_thread_cfg, .fn = Func_SPITransmit },
+};
 
+void init_sequence(void);
 
 /***********************************************************************
-* transfer - Function to create a transfer structure and pass it to 
-* 		IOCTL to display on LED.
-* @address: Address
-* @data: data
+* sample_done - Capture callback publishing each measurement.
+* @eng: Capture engine
+* @s: Sensor that finished
+* @pulse: Echo pulse, valid or timed out
 *
-* Returns 0 on success.
+* Returns nothing.
 * 
-* Description: Function to create a transfer structure and pass it to 
-* 		IOCTL to display on LED. Various parameters for the transfer are
-* 		set like, bits per word, speed etc.
+* Description: Capture callback publishing each measurement to the 
+* 	display thread through the sample ring, running it through the
+* 	sensor's filter to publish the new motion model, and appending
+* 	it to the measurement log.
 ***********************************************************************/
-void transfer(int fd, uint8_t address, uint8_t data)
+static void sample_done(struct capture_engine *eng, struct capture_sensor *s,
+	const struct echo_pulse *pulse)
 {
-	int retValue;
+	struct sample sample;
+	struct motion m;
+	unsigned int flags = 0;
+
+	sample.timestamp_ns = 0;
+#ifdef HW_FAKE
+	/* the filter runs on the recorded timeline, not on the replay's */
+	if(replay.fast)
+		sample.timestamp_ns = hw_fake_replay_stamp(board_sensors[s->id].trig);
+#endif
+	sample.sensor_id = s->id;
+	sample.rise = pulse->rise;
+	sample.fall = pulse->fall;
+	sample.distance_um = pulse->distance_um;
+	sample.valid = pulse->valid;
+	sample_ring_publish(&samples, &sample);
+
+	if(filter_update(&sensor_filt[s->id], &sample))
+	{
+		filter_motion(&sensor_filt[s->id], &m);
+		motion_publish(&motion[s->id], &m);
+	}
 
-	//printf("transfer start fd %d\n",fd);
+	if(pulse->valid)
+		flags |= MEASLOG_VALID;
+	if(!s->echo.use_cdev)
+		flags |= MEASLOG_TSC;
+	measlog_append(&mlog, s->id, s->trigger_stamp, pulse->rise, pulse->fall,
+		pulse->distance_um, flags);
+}
 
-	uint8_t tx[2];
-	
-	uint8_t rx[ARRAY_SIZE(tx)] = {0,};
-	//printf("1\n");
+/***********************************************************************
+* sensor_open - Function to set up the capture of every board sensor.
+* @engine: Capture engine
+*
+* Returns 0 on success.
+*
+* Description: Function to set up one capture engine for every sensor
+* 	of board_sensors[], reporting through sample_done(), and the
+* 	filter of every sensor.
+***********************************************************************/
+static int sensor_open(struct capture_engine *engine)
+{
+	struct filter_config filter_cfg;
+	int i;
 
-	tx[0] = address;
-	tx[1] = data;
-	
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)tx,
-		.rx_buf = (unsigned long)rx,
-		.len = 2,
-		.delay_usecs = 1,
-		.speed_hz = 10000000, //10000000
-		.cs_change = 1,
-		.bits_per_word = 8,
-	};
-	
-	
-	retValue = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
+	if(capture_init(engine, sample_done, NULL) < 0)
+		return -1;
 
-	//printf("Return val of ioctl %d \n",retValue);
-	//printf("Inside transfer\n");
-	if (retValue < 1)
-		printf("can't send spi message\n");
+	filter_default_config(&filter_cfg);
+	for(i=0; i < ARRAY_SIZE(board_sensors); i++)
+	{
+		filter_init(&sensor_filt[i], &filter_cfg);
+		if(capture_add(engine, board_sensors[i].trig, board_sensors[i].echo) < 0)
+			printf("Can not open ultrasonic sensor %d.\n", i);
+	}
+	return 0;
 }
 
-
+/***********************************************************************
+* Func_UltrasonicDetect - Thread Function to measure the distance.
+* @ptr: Thread Parameters
+*
+* Returns NULL
+* 
+* Description: Thread Function to measure the distance. Every sensor of
+* 	board_sensors[] is driven by one capture engine on this thread;
+* 	finished measurements are published by sample_done().
+***********************************************************************/
 void* Func_UltrasonicDetect(void *ptr)
 {
-	struct pollfd Echo_Pin;
-	int retPoll, retValue;
-	unsigned long long Rise_time;
-	unsigned long long Fall_time;
-	char *buf[MAX_BUF];
-	long double dummy1, dummy2;
-	int fd, fd_val, res, fd_edge, fd13, fd11;
-	unsigned char Readvalue[2];
+	static struct capture_engine engine;
 
-	
-	fd_val = open("/sys/class/gpio/gpio14/value",O_RDONLY); //echo
-	//fd13 = open("/sys/class/gpio/gpio13/value", O_WRONLY); //trig
-	fd11 = open("/sys/class/gpio/gpio11/value", O_WRONLY);
-	//printf(" fd13 %d\n",fd13 );
-	fd_edge = open("/sys/class/gpio/gpio14/edge", O_WRONLY);
-	Echo_Pin.fd = fd_val;
-	Echo_Pin.events = POLLPRI;
-	Echo_Pin.revents = 0;
+	if(sensor_open(&engine) < 0)
+		pthread_exit(0);
 
+	while(capture_run_once(&engine) >= 0)
+		;
 
-	while(1)
-	{
-		lseek(Echo_Pin.fd, 0, SEEK_SET);
-		Echo_Pin.revents = 0;
-		
-		write(fd_edge,"rising",6);
-		
-		write(fd11,"1",1);
-		//printf(" res for fd13 %d\n", res);
-		usleep(20);
-		write(fd11,"0",1);
-		//usleep(2);
-		
+	capture_close(&engine);
+	pthread_exit(0);
+}
 
-		retPoll = poll(&Echo_Pin, 1, 3000);
-		
-		if(retPoll < 0)
-		{
-			printf("Poll Error Ocurred\n");	
-		}
+/* Display state, carried from frame to frame by display_frame() */
+static struct {
+	struct filter filt;	/* decisions only, taken on predictions */
+	struct spi_frame frame;
+	struct max7219_chain wall;
+	struct frame_sched sched;
+	const struct animation *anim;
+	int j;
+	struct scroll scroll;
+	long shown;		/* reading on the marquee, in mm */
+	unsigned long long new_sample_ns;
+	struct motion_prediction pred;	/* for when the staged frame shows */
+} disp;
+
+#if DISPLAY_TEXT
+/* Stages the next marquee frame, re-rendering the text only on a change */
+static void display_stage_text(void)
+{
+	uint64_t cols[MAX7219_CHAIN_MAX];
+	char text[SCROLL_TEXT_MAX + 1];
+	long mm = disp.filt.started ? (long)(disp.filt.distance_cm * 10 + 0.5) : -1;
+
+	if(mm != disp.shown)
+	{
+		if(mm < 0)
+			snprintf(text, sizeof(text), "---");
 		else
-		{
-			if(Echo_Pin.revents & POLLPRI)
-			{
-				Rise_time = my_rdtsc();
-				//timeRising = timeRising/400;
-				//printf("Rising edge %llu \n",timeRising);
-				
-				read(Echo_Pin.fd,Readvalue,1);
-				Echo_Pin.revents = 0;
-
-				//FLush buffer
-				lseek(Echo_Pin.fd, 0, SEEK_SET);
-				//Echo_Pin.revents = 0;
-				write(fd_edge,"falling",7);
-				
-				retPoll = poll(&Echo_Pin, 1, 3000);
-				
-				if(retPoll < 0)
-				{
-					printf("poll Error Ocurred\n");	
-				}
-				else if(retPoll > 0)
-				{
-					if(Echo_Pin.revents & POLLPRI)
-					{
-						Fall_time = my_rdtsc();
-						//timeFalling = (long double)timeFalling/400;
-						//printf("Falling edge %llu \n",timeFalling);
-						
-						read(Echo_Pin.fd,Readvalue,1);
-						//Echo_Pin.revents = 0;
-					}
-				}
-			}
-		}
-			
-		usleep(600000);
-
-		pthread_mutex_lock(&lock);
-		distance = (double)(((Fall_time - Rise_time) / 400) * 0.017);
-		pthread_mutex_unlock(&lock);
-		printf("Distance is %0.2f \n",distance);
+			snprintf(text, sizeof(text), "%ld.%ldcm ", mm / 10, mm % 10);
+		scroll_set_text(&disp.scroll, text);
+		disp.shown = mm;
 	}
-		close(fd_edge);
-		close(fd_val);
-		close(fd11);
-		pthread_exit(0);
+	scroll_window(&disp.scroll, cols, disp.wall.n);
+	scroll_step(&disp.scroll, 1);
+	max7219_chain_load(&disp.wall, cols);
+	max7219_chain_stage(&disp.wall);
 }
-
+#endif
 
 /***********************************************************************
-* thread_transmit_spi - Thread Function to send data to the LED display.
-* @fd: file descriptor
+* display_open - Function to bring up the LED display.
 *
 * Returns 0 on success.
 * 
-* Description: Thread Function to send data to the LED display. We 
-* 	continuosly monitor the distance obatined from the sensor, using 
-* 	this distance, we can find if the person/obstance is approaching or 
-* 	going away from sensor. Based on this the dog id made to run slow 
-* 	and fast and turn its direction.
+* Description: Function to configure the board pins, open the SPI
+* 	device, start the MAX7219 chain and stage the first frame.
 ***********************************************************************/
-void* Func_SPITransmit(void *ptr)
+static int display_open(void)
 {
-	int i,fd,j,delay;
-	int retValue;
-	double distance_previous = 0, distance_current = 0, distance_diff = 0, distance_threshhold=0;
-	char new_direction = 'L', old_direction = 'L';
-	
+	struct filter_config filter_cfg;
+	int fd;
+
 	init_sequence();
 
-	fd = open(SPI_DEVICE_NAME, O_RDWR);
+	fd = spi_open(SPI_DEVICE_NAME);
 
 	if(fd < 0)
 	{
 		printf("Can not open device file fd_spi.\n");
-		return 0;
+		return -1;
 	}
 	else
 	{
 		printf("fd_spi device opened succcessfully.\n");
 	}
+
+	if(spi_frame_init(&disp.frame, fd, SPI_NATIVE_CS ? SPI_CS_NATIVE : SPI_CS_GPIO) < 0)
+	{
+		printf("Can not set up spi frame.\n");
+		return -1;
+	}
 	
-	/*********************/
-	
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, 0x0F, 0x01);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
-	usleep(100000);
-
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, 0x0F, 0x00);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
-	usleep(100000);
-
-	// Enable mode B
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, 0x09, 0x00);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
-	usleep(100000);
-	// Define Intensity
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, 0x0A, 0x00);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
-	usleep(100000);
-	// Only scan 7 digit
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, 0x0B, 0x07);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
-	usleep(100000);
-	// Turn on chip
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, 0x0C, 0x01);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
-	usleep(100000);
-
-	for(i=1; i < 9; i++)
+	max7219_chain_init(&disp.wall, &disp.frame, DISPLAY_DEVICES, MAX7219_FULL_REFRESH);
+	if(max7219_chain_start(&disp.wall) < 0)
+		printf("Can not set up the display.\n");
+
+	filter_default_config(&filter_cfg);
+	filter_init(&disp.filt, &filter_cfg);
+
+#if DISPLAY_TEXT
+	scroll_init(&disp.scroll, max7219_chain_width(&disp.wall));
+	disp.shown = -2;
+	display_stage_text();
+	frame_sched_init(&disp.sched, FRAME_PERIOD_TEXT_NS);
+#else
+	disp.anim = &dog_left;
+	disp.j = 0;
+	max7219_chain_blit(&disp.wall, 0, &disp.anim->frames[0]);
+	max7219_chain_stage(&disp.wall);
+	frame_sched_init(&disp.sched, FRAME_PERIOD_FAR_NS);
+#endif
+	return 0;
+}
+
+/*
+ * When the frame being staged will show: the next deadline, with the
+ * period just set. A fast replay stamps samples on the recorded
+ * timeline and has no frame timeline to predict to.
+ */
+static unsigned long long display_show_ns(const struct motion *m)
+{
+#ifdef HW_FAKE
+	if(replay.fast)
+		return m->timestamp_ns;
+#endif
+	return frame_sched_next_ns(&disp.sched);
+}
+
+/***********************************************************************
+* display_frame - Function to show the staged frame and stage the next.
+*
+* Returns nothing.
+* 
+* Description: Function to push the staged frame, then stage the next
+* 	one from the display sensor's motion model, carried forward to
+* 	the deadline the staged frame goes out at: the dog runs fast when
+* 	the target will be near and turns with its direction of motion.
+* 	A sample can be most of a frame period old by then. With
+* 	DISPLAY_TEXT the distance scrolls by at a fixed 60 fps instead.
+***********************************************************************/
+static void display_frame(void)
+{
+	unsigned long long frame_start, show_ns = 0;
+	struct sample latest;
+	struct motion m;
+	int have_motion;
+
+	frame_start = stats_stamp();
+	max7219_chain_present(&disp.wall);
+	stats_record_ticks(STAT_FRAME_PUSH, frame_start, stats_stamp());
+	if(stats->counter[STAT_FRAMES] == 0)
+		printf("first frame %.1f ms after start\n",
+			(capture_now_ns() - start_ns) / 1e6);
+	stats_count(STAT_FRAMES);
+	if(disp.new_sample_ns != 0)
 	{
-	gpio_set_value(15,GPIO_VALUE_LOW);
-	transfer(fd, i, 0x00);
-	gpio_set_value(15,GPIO_VALUE_HIGH);
+		stats_record_ns(STAT_SAMPLE_DISPLAY, capture_now_ns() - disp.new_sample_ns);
+		disp.new_sample_ns = 0;
 	}
 
+	/* the newest sample of the display sensor, for its latency */
+	while(sample_ring_pop(&samples, &latest))
+	{
+		if(latest.sensor_id == DISPLAY_SENSOR)
+			disp.new_sample_ns = latest.timestamp_ns;
+	}
+
+	/* decide on the distance predicted for when the staged frame shows */
+	have_motion = motion_read(&motion[DISPLAY_SENSOR], &m);
+	if(have_motion)
+	{
+		show_ns = display_show_ns(&m);
+		motion_predict(&m, show_ns, disp.filt.cfg.predict_max_s, &disp.pred);
+		filter_decide(&disp.filt, &disp.pred);
+	}
+#ifdef HW_FAKE
+	if(replay.fast)
+		disp.new_sample_ns = 0;
+#endif
+	//printf("Distance = %0.2f\n",disp.filt.distance_cm);
+
+	/* stage the next frame while the deadline approaches */
+#if DISPLAY_TEXT
+	display_stage_text();
+#else
+	frame_sched_set_period(&disp.sched,
+		disp.filt.near ? FRAME_PERIOD_NEAR_NS : FRAME_PERIOD_FAR_NS);
+
+	/* a new period moves the deadline the staged frame shows at */
+	if(have_motion && display_show_ns(&m) != show_ns)
+		motion_predict(&m, display_show_ns(&m), disp.filt.cfg.predict_max_s,
+			&disp.pred);
+
+	disp.anim = (disp.filt.direction == 'R') ? &dog_right : &dog_left;
+	disp.j = (disp.j + 1) % disp.anim->count;
+	max7219_chain_blit(&disp.wall, 0, &disp.anim->frames[disp.j]);
+	max7219_chain_stage(&disp.wall);
+#endif
+	if(have_motion)
+		stats_record_ns(STAT_PREDICT_AHEAD, disp.pred.ahead_ns);
+}
+
+/***********************************************************************
+* thread_transmit_spi - Thread Function to send data to the LED display.
+* @fd: file descriptor
+*
+* Returns 0 on success.
+* 
+* Description: Thread Function to send data to the LED display. We 
+* 	continuosly monitor the distance obatined from the sensor, using 
+* 	this distance, we can find if the person/obstance is approaching or 
+* 	going away from sensor. Based on this the dog id made to run slow 
+* 	and fast and turn its direction. Frames go out on the absolute
+* 	deadlines of a frame_sched; the next frame is staged right after
+* 	the current one is pushed, so only the SPI submit happens at the
+* 	deadline, and a speed change applies from the next frame on. The
+* 	distance used is the one predicted for the moment each frame
+* 	shows, not the last reading.
+***********************************************************************/
+void* Func_SPITransmit(void *ptr)
+{
+	if(display_open() < 0)
+		return 0;
+
 	while(1)
 	{	
-		pthread_mutex_lock(&lock);
-		distance_current = distance;
-		pthread_mutex_unlock(&lock);
-		distance_diff = distance_current - distance_previous;
-		distance_threshhold = distance_current / 10.0;
-		//printf("Distance = %0.2f\n",distance_current);
-		if(distance>35)
-		{
-			delay=600000;
-		}
-		else
-		{
-			delay=60000;
-		}
-		if((distance_diff > -distance_threshhold) && (distance_diff < distance_threshhold))
-		{
-			new_direction = old_direction;
-		}
-		else if(distance_diff > distance_threshhold)
-		{
-			new_direction = 'R';
-		}
-		else if(distance_diff < -distance_threshhold)
-		{
-			new_direction = 'L';
-		}
-		
-		if(new_direction == 'R')
-		{
-			//printf("Moving Away... Move Right\n");
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x01, 0x08);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x02, 0x90);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x03, 0xf0);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x04, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x05, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x06, 0x37);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x07, 0xdf);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x08, 0x98);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-			
-			usleep(delay);
-			
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x01, 0x20);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x02, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x03, 0x70);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x04, 0xd0);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x05, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x06, 0x97);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x07, 0xff);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x08, 0x18);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-			
-			usleep(delay);
-			
-		}
-		else if(new_direction == 'L')
-		{
-			//printf("Moving Closer... Move Left\n");
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x01, 0x98);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x02, 0xdf);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x03, 0x37);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x04, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x05, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x06, 0xf0);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x07, 0x90);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x08, 0x08);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-			
-			
-			usleep(delay);
-			
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x01, 0x18);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x02, 0xff);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x03, 0x97);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x04, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x05, 0xd0);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x06, 0x70);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x07, 0x10);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-
-			gpio_set_value(15,GPIO_VALUE_LOW);
-			transfer(fd, 0x08, 0x20);
-			gpio_set_value(15,GPIO_VALUE_HIGH);
-			
-			
-			usleep(delay);
-		 
-		}
-		
-		distance_previous = distance_current;
-		old_direction = new_direction;
-}
+		frame_sched_wait(&disp.sched);
+		display_frame();
+	}
 		
 	
 pthread_exit(0);
 }
 
+#ifdef HW_FAKE
+/***********************************************************************
+* host_report - Function to report a run on the fake backend.
+* @start: When the run started, CLOCK_MONOTONIC ns
+*
+* Returns nothing, exits the process.
+* 
+* Description: Function to print the throughput and the latency of
+* 	each stage of a run on the fake backend, and exit.
+***********************************************************************/
+static void host_report(unsigned long long start)
+{
+	struct hw_fake_stats st;
+	unsigned long long published;
+	double secs;
+
+	secs = (capture_now_ns() - start) / 1e9;
+	hw_fake_get_stats(&st);
+	published = __atomic_load_n(&samples.head, __ATOMIC_ACQUIRE);
+
+	printf("host: %.1f s on the fake backend\n", secs);
+	printf("  sensor : %llu triggers, %llu echoes, %.1f samples/s, %llu late edges\n",
+		st.triggers, st.echoes, published / secs, st.late_edges);
+	printf("  log    : %llu records in %s\n", mlog.next - 1,
+		replay.rec ? MEASLOG_REPLAY_PATH : MEASLOG_PATH);
+	printf("  display: %.1f spi messages/s, %.1f transfers/s, %.0f bytes/s\n",
+		st.spi_messages / secs, st.spi_transfers / secs, st.spi_bytes / secs);
+	if(replay.rec)
+		printf("  replay : %ld records, spi hash %016llx, spi messages in %s\n",
+			replay.count, st.spi_hash, REPLAY_SPI_PATH);
+	stats_print(stdout, stats);
+	exit(0);
+}
+
+/***********************************************************************
+* replay_open - Function to load a measurement log for replay.
+* @path: Log written by an earlier run
+* @fast: Non zero to replay as fast as possible
+*
+* Returns 0 on success.
+* 
+* Description: Function to let sensor i of board_sensors[] replay the
+* 	recorded cycles of sensor i from @path, and to record the SPI
+* 	output to REPLAY_SPI_PATH.
+***********************************************************************/
+static int replay_open(const char *path, int fast)
+{
+	long n;
+	int i;
+
+	replay.count = measlog_load(path, &replay.hdr, &replay.rec, NULL);
+	if(replay.count < 0)
+	{
+		printf("Can not load %s for replay\n", path);
+		return -1;
+	}
+	replay.fast = fast;
+
+	for(i=0; i < ARRAY_SIZE(board_sensors); i++)
+	{
+		n = hw_fake_replay(board_sensors[i].trig, &replay.hdr, replay.rec,
+			replay.count, i, fast);
+		printf("replay: sensor %d plays %ld cycles%s\n", i, n,
+			fast ? ", as fast as possible" : "");
+	}
+	if(hw_fake_record_spi(REPLAY_SPI_PATH) < 0)
+		printf("Can not record SPI to %s\n", REPLAY_SPI_PATH);
+	return 0;
+}
+
+/***********************************************************************
+* replay_run_fast - Function to replay a log as fast as possible.
+*
+* Returns nothing.
+* 
+* Description: Function to replay a log as fast as possible on the
+* 	calling thread, through the same capture and display code as the
+* 	threads: sensors fire without pacing, and after each capture pass
+* 	a display frame takes its samples. The lock step makes every run
+* 	of the same log send the same SPI stream.
+***********************************************************************/
+static void replay_run_fast(void)
+{
+	static struct capture_engine engine;
+	struct hw_fake_stats st;
+	unsigned int i, busy;
+
+	if(sensor_open(&engine) < 0 || display_open() < 0)
+		return;
+	for(i=0; i < engine.count; i++)
+		capture_set_pacing(&engine, i, 0, 0);
+
+	do
+	{
+		if(capture_run_once(&engine) < 0)
+			break;
+		display_frame();
+		hw_fake_get_stats(&st);
+		for(i=0, busy=0; i < engine.count; i++)
+			busy |= (engine.sensor[i].state != CAPTURE_IDLE);
+	} while(st.replay_left > 0 || busy);
+
+	/* push the frame of the last sample */
+	display_frame();
+	capture_close(&engine);
+}
+
+/***********************************************************************
+* host_wait - Function to let the threads run on the fake backend.
+*
+* Returns nothing.
+* 
+* Description: Function to let the threads run for HW_FAKE_SECONDS, or
+* 	during a replay until every recorded cycle was played.
+***********************************************************************/
+static void host_wait(void)
+{
+	struct hw_fake_stats st;
+
+	if(replay.rec == NULL)
+	{
+		sleep(HW_FAKE_SECONDS);
+		return;
+	}
+	do
+	{
+		usleep(100000);
+		hw_fake_get_stats(&st);
+	} while(st.replay_left > 0);
+	/* the last echo and the frame showing it */
+	usleep(FRAME_PERIOD_FAR_NS / 1000);
+}
+#endif
+
 /***********************************************************************
 * main - Main Thread Function which creates two threads, one to read the
 * 		sensor and other to display data onto LED
@@ -493,122 +649,98 @@ pthread_exit(0);
 * Returns NULL
 * 
 * Description:  Main Thread Function which creates two threads, one to 
-* 	read the sensor and other to display data onto LED
+* 	read the sensor and other to display data onto LED. The host build
+* 	takes an optional measurement log to replay, and "fast" to replay
+* 	it as fast as possible: output_host [log [fast]].
 ***********************************************************************/
-int main(void)
+int main(int argc, char **argv)
 {
-	int i;
+	const char *log_path = MEASLOG_PATH;
+#ifdef HW_FAKE
+	unsigned long long run_start;
+#endif
+	int i, ret;
+
+	start_ns = capture_now_ns();
+	sample_ring_init(&samples);
+
+#ifdef HW_FAKE
+	hw_set_backend(&hw_fake);
+	for(i=0; i < ARRAY_SIZE(board_sensors); i++)
+		hw_fake_add_sensor(board_sensors[i].trig, board_sensors[i].echo);
+	if(argc > 1)
+	{
+		if(replay_open(argv[1], argc > 2 && strcmp(argv[2], "fast") == 0) < 0)
+			return 1;
+		log_path = MEASLOG_REPLAY_PATH;
+	}
+#endif
 
-	pthread_mutex_init(&lock, NULL);
+	if(tsc_calibrate() < 0)
+		printf("TSC calibration failed, assuming %d Hz\n", CPU_CLOCK_SPEED);
+	tsc_self_test();
 
-	for(i=0; i<2; i++)
+	/* before any thread exists, they all inherit the blocked SIGUSR1 */
+	stats_init();
+
+	if(RT_PROFILE && rt_lock_memory() < 0)
+		printf("Memory not locked, page faults may stall the threads\n");
+	if(measlog_open(&mlog, log_path, MEASLOG_RECORDS) < 0)
+		printf("No measurement log, samples are not recorded\n");
+
+#ifdef HW_FAKE
+	if(replay.fast)
 	{
-	pthread_attr_init(&thread_attr[i]);
-	pthread_attr_getschedparam(&thread_attr[i], &param[i]);
-	param[i].sched_priority = thread_priority[i];  /* set thread priority */
-	pthread_attr_setschedparam(&thread_attr[i], &param[i]);
-	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param[i]);
+		run_start = capture_now_ns();
+		replay_run_fast();
+		host_report(run_start);
 	}
-	
-	rerror[1] = pthread_create(&thread_ID[1], &thread_attr[1], &Func_UltrasonicDetect, NULL);
-	rerror[0] = pthread_create(&thread_ID[0], &thread_attr[0], &Func_SPITransmit, NULL);		
-	if(rerror[0] != 0)
-		{
-		printf("Error while creating thread \n");
-		}
+#endif
+
+	for(i=0; i < ARRAY_SIZE(threads); i++)
+	{
+		ret = rt_thread_start(&threads[i], RT_PROFILE);
+		if(ret <= -2)
+			printf("Thread %s could not be started\n", threads[i].cfg->name);
+		else if(RT_PROFILE && ret < 0)
+			printf("Thread %s runs without its real time profile\n",
+				threads[i].cfg->name);
+	}
+
+#ifdef HW_FAKE
+	run_start = capture_now_ns();
+	host_wait();
+	host_report(run_start);
+#endif
 
 
-	for(i=0; i<2; i++)
+	for(i=0; i < ARRAY_SIZE(threads); i++)
 	{
-	pthread_join(thread_ID[i],NULL); /* wait for all threads to terminate */
+		if(threads[i].status > -2)
+			pthread_join(threads[i].id, NULL); /* wait for all threads to terminate */
 	}
 	
 	return 0;
 }
 
+/***********************************************************************
+* init_sequence - Function to configure the board pins.
+*
+* Returns nothing.
+* 
+* Description: Function to bring every pin of board_pins[] to its wanted
+* 	state in one pass. Pins already configured by an earlier run are
+* 	left alone. The SPI1 selects are then driven as one group.
+***********************************************************************/
 void init_sequence(void)
 {
-	int fd, fd34, fd14, fd77, fd76, fd64, fd11;
-
-	/* Export all GPIO Pins */
-	gpio_export(11);
-	gpio_export(13);
-	gpio_export(14);
-	gpio_export(34);
-	gpio_export(16);
-	gpio_export(77);
-	gpio_export(76);
-	gpio_export(64);
-	gpio_export(32);
-	//gpio_export(17);
-	
-	/* Set Directions for all GPIO Pins */ 
-	fd14 = open("/sys/class/gpio/gpio14/direction", O_WRONLY);
-	write(fd14,"in",2);
-	gpio_set_dir(13,0);
-	gpio_set_dir(11,0);
-	gpio_set_dir(32,0);
-	//gpio_set_dir(14,1);
-	gpio_set_dir(34,0);
-	gpio_set_dir(16,0);
-	// gpio_set_dir(77,0);
-	// gpio_set_dir(76,0);
-	// gpio_set_dir(64,0);
-
-	// fd34 = open("/sys/class/gpio/gpio34/direction", O_WRONLY);
-	// write(fd34,"out",3);
-	
-	/* Set values for all GPIO Pins */
-	// 0 - output
-	// fd11 = open("/sys/class/gpio/gpio11/value", O_WRONLY);
-	// write(fd11,"1",1);
-	gpio_set_value(32,0);
-	gpio_set_value(13,0);
-	//gpio_set_value(14,0);
-	gpio_set_value(16,1);
-	gpio_set_value(34,0);
-	gpio_set_value(77,0);
-	gpio_set_value(76,0);
-	gpio_set_value(64,0);
-	//gpio_set_value(17,1);
-
-	/******************************/
-	gpio_export(72);
-	gpio_export(44);
-	gpio_export(46);
-	gpio_export(15);
-
-	gpio_export(24);
-	gpio_export(42);
-	gpio_export(30);
-
-	gpio_export(25);
-	gpio_export(43);
-	gpio_export(31);
-
-	gpio_set_dir(72, GPIO_DIRECTION_OUT);
-	gpio_set_dir(44, GPIO_DIRECTION_OUT);
-	gpio_set_dir(46, GPIO_DIRECTION_OUT);
-	gpio_set_dir(15, GPIO_DIRECTION_OUT);
-
-	gpio_set_dir(24, GPIO_DIRECTION_OUT);
-	gpio_set_dir(42, GPIO_DIRECTION_OUT);
-	gpio_set_dir(30, GPIO_DIRECTION_OUT);
-
-	gpio_set_dir(25,GPIO_DIRECTION_OUT);
-	gpio_set_dir(43,GPIO_DIRECTION_OUT);
-	gpio_set_dir(31,GPIO_DIRECTION_OUT);
-
-	gpio_set_value(25,1);
-	gpio_set_value(43,1);
-	gpio_set_value(31,1);
-
-	gpio_set_value(24,GPIO_VALUE_LOW);
-	gpio_set_value(42,GPIO_VALUE_LOW);
-	gpio_set_value(30,GPIO_VALUE_LOW);
-
-	gpio_set_value(72,GPIO_VALUE_LOW);
-	gpio_set_value(44,GPIO_VALUE_HIGH);
-	gpio_set_value(46,GPIO_VALUE_HIGH);
-	/******************************/
+	int changed = gpio_apply(board_pins, ARRAY_SIZE(board_pins));
+
+	if(changed < 0)
+		printf("%d board pins could not be configured\n", -changed);
+	else
+		printf("%d of %d board pins changed\n", changed, (int)ARRAY_SIZE(board_pins));
+
+	if(gpio_set_values(board_spi_sel, board_spi_sel_values, ARRAY_SIZE(board_spi_sel)) < 0)
+		printf("SPI1 selects could not be set\n");
 }
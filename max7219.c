@@ -0,0 +1,298 @@
+#include <string.h>
+#include "max7219.h"
+
+
+/*
+ * Start up registers. The digits are cleared while the chip is still in
+ * shutdown (the power-on state) and shutdown is left last, so nothing
+ * random is ever shown.
+ */
+static const uint8_t max7219_setup[][2] = {
+	{ MAX7219_REG_DISPLAY_TEST, 0x00 },
+	{ MAX7219_REG_DECODE, 0x00 },		/* raw segments, no BCD */
+	{ MAX7219_REG_INTENSITY, 0x00 },
+	{ MAX7219_REG_SCAN_LIMIT, 0x07 },	/* scan all 8 digits */
+};
+
+/***********************************************************************
+* max7219_chain_init - Function to set up a daisy chained wall.
+* @chain: Wall
+* @frame: SPI frame bound to the spidev device
+* @n: Number of devices, 1 to MAX7219_CHAIN_MAX
+* @refresh_interval: Flushes between forced full refreshes, 0 for never
+*
+* Returns nothing.
+*
+* Description: Function to set up a daisy chained wall. The register
+* 	bytes of the row messages never change and are written here,
+* 	only the data bytes are filled in per frame.
+***********************************************************************/
+void max7219_chain_init(struct max7219_chain *chain, struct spi_frame *frame,
+	unsigned int n, unsigned int refresh_interval)
+{
+	unsigned int i, k;
+
+	if(n < 1)
+		n = 1;
+	if(n > MAX7219_CHAIN_MAX)
+		n = MAX7219_CHAIN_MAX;
+
+	memset(chain, 0, sizeof(*chain));
+	chain->frame = frame;
+	chain->n = n;
+	chain->refresh_interval = refresh_interval;
+	for(i = 0; i < MAX7219_DIGITS; i++)
+		for(k = 0; k < n; k++)
+			chain->wire[i][2 * k] = i + 1;
+}
+
+/* Fills @buf with the same register write for every device */
+static void max7219_chain_broadcast(struct max7219_chain *chain, uint8_t *buf,
+	uint8_t address, uint8_t data)
+{
+	unsigned int k;
+
+	for(k = 0; k < chain->n; k++)
+	{
+		buf[2 * k] = address;
+		buf[2 * k + 1] = data;
+	}
+}
+
+/* Encodes row @i of @fb into its row message, device 0 last */
+static void max7219_chain_encode(struct max7219_chain *chain, unsigned int i)
+{
+	uint8_t *w = &chain->wire[i][2 * chain->n - 1];
+	unsigned int k;
+
+	for(k = 0; k < chain->n; k++, w -= 2)
+		*w = chain->fb[i][k];
+}
+
+/***********************************************************************
+* max7219_chain_start - Function to bring the whole wall up blank.
+* @chain: Wall
+*
+* Returns 0 on success.
+*
+* Description: Function to bring the whole wall up blank: the setup
+* 	registers, the eight cleared rows and the shutdown exit as one
+* 	frame. The datasheet asks for no delay between register writes,
+* 	only for a latch per write. Each setup register and each cleared
+* 	row is one message carrying it for all devices, so the wall
+* 	starts with 13 latches however long the chain is; the shadow is
+* 	valid afterwards.
+***********************************************************************/
+int max7219_chain_start(struct max7219_chain *chain)
+{
+	unsigned int i, len = chain->n * 2;
+
+	spi_frame_reset(chain->frame);
+	for(i = 0; i < sizeof(max7219_setup) / sizeof(max7219_setup[0]); i++)
+	{
+		max7219_chain_broadcast(chain, chain->cmd[i], max7219_setup[i][0],
+			max7219_setup[i][1]);
+		spi_frame_add_buf(chain->frame, chain->cmd[i], len);
+	}
+	memset(chain->fb, 0, sizeof(chain->fb));
+	for(i = 0; i < MAX7219_DIGITS; i++)
+	{
+		max7219_chain_encode(chain, i);
+		spi_frame_add_buf(chain->frame, chain->wire[i], len);
+	}
+	max7219_chain_broadcast(chain, chain->cmd[4], MAX7219_REG_SHUTDOWN, 0x01);
+	spi_frame_add_buf(chain->frame, chain->cmd[4], len);
+
+	if(spi_frame_submit(chain->frame) < 0)
+	{
+		chain->shadow_valid = 0;
+		return -1;
+	}
+	memset(chain->shadow, 0, sizeof(chain->shadow));
+	chain->shadow_valid = 1;
+	chain->since_refresh = 0;
+	return 0;
+}
+
+/***********************************************************************
+* max7219_chain_invalidate - Function to forget what the wall holds.
+* @chain: Wall
+*
+* Returns nothing.
+*
+* Description: Function to forget what the wall holds, forcing the next
+* 	flush to rewrite every row.
+***********************************************************************/
+void max7219_chain_invalidate(struct max7219_chain *chain)
+{
+	chain->shadow_valid = 0;
+}
+
+/***********************************************************************
+* max7219_chain_clear - Function to blank the framebuffer.
+* @chain: Wall
+*
+* Returns nothing.
+*
+* Description: Function to blank the framebuffer. Nothing is sent until
+* 	max7219_chain_flush().
+***********************************************************************/
+void max7219_chain_clear(struct max7219_chain *chain)
+{
+	memset(chain->fb, 0, sizeof(chain->fb));
+}
+
+/***********************************************************************
+* max7219_chain_set_pixel - Function to set one pixel of the wall.
+* @chain: Wall
+* @x: Column, 0 is the left edge of device 0
+* @y: Row, 0 is the top
+* @on: Non zero to light it
+*
+* Returns nothing.
+*
+* Description: Function to set one pixel of the wall. On this matrix
+* 	the digit registers are columns, digit 1 leftmost, and bit 0 of
+* 	a digit is the top row (see sprites.h).
+***********************************************************************/
+void max7219_chain_set_pixel(struct max7219_chain *chain, unsigned int x,
+	unsigned int y, int on)
+{
+	uint8_t bit = 1 << y;
+
+	if(x >= chain->n * 8 || y >= 8)
+		return;
+	if(on)
+		chain->fb[x % 8][x / 8] |= bit;
+	else
+		chain->fb[x % 8][x / 8] &= ~bit;
+}
+
+/***********************************************************************
+* max7219_chain_load - Function to set the framebuffer from a bitmap.
+* @chain: Wall
+* @cols: Column packed words, one per device (see scroll.h)
+*
+* Returns nothing.
+*
+* Description: Function to set the whole framebuffer from a column
+* 	packed bitmap: byte d of word k is digit d + 1 of device k.
+***********************************************************************/
+void max7219_chain_load(struct max7219_chain *chain, const uint64_t *cols)
+{
+	unsigned int i, k;
+
+	for(k = 0; k < chain->n; k++)
+		for(i = 0; i < MAX7219_DIGITS; i++)
+			chain->fb[i][k] = (uint8_t)(cols[k] >> (8 * i));
+}
+
+/***********************************************************************
+* max7219_chain_set_digit - Function to set one row of one device.
+* @chain: Wall
+* @device: Device, 0 is the one on the bus
+* @digit: Digit register, 1 to 8
+* @data: Row bits
+*
+* Returns nothing.
+*
+* Description: Function to set one row of one device of the framebuffer.
+***********************************************************************/
+void max7219_chain_set_digit(struct max7219_chain *chain, unsigned int device,
+	unsigned int digit, uint8_t data)
+{
+	if(device < chain->n && digit >= 1 && digit <= MAX7219_DIGITS)
+		chain->fb[digit - 1][device] = data;
+}
+
+/***********************************************************************
+* max7219_chain_blit - Function to draw a sprite on one device.
+* @chain: Wall
+* @device: Device, 0 is the one on the bus
+* @sprite: Sprite
+*
+* Returns nothing.
+*
+* Description: Function to draw a pre-encoded sprite on one device of
+* 	the framebuffer.
+***********************************************************************/
+void max7219_chain_blit(struct max7219_chain *chain, unsigned int device,
+	const struct max7219_sprite *sprite)
+{
+	unsigned int i;
+
+	if(device >= chain->n)
+		return;
+	for(i = 0; i < MAX7219_DIGITS; i++)
+		chain->fb[sprite->wire[i][0] - 1][device] = sprite->wire[i][1];
+}
+
+/***********************************************************************
+* max7219_chain_stage - Function to prepare the next wall frame.
+* @chain: Wall
+*
+* Returns nothing.
+*
+* Description: Function to encode the rows of @fb that differ from the
+* 	shadow on any device and queue them, one message and one latch
+* 	per row, so a frame is at most 8 transfers whatever the chain
+* 	length. max7219_chain_present() sends it; @fb must not change in
+* 	between.
+***********************************************************************/
+void max7219_chain_stage(struct max7219_chain *chain)
+{
+	unsigned int i;
+
+	chain->staged_full = !chain->shadow_valid ||
+		(chain->refresh_interval && chain->since_refresh >= chain->refresh_interval);
+	spi_frame_reset(chain->frame);
+	for(i = 0; i < MAX7219_DIGITS; i++)
+	{
+		if(!chain->staged_full && memcmp(chain->fb[i], chain->shadow[i], chain->n) == 0)
+			continue;
+		max7219_chain_encode(chain, i);
+		spi_frame_add_buf(chain->frame, chain->wire[i], chain->n * 2);
+	}
+	chain->staged = 1;
+}
+
+/***********************************************************************
+* max7219_chain_present - Function to send the staged wall frame.
+* @chain: Wall
+*
+* Returns 0 on success, or if nothing was staged.
+*
+* Description: Function to send the frame prepared by
+* 	max7219_chain_stage(). A failed submit invalidates the shadow.
+***********************************************************************/
+int max7219_chain_present(struct max7219_chain *chain)
+{
+	if(!chain->staged)
+		return 0;
+	chain->staged = 0;
+
+	if(spi_frame_submit(chain->frame) < 0)
+	{
+		chain->shadow_valid = 0;
+		return -1;
+	}
+	memcpy(chain->shadow, chain->fb, sizeof(chain->shadow));
+	chain->shadow_valid = 1;
+	chain->since_refresh = chain->staged_full ? 0 : chain->since_refresh + 1;
+	return 0;
+}
+
+/***********************************************************************
+* max7219_chain_flush - Function to send the framebuffer to the wall.
+* @chain: Wall
+*
+* Returns 0 on success.
+*
+* Description: Function to send the changed rows of the framebuffer to
+* 	the wall right away.
+***********************************************************************/
+int max7219_chain_flush(struct max7219_chain *chain)
+{
+	max7219_chain_stage(chain);
+	return max7219_chain_present(chain);
+}
@@ -0,0 +1,88 @@
+#ifndef __MAX7219_FUNC_H__
+#define __MAX7219_FUNC_H__
+
+#include <stdint.h>
+#include "spi.h"
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define MAX7219_DIGITS 8		/* digit registers 0x01 - 0x08 */
+#define MAX7219_FULL_REFRESH 64		/* frames between full rewrites */
+#define MAX7219_CHAIN_MAX 32		/* daisy chained devices */
+
+#define MAX7219_REG_NOOP 0x00
+
+#define MAX7219_REG_DECODE 0x09
+#define MAX7219_REG_INTENSITY 0x0A
+#define MAX7219_REG_SCAN_LIMIT 0x0B
+#define MAX7219_REG_SHUTDOWN 0x0C
+#define MAX7219_REG_DISPLAY_TEST 0x0F
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/* One full image, pre-encoded as the address/data pairs sent on the wire */
+struct max7219_sprite {
+	uint8_t wire[MAX7219_DIGITS][2];
+};
+
+/*
+ * A wall of daisy chained MAX7219s, device 0 wired to the SPI bus and
+ * leftmost. Each chip shifts what it receives on to the next, and all of
+ * them latch their last 16 bits when chip select goes high, so one
+ * digit register (a row of the MAX7219, a column of this matrix) of the
+ * whole wall is a single @n * 2 byte message: the farthest device's
+ * pair first, device 0's last. @fb is what the caller wants on the wall
+ * and @shadow what the chips currently hold, one byte per device per
+ * digit. Flushing only sends the rows that differ, and every
+ * @refresh_interval flushes all of them are rewritten so a glitched
+ * register does not stick. @wire holds the encoded row messages and
+ * @cmd the setup broadcasts, both sent in place. A single display is a
+ * chain of one.
+ */
+struct max7219_chain {
+	struct spi_frame *frame;
+	unsigned int n;
+	uint8_t fb[MAX7219_DIGITS][MAX7219_CHAIN_MAX];
+	uint8_t shadow[MAX7219_DIGITS][MAX7219_CHAIN_MAX];
+	uint8_t wire[MAX7219_DIGITS][MAX7219_CHAIN_MAX * 2];
+	uint8_t cmd[5][MAX7219_CHAIN_MAX * 2];	/* setup and shutdown exit */
+	int shadow_valid;
+	unsigned int refresh_interval;	/* 0 disables forced refreshes */
+	unsigned int since_refresh;
+	int staged;			/* a frame is queued in @frame */
+	int staged_full;		/* ... and it rewrites every row */
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+void max7219_chain_init(struct max7219_chain *chain, struct spi_frame *frame,
+	unsigned int n, unsigned int refresh_interval);
+int max7219_chain_start(struct max7219_chain *chain);
+void max7219_chain_invalidate(struct max7219_chain *chain);
+void max7219_chain_clear(struct max7219_chain *chain);
+void max7219_chain_set_pixel(struct max7219_chain *chain, unsigned int x,
+	unsigned int y, int on);
+void max7219_chain_set_digit(struct max7219_chain *chain, unsigned int device,
+	unsigned int digit, uint8_t data);
+void max7219_chain_load(struct max7219_chain *chain, const uint64_t *cols);
+void max7219_chain_blit(struct max7219_chain *chain, unsigned int device,
+	const struct max7219_sprite *sprite);
+void max7219_chain_stage(struct max7219_chain *chain);
+int max7219_chain_present(struct max7219_chain *chain);
+int max7219_chain_flush(struct max7219_chain *chain);
+
+/* Width of the wall in pixels */
+static __inline__ unsigned int max7219_chain_width(const struct max7219_chain *chain)
+{
+	return chain->n * 8;
+}
+
+
+#endif /* __MAX7219_FUNC_H__ */
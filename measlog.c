@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "tsc.h"
+#include "measlog.h"
+
+
+/***********************************************************************
+* measlog_open - Function to create a measurement log.
+* @log: Log
+* @path: File
+* @records: Ring capacity, a power of two
+*
+* Returns 0 on success.
+*
+* Description: Function to create a measurement log of @records slots in
+* 	@path, replacing an older one, and map it. The mapping is
+* 	populated up front, so appends do not page fault.
+***********************************************************************/
+int measlog_open(struct measlog *log, const char *path, unsigned int records)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	struct timespec ts;
+
+	memset(log, 0, sizeof(*log));
+	log->fd = -1;
+	if(records == 0 || (records & (records - 1)) != 0)
+		return -EINVAL;
+
+	log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(log->fd < 0)
+	{
+		perror("measlog/open");
+		return -errno;
+	}
+	log->map_len = page + (unsigned long long)records * sizeof(struct measlog_record);
+	if(ftruncate(log->fd, log->map_len) < 0)
+	{
+		perror("measlog/ftruncate");
+		goto fail;
+	}
+	log->map = mmap(NULL, log->map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, log->fd, 0);
+	if(log->map == MAP_FAILED)
+	{
+		perror("measlog/mmap");
+		log->map = NULL;
+		goto fail;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	log->hdr = log->map;
+	log->hdr->magic = MEASLOG_MAGIC;
+	log->hdr->version = MEASLOG_VERSION;
+	log->hdr->record_size = sizeof(struct measlog_record);
+	log->hdr->capacity = records;
+	log->hdr->data_offset = page;
+	log->hdr->tsc_hz = tsc_calib.hz;
+	log->hdr->start_ns = (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	msync(log->map, page, MS_SYNC);
+
+	log->mask = records - 1;
+	log->per_page = page / sizeof(struct measlog_record);
+	log->next = 1;
+	log->flushed = 1;
+	log->rec = (struct measlog_record *)((char *)log->map + page);
+	return 0;
+
+fail:
+	close(log->fd);
+	log->fd = -1;
+	return -1;
+}
+
+/* Writes back the records of [from, to) in seq space, to - from <= capacity */
+static void measlog_sync_range(struct measlog *log, unsigned long long from,
+	unsigned long long to)
+{
+	unsigned long long first = (from - 1) & log->mask;
+	unsigned long long count = to - from;
+	unsigned long long part;
+	char *start;
+
+	while(count > 0)
+	{
+		part = log->mask + 1 - first;
+		if(part > count)
+			part = count;
+		/* msync() wants a page aligned start */
+		start = (char *)&log->rec[first - first % log->per_page];
+		msync(start, (char *)&log->rec[first + part] - start, MS_SYNC);
+		count -= part;
+		first = 0;
+	}
+}
+
+/***********************************************************************
+* measlog_flush - Function to write finished log pages to the file.
+* @log: Log
+*
+* Returns number of records written back.
+*
+* Description: Function to write back the log pages the writer has
+* 	moved past. The page being filled is left alone: writeback write
+* 	protects a page, and the writer's next store to it would fault.
+* 	For the same reason the MEASLOG_AHEAD_PAGES pages ahead of the
+* 	writer are dirtied here, so the fault is taken by the flusher.
+***********************************************************************/
+int measlog_flush(struct measlog *log)
+{
+	unsigned long long next = __atomic_load_n(&log->next, __ATOMIC_ACQUIRE);
+	unsigned long long done, seq, capacity = log->mask + 1;
+	struct measlog_record *r;
+	unsigned int n;
+
+	/* records before the page being written, but no more than one lap */
+	done = next - (next - 1) % log->per_page;
+	if(done - log->flushed > capacity)
+		log->flushed = done - capacity;
+	if(done <= log->flushed)
+		return 0;
+	measlog_sync_range(log, log->flushed, done);
+	n = done - log->flushed;
+	log->flushed = done;
+
+	for(seq = done + log->per_page; seq < done + (MEASLOG_AHEAD_PAGES + 1) * log->per_page;
+		seq += log->per_page)
+	{
+		r = &log->rec[(seq - 1) & log->mask];
+		__atomic_fetch_or(&r->seq, 0, __ATOMIC_RELAXED);
+	}
+	return n;
+}
+
+/***********************************************************************
+* measlog_flusher - Thread Function to flush a log periodically.
+* @arg: Log
+*
+* Returns NULL
+*
+* Description: Thread Function to flush the log every MEASLOG_FLUSH_MS
+* 	until @stop is set. Meant to run at low priority.
+***********************************************************************/
+void *measlog_flusher(void *arg)
+{
+	struct measlog *log = arg;
+
+	while(!log->stop)
+	{
+		usleep(MEASLOG_FLUSH_MS * 1000);
+		measlog_flush(log);
+	}
+	return NULL;
+}
+
+/***********************************************************************
+* measlog_close - Function to flush and close a log.
+* @log: Log
+*
+* Returns nothing.
+*
+* Description: Function to write back every record and close the log.
+* 	A flusher thread must have been stopped, by setting @stop, and
+* 	joined first. Records left unflushed at exit are not lost, they
+* 	sit in the page cache and reach the file with normal writeback.
+***********************************************************************/
+void measlog_close(struct measlog *log)
+{
+	if(log->map != NULL)
+	{
+		if(log->next - log->flushed > log->mask + 1)
+			log->flushed = log->next - (log->mask + 1);
+		measlog_sync_range(log, log->flushed, log->next);
+		munmap(log->map, log->map_len);
+	}
+	if(log->fd >= 0)
+		close(log->fd);
+	log->map = NULL;
+	log->rec = NULL;
+	log->fd = -1;
+}
+
+/***********************************************************************
+* measlog_load - Function to read a log file back.
+* @path: File
+* @hdr: Filled with the file header
+* @out: Set to the records, oldest first; free() it
+* @torn: If not NULL, set to the number of slots caught mid-write
+*
+* Returns number of records, negative on failure.
+*
+* Description: Function to read a log file back in record order. Only
+* 	the last lap of the ring is still there; the newest record is the
+* 	one with the highest seq.
+***********************************************************************/
+long measlog_load(const char *path, struct measlog_header *hdr,
+	struct measlog_record **out, unsigned long long *torn)
+{
+	struct measlog_record *ring, *rec;
+	unsigned long long seq, first, last = 0, skipped = 0;
+	long n = 0;
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if(f == NULL)
+		return -errno;
+	if(fread(hdr, sizeof(*hdr), 1, f) != 1 || hdr->magic != MEASLOG_MAGIC ||
+		hdr->version != MEASLOG_VERSION ||
+		hdr->record_size != sizeof(struct measlog_record) ||
+		hdr->capacity == 0 || (hdr->capacity & (hdr->capacity - 1)) != 0)
+	{
+		fclose(f);
+		return -EINVAL;
+	}
+
+	ring = calloc(hdr->capacity, sizeof(*ring));
+	rec = calloc(hdr->capacity, sizeof(*rec));
+	if(ring == NULL || rec == NULL || fseek(f, hdr->data_offset, SEEK_SET) < 0 ||
+		fread(ring, sizeof(*ring), hdr->capacity, f) != hdr->capacity)
+	{
+		fclose(f);
+		free(ring);
+		free(rec);
+		return -EIO;
+	}
+	fclose(f);
+
+	for(i = 0; i < hdr->capacity; i++)
+		if(ring[i].seq > last)
+			last = ring[i].seq;
+	first = (last > hdr->capacity) ? last - hdr->capacity + 1 : 1;
+
+	for(seq = first; seq <= last && last != 0; seq++)
+	{
+		if(ring[(seq - 1) & (hdr->capacity - 1)].seq != seq)
+			skipped++;
+		else
+			rec[n++] = ring[(seq - 1) & (hdr->capacity - 1)];
+	}
+	free(ring);
+
+	if(torn != NULL)
+		*torn = skipped;
+	*out = rec;
+	return n;
+}
+
+/***********************************************************************
+* measlog_stamp_ns - Function to convert a raw stamp of a record to ns.
+* @hdr: Header of the log the record came from
+* @r: Record
+* @stamp: One of its trigger/rise/fall stamps, or a difference of two
+*
+* Returns @stamp in ns.
+*
+* Description: Function to convert a raw stamp of a record to ns. TSC
+* 	stamps are converted with the frequency the log was written at.
+***********************************************************************/
+unsigned long long measlog_stamp_ns(const struct measlog_header *hdr,
+	const struct measlog_record *r, unsigned long long stamp)
+{
+	if(!(r->flags & MEASLOG_TSC) || hdr->tsc_hz == 0)
+		return stamp;
+	return (unsigned long long)((long double)stamp * 1e9L / hdr->tsc_hz);
+}
@@ -0,0 +1,117 @@
+#ifndef __MEASLOG_FUNC_H__
+#define __MEASLOG_FUNC_H__
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#ifndef MEASLOG_PATH
+#define MEASLOG_PATH "/tmp/hcsr04.mlog"
+#endif
+#define MEASLOG_MAGIC 0x474c4d48	/* "HMLG" */
+#define MEASLOG_VERSION 2
+#define MEASLOG_RECORDS 65536		/* power of two, 4 MB of records */
+#define MEASLOG_REPLAY_PATH "/tmp/hcsr04-replay.mlog"	/* log of a replay */
+#define MEASLOG_FLUSH_MS 250
+#define MEASLOG_AHEAD_PAGES 16		/* dirtied ahead of the writer */
+
+/* Record flags */
+#define MEASLOG_VALID 0x1	/* echo finished in range */
+#define MEASLOG_TSC 0x2		/* stamps are TSC ticks, not ns */
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * One measurement, a cache line. @seq counts records from 1 and is
+ * written last, so a record whose @seq is not the one its slot should
+ * hold is stale or torn. The raw stamps are enough to replay the
+ * measurement: @rise is 0 if no echo came, @fall is 0 if it never ended.
+ */
+struct measlog_record {
+	unsigned long long seq;
+	unsigned long long trigger;	/* raw timestamps, end of trigger pulse */
+	unsigned long long rise;	/* ... and echo edges */
+	unsigned long long fall;
+	unsigned int distance_um;
+	unsigned short sensor_id;
+	unsigned short flags;
+	unsigned int reserved[6];
+};
+
+/*
+ * File header, alone in the first page. Written once at open, so the
+ * writer never dirties it; the newest record is found by its @seq.
+ */
+struct measlog_header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int record_size;
+	unsigned int capacity;		/* records in the ring */
+	unsigned int data_offset;	/* file offset of record 0 */
+	unsigned int pad;
+	unsigned long long tsc_hz;
+	unsigned long long start_ns;	/* CLOCK_MONOTONIC at open */
+};
+
+/*
+ * Open log. The ring is a MAP_SHARED file mapping: appending is a store
+ * into the page cache, and the flusher thread writes the pages that the
+ * writer has left behind back to the file.
+ */
+struct measlog {
+	int fd;
+	void *map;
+	unsigned long long map_len;
+	struct measlog_header *hdr;
+	struct measlog_record *rec;
+	unsigned int mask;
+	unsigned int per_page;		/* records per page */
+	unsigned long long next;	/* seq of the next record, writer owned */
+	unsigned long long flushed;	/* records below are on disk */
+	volatile int stop;
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+int measlog_open(struct measlog *log, const char *path, unsigned int records);
+void measlog_close(struct measlog *log);
+int measlog_flush(struct measlog *log);
+void *measlog_flusher(void *arg);
+long measlog_load(const char *path, struct measlog_header *hdr,
+	struct measlog_record **out, unsigned long long *torn);
+unsigned long long measlog_stamp_ns(const struct measlog_header *hdr,
+	const struct measlog_record *r, unsigned long long stamp);
+
+/*
+ * Appends one record. Single writer; no syscall and no lock, only
+ * stores into the locked mapping.
+ */
+static __inline__ void measlog_append(struct measlog *log, unsigned int sensor_id,
+	unsigned long long trigger, unsigned long long rise, unsigned long long fall,
+	unsigned long long distance_um, unsigned int flags)
+{
+	unsigned long long seq = log->next;
+	struct measlog_record *r;
+
+	if(log->rec == 0)
+		return;
+	r = &log->rec[(seq - 1) & log->mask];
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	r->trigger = trigger;
+	r->rise = rise;
+	r->fall = fall;
+	r->distance_um = distance_um;
+	r->sensor_id = sensor_id;
+	r->flags = flags;
+	__atomic_store_n(&r->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&log->next, seq + 1, __ATOMIC_RELEASE);
+}
+
+
+#endif /* __MEASLOG_FUNC_H__ */
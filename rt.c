@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "rt.h"
+
+
+/* sched_setattr(2) argument, which glibc does not wrap everywhere */
+struct rt_sched_attr {
+	unsigned int size;
+	unsigned int sched_policy;
+	unsigned long long sched_flags;
+	int sched_nice;
+	unsigned int sched_priority;
+	unsigned long long sched_runtime;
+	unsigned long long sched_deadline;
+	unsigned long long sched_period;
+};
+
+static const char *rt_policy_name(int policy)
+{
+	switch(policy)
+	{
+	case SCHED_OTHER:
+		return "SCHED_OTHER";
+	case SCHED_FIFO:
+		return "SCHED_FIFO";
+	case SCHED_RR:
+		return "SCHED_RR";
+	case SCHED_IDLE:
+		return "SCHED_IDLE";
+	case SCHED_DEADLINE:
+		return "SCHED_DEADLINE";
+	}
+	return "unknown";
+}
+
+/* Policies pthread attributes can carry, the others are set in-thread */
+static int rt_attr_policy(int policy)
+{
+	return policy == SCHED_OTHER || policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+/* Locked memory of the process in kB, from /proc/self/status */
+static long rt_locked_kb(void)
+{
+	char line[128];
+	long kb = -1;
+	FILE *f = fopen("/proc/self/status", "r");
+
+	if(f == NULL)
+		return -1;
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		if(sscanf(line, "VmLck: %ld", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb;
+}
+
+/***********************************************************************
+* rt_lock_memory - Function to keep the process resident.
+*
+* Returns 0 on success.
+*
+* Description: Function to lock all current and future pages of the
+* 	process and fault in RT_HEAP_RESERVE of heap. Freed heap is kept
+* 	in the process and large allocations are not served by mmap, so
+* 	later mallocs reuse locked pages instead of page faulting. Call
+* 	it once, before the real time threads are started.
+***********************************************************************/
+int rt_lock_memory(void)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *heap;
+	long i, kb;
+
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		perror("rt/mlockall");
+		return -1;
+	}
+
+	heap = malloc(RT_HEAP_RESERVE);
+	if(heap != NULL)
+	{
+		for(i = 0; i < RT_HEAP_RESERVE; i += page)
+			heap[i] = 0;
+		free(heap);
+	}
+
+	kb = rt_locked_kb();
+	if(kb <= 0)
+	{
+		printf("rt: mlockall took no effect\n");
+		return -1;
+	}
+	printf("rt: %ld kB locked\n", kb);
+	return 0;
+}
+
+/***********************************************************************
+* rt_prefault_stack - Function to fault in the top of the thread stack.
+*
+* Returns nothing.
+*
+* Description: Function to touch RT_STACK_PREFAULT bytes of stack below
+* 	the caller, so the first deep call of a real time loop does not
+* 	take page faults.
+***********************************************************************/
+void __attribute__((noinline)) rt_prefault_stack(void)
+{
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	unsigned int i;
+
+	for(i = 0; i < sizeof(stack); i += 256)
+		stack[i] = 0;
+}
+
+/***********************************************************************
+* rt_apply - Function to apply a profile to the calling thread.
+* @cfg: Wanted scheduling
+*
+* Returns 0 on success.
+*
+* Description: Function to apply a profile to the calling thread.
+* 	SCHED_DEADLINE threads are left unpinned, the kernel only admits
+* 	them with an affinity spanning their whole root domain.
+***********************************************************************/
+int rt_apply(const struct rt_thread_cfg *cfg)
+{
+	struct sched_param param = { .sched_priority = cfg->priority };
+	struct rt_sched_attr attr;
+	cpu_set_t cpus;
+	int ret;
+
+	if(cfg->policy == SCHED_DEADLINE)
+	{
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.sched_policy = SCHED_DEADLINE;
+		attr.sched_runtime = cfg->runtime_ns;
+		attr.sched_deadline = cfg->deadline_ns;
+		attr.sched_period = cfg->period_ns;
+		if(syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+		{
+			printf("rt: %s: SCHED_DEADLINE refused (%s)\n", cfg->name,
+				strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	ret = pthread_setschedparam(pthread_self(), cfg->policy, &param);
+	if(ret == 0 && cfg->cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(cfg->cpu, &cpus);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	if(ret != 0)
+	{
+		printf("rt: %s: %s\n", cfg->name, strerror(ret));
+		return -1;
+	}
+	return 0;
+}
+
+/***********************************************************************
+* rt_verify - Function to check a profile took on the calling thread.
+* @cfg: Wanted scheduling
+*
+* Returns 0 if policy, priority and affinity match, -1 otherwise.
+*
+* Description: Function to check a profile took on the calling thread,
+* 	by reading back what the kernel actually applied, and print it.
+***********************************************************************/
+int rt_verify(const struct rt_thread_cfg *cfg)
+{
+	struct rt_sched_attr attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	int policy, ok = 1;
+
+	if(cfg->policy == SCHED_DEADLINE)
+	{
+		memset(&attr, 0, sizeof(attr));
+		if(syscall(SYS_sched_getattr, 0, &attr, sizeof(attr), 0) < 0)
+			return -1;
+		policy = attr.sched_policy;
+		param.sched_priority = 0;
+		ok = policy == SCHED_DEADLINE && attr.sched_runtime == cfg->runtime_ns &&
+			attr.sched_period == cfg->period_ns;
+	}
+	else
+	{
+		if(pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+			return -1;
+		ok = policy == cfg->policy && param.sched_priority == cfg->priority;
+	}
+
+	if(cfg->cpu >= 0 && cfg->policy != SCHED_DEADLINE)
+	{
+		if(pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0 ||
+			CPU_COUNT(&cpus) != 1 || !CPU_ISSET(cfg->cpu, &cpus))
+			ok = 0;
+	}
+
+	printf("rt: %s %s/%d cpu %d%s\n", cfg->name, rt_policy_name(policy),
+		param.sched_priority, sched_getcpu(), ok ? "" : ", NOT as configured");
+	return ok ? 0 : -1;
+}
+
+/*
+ * Runs in the new thread: finishes what pthread attributes can not set,
+ * checks the result and lets rt_thread_start() return.
+ */
+static void *rt_thread_main(void *arg)
+{
+	struct rt_thread *t = arg;
+	void *(*fn)(void *) = t->fn;
+	void *fn_arg = t->arg;
+
+	if(t->status == 0 && !rt_attr_policy(t->cfg->policy) && rt_apply(t->cfg) < 0)
+		t->status = -1;
+	rt_prefault_stack();
+	if(t->status == 0 && rt_verify(t->cfg) < 0)
+		t->status = -1;
+	sem_post(&t->started);
+	return fn(fn_arg);
+}
+
+/***********************************************************************
+* rt_thread_start - Function to start a thread under its profile.
+* @t: Thread, with cfg, fn and arg filled in
+* @enable: Zero to start it with default scheduling
+*
+* Returns 0 if the profile is in effect, negative if the thread runs
+* without it, -2 if it could not be started at all.
+*
+* Description: Function to start a thread under its profile. Policy,
+* 	priority and affinity are set on the attributes with
+* 	PTHREAD_EXPLICIT_SCHED, so the thread runs with them from its
+* 	first instruction instead of inheriting the creator's; SCHED_IDLE
+* 	and SCHED_DEADLINE are applied by the thread itself. The thread
+* 	gets an RT_STACK_SIZE stack, prefaults it and verifies its
+* 	scheduling before this returns. Without the permission for the
+* 	profile the thread is started unprofiled.
+***********************************************************************/
+int rt_thread_start(struct rt_thread *t, int enable)
+{
+	const struct rt_thread_cfg *cfg = t->cfg;
+	struct sched_param param = { .sched_priority = cfg->priority };
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int ret;
+
+	sem_init(&t->started, 0, 0);
+	t->status = enable ? 0 : -1;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+	if(enable && rt_attr_policy(cfg->policy))
+	{
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, cfg->policy);
+		pthread_attr_setschedparam(&attr, &param);
+		if(cfg->cpu >= 0)
+		{
+			CPU_ZERO(&cpus);
+			CPU_SET(cfg->cpu, &cpus);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		}
+	}
+
+	ret = pthread_create(&t->id, &attr, rt_thread_main, t);
+	if(ret == EPERM || ret == EINVAL)
+	{
+		printf("rt: %s: %s, started unprofiled\n", cfg->name, strerror(ret));
+		t->status = -1;
+		pthread_attr_destroy(&attr);
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+		ret = pthread_create(&t->id, &attr, rt_thread_main, t);
+	}
+	pthread_attr_destroy(&attr);
+	if(ret != 0)
+	{
+		printf("rt: can not start %s (%s)\n", cfg->name, strerror(ret));
+		sem_destroy(&t->started);
+		t->status = -2;
+		return -2;
+	}
+
+	sem_wait(&t->started);
+	sem_destroy(&t->started);
+	return t->status;
+}
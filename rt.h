@@ -0,0 +1,68 @@
+#ifndef __RT_FUNC_H__
+#define __RT_FUNC_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/*
+ * Explicit thread stack size. With mlockall(MCL_FUTURE) every stack is
+ * locked in full, so the 8 MB glibc default would pin 8 MB per thread.
+ */
+#define RT_STACK_SIZE (256 * 1024)
+#define RT_STACK_PREFAULT (64 * 1024)	/* touched before the thread runs */
+#define RT_HEAP_RESERVE (1024 * 1024)	/* heap faulted in and kept */
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/* Wanted scheduling of one thread */
+struct rt_thread_cfg {
+	const char *name;
+	int policy;			/* SCHED_OTHER/FIFO/RR/IDLE/DEADLINE */
+	int priority;			/* SCHED_FIFO priority */
+	int cpu;			/* CPU to pin to, -1 for any */
+	unsigned long long runtime_ns;	/* SCHED_DEADLINE budget ... */
+	unsigned long long deadline_ns;	/* ... due this long after ... */
+	unsigned long long period_ns;	/* ... the start of every period */
+};
+
+/*
+ * A thread started under a profile. @status is 0 once the thread checked
+ * that its policy, priority and affinity took, negative if they did not
+ * and the thread runs with what it got instead, -2 if it never started.
+ */
+struct rt_thread {
+	const struct rt_thread_cfg *cfg;
+	void *(*fn)(void *);
+	void *arg;
+	pthread_t id;
+	int status;
+	sem_t started;
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+int rt_lock_memory(void);
+int rt_thread_start(struct rt_thread *t, int enable);
+int rt_apply(const struct rt_thread_cfg *cfg);
+int rt_verify(const struct rt_thread_cfg *cfg);
+void rt_prefault_stack(void);
+
+
+#endif /* __RT_FUNC_H__ */
@@ -0,0 +1,162 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "sample_ring.h"
+
+
+/*
+ * Copies slot @seq out of the ring. Returns 0 on a clean copy, -EAGAIN if
+ * the producer was writing that slot or has already reused it.
+ */
+static int sample_ring_read(struct sample_ring *ring, unsigned long long seq,
+	struct sample *out)
+{
+	unsigned int idx = (seq - 1) & SAMPLE_RING_MASK;
+	unsigned int l1, l2;
+
+	l1 = __atomic_load_n(&ring->slot[idx].lock, __ATOMIC_ACQUIRE);
+	if(l1 & 1)
+		return -EAGAIN;
+	memcpy(out, &ring->slot[idx].s, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	l2 = __atomic_load_n(&ring->slot[idx].lock, __ATOMIC_RELAXED);
+
+	if(l1 != l2 || out->seq != seq)
+		return -EAGAIN;
+	return 0;
+}
+
+/***********************************************************************
+* sample_ring_init - Function to empty a sample ring.
+* @ring: Ring
+*
+* Returns nothing.
+*
+* Description: Function to empty a sample ring.
+***********************************************************************/
+void sample_ring_init(struct sample_ring *ring)
+{
+	memset(ring, 0, sizeof(*ring));
+}
+
+/***********************************************************************
+* sample_ring_publish - Function to add a sample, producer side.
+* @ring: Ring
+* @s: Sample; its seq is filled in, and its timestamp_ns if 0
+*
+* Returns nothing.
+*
+* Description: Function to add a sample, producer side. Never blocks and
+* 	takes no lock, so it is safe from a SCHED_FIFO thread. A replay
+* 	passes its own timestamp_ns, to keep the recorded timeline.
+***********************************************************************/
+void sample_ring_publish(struct sample_ring *ring, struct sample *s)
+{
+	unsigned long long seq = ring->head + 1;
+	unsigned int idx = (seq - 1) & SAMPLE_RING_MASK;
+	unsigned int lock = ring->slot[idx].lock;
+	struct timespec ts;
+
+	s->seq = seq;
+	if(s->timestamp_ns == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		s->timestamp_ns = (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	__atomic_store_n(&ring->slot[idx].lock, lock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&ring->slot[idx].s, s, sizeof(*s));
+	__atomic_store_n(&ring->slot[idx].lock, lock + 2, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ring->head, seq, __ATOMIC_RELEASE);
+}
+
+/***********************************************************************
+* sample_ring_latest - Function to get the newest sample, consumer side.
+* @ring: Ring
+* @out: Filled with the sample
+*
+* Returns 0 on success, -ENODATA if nothing was published yet.
+*
+* Description: Function to get the newest sample, consumer side. Wait
+* 	free: the newest slot is only rewritten SAMPLE_RING_SIZE publishes
+* 	later, so if it is caught mid-write the reader just takes the next
+* 	newest one, trying a bounded number of slots.
+***********************************************************************/
+int sample_ring_latest(struct sample_ring *ring, struct sample *out)
+{
+	unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	int tries;
+
+	for(tries = 0; tries < 4 && head > 0; tries++)
+	{
+		if(sample_ring_read(ring, head, out) == 0)
+			return 0;
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+	return (head == 0) ? -ENODATA : -EAGAIN;
+}
+
+/***********************************************************************
+* sample_ring_pop - Function to take the oldest unread sample.
+* @ring: Ring
+* @out: Filled with the sample
+*
+* Returns 1 if a sample was taken, 0 if the ring is empty.
+*
+* Description: Function to take the oldest unread sample, consumer side,
+* 	so that no sample is skipped while the consumer keeps up. Samples
+* 	overwritten before they were popped are added to ring->lost.
+***********************************************************************/
+int sample_ring_pop(struct sample_ring *ring, struct sample *out)
+{
+	unsigned long long head;
+
+	while(1)
+	{
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if(ring->tail == head)
+			return 0;
+
+		if(head - ring->tail > SAMPLE_RING_SIZE - 1)
+		{
+			ring->lost += head - ring->tail - (SAMPLE_RING_SIZE - 1);
+			ring->tail = head - (SAMPLE_RING_SIZE - 1);
+		}
+
+		if(sample_ring_read(ring, ring->tail + 1, out) == 0)
+		{
+			ring->tail++;
+			return 1;
+		}
+		/* overwritten under us, the check above skips ahead */
+	}
+}
+
+/***********************************************************************
+* sample_ring_recent - Function to copy the newest samples.
+* @ring: Ring
+* @out: Array filled newest first
+* @n: Size of @out, at most SAMPLE_RING_SIZE - 1
+*
+* Returns number of samples copied.
+*
+* Description: Function to copy the newest samples without consuming
+* 	them. Slots the producer is reusing meanwhile end the copy early.
+***********************************************************************/
+int sample_ring_recent(struct sample_ring *ring, struct sample *out, int n)
+{
+	unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	int i;
+
+	if(n > SAMPLE_RING_SIZE - 1)
+		n = SAMPLE_RING_SIZE - 1;
+
+	for(i = 0; i < n && head > (unsigned long long)i; i++)
+	{
+		if(sample_ring_read(ring, head - i, &out[i]) < 0)
+			break;
+	}
+	return i;
+}
@@ -0,0 +1,54 @@
+#ifndef __SAMPLE_RING_H__
+#define __SAMPLE_RING_H__
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define SAMPLE_RING_SIZE 64	/* power of two */
+#define SAMPLE_RING_MASK (SAMPLE_RING_SIZE - 1)
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/* One distance measurement as published by the sensor thread */
+struct sample {
+	unsigned long long seq;		/* publish number, from 1 */
+	unsigned int sensor_id;
+	unsigned long long timestamp_ns;	/* CLOCK_MONOTONIC at publish, or replay time */
+	unsigned long long rise;	/* raw echo timestamps */
+	unsigned long long fall;
+	unsigned long long distance_um;
+	int valid;
+};
+
+/*
+ * Single producer / single consumer ring of samples. The producer never
+ * waits: when the consumer falls behind, the oldest samples are
+ * overwritten and counted in @lost. Each slot carries its own sequence
+ * word, odd while being written, so a reader can tell a torn copy.
+ */
+struct sample_ring {
+	struct {
+		unsigned int lock;
+		struct sample s;
+	} slot[SAMPLE_RING_SIZE];
+	unsigned long long head;	/* samples published, producer owned */
+	unsigned long long tail;	/* samples popped, consumer owned */
+	unsigned long long lost;	/* overwritten before being popped */
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+void sample_ring_init(struct sample_ring *ring);
+void sample_ring_publish(struct sample_ring *ring, struct sample *s);
+int sample_ring_latest(struct sample_ring *ring, struct sample *out);
+int sample_ring_pop(struct sample_ring *ring, struct sample *out);
+int sample_ring_recent(struct sample_ring *ring, struct sample *out, int n);
+
+
+#endif /* __SAMPLE_RING_H__ */
@@ -0,0 +1,182 @@
+#include <string.h>
+#include "scroll.h"
+
+
+/* Packs up to five column bytes, leftmost first, into a glyph word */
+#define GLYPH(w, c0, c1, c2, c3, c4) \
+	{ (w), (uint64_t)(c0) | (uint64_t)(c1) << 8 | (uint64_t)(c2) << 16 | \
+		(uint64_t)(c3) << 24 | (uint64_t)(c4) << 32 }
+
+struct glyph {
+	unsigned int width;		/* columns, 0 for a character not drawn */
+	uint64_t cols;
+};
+
+/*
+ * Proportional 5x7 font, bit 0 on top, covering what a distance reading
+ * needs. Glyphs are followed by one blank column when drawn.
+ */
+static const struct glyph font[128] = {
+	[' '] = GLYPH(3, 0x00, 0x00, 0x00, 0, 0),
+	['-'] = GLYPH(3, 0x08, 0x08, 0x08, 0, 0),
+	['.'] = GLYPH(2, 0x60, 0x60, 0, 0, 0),
+	['0'] = GLYPH(5, 0x3e, 0x51, 0x49, 0x45, 0x3e),
+	['1'] = GLYPH(3, 0x42, 0x7f, 0x40, 0, 0),
+	['2'] = GLYPH(5, 0x42, 0x61, 0x51, 0x49, 0x46),
+	['3'] = GLYPH(5, 0x21, 0x41, 0x45, 0x4b, 0x31),
+	['4'] = GLYPH(5, 0x18, 0x14, 0x12, 0x7f, 0x10),
+	['5'] = GLYPH(5, 0x27, 0x45, 0x45, 0x45, 0x39),
+	['6'] = GLYPH(5, 0x3c, 0x4a, 0x49, 0x49, 0x30),
+	['7'] = GLYPH(5, 0x01, 0x71, 0x09, 0x05, 0x03),
+	['8'] = GLYPH(5, 0x36, 0x49, 0x49, 0x49, 0x36),
+	['9'] = GLYPH(5, 0x06, 0x49, 0x49, 0x29, 0x1e),
+	['c'] = GLYPH(4, 0x38, 0x44, 0x44, 0x44, 0),
+	['m'] = GLYPH(5, 0x7c, 0x04, 0x18, 0x04, 0x78),
+};
+
+static const struct glyph *font_glyph(char c)
+{
+	return &font[(unsigned char)c & 0x7f];
+}
+
+/* ORs @cols, @width columns wide, into @bits at column @x */
+static void font_put(uint64_t *bits, unsigned int words, unsigned int x,
+	uint64_t cols, unsigned int width)
+{
+	unsigned int i = x / 8, sh = (x % 8) * 8;
+
+	if(i < words)
+		bits[i] |= cols << sh;
+	if(sh != 0 && sh + width * 8 > 64 && i + 1 < words)
+		bits[i + 1] |= cols >> (64 - sh);
+}
+
+/***********************************************************************
+* font_width - Function to measure a text.
+* @text: Text
+*
+* Returns its width in columns, spacing included.
+*
+* Description: Function to measure a text as font_render() draws it.
+***********************************************************************/
+unsigned int font_width(const char *text)
+{
+	unsigned int w = 0;
+
+	for(; *text; text++)
+		if(font_glyph(*text)->width)
+			w += font_glyph(*text)->width + 1;
+	return w;
+}
+
+/***********************************************************************
+* font_render - Function to draw a text into a column packed bitmap.
+* @bits: Bitmap
+* @words: Its size in words
+* @x: Column of the left edge of the text
+* @text: Text
+*
+* Returns the column after the text.
+*
+* Description: Function to draw a text into a column packed bitmap, one
+* 	glyph word shifted into place and ORed per character. Characters
+* 	the font lacks are left out, columns past the bitmap clipped.
+***********************************************************************/
+unsigned int font_render(uint64_t *bits, unsigned int words, unsigned int x,
+	const char *text)
+{
+	const struct glyph *g;
+
+	for(; *text; text++)
+	{
+		g = font_glyph(*text);
+		if(g->width == 0)
+			continue;
+		font_put(bits, words, x, g->cols, g->width);
+		x += g->width + 1;
+	}
+	return x;
+}
+
+/***********************************************************************
+* scroll_init - Function to set up an empty marquee.
+* @s: Marquee
+* @width: Columns shown, at most SCROLL_WALL_COLS
+*
+* Returns nothing.
+*
+* Description: Function to set up an empty marquee.
+***********************************************************************/
+void scroll_init(struct scroll *s, unsigned int width)
+{
+	memset(s, 0, sizeof(*s));
+	s->width = (width > SCROLL_WALL_COLS) ? SCROLL_WALL_COLS : width;
+	s->len = s->width;
+}
+
+/***********************************************************************
+* scroll_set_text - Function to change the text of a marquee.
+* @s: Marquee
+* @text: Text, at most SCROLL_TEXT_MAX characters are shown
+*
+* Returns nothing.
+*
+* Description: Function to render @text into the strip. The position is
+* 	kept, so a reading that changes while it scrolls by does not jump.
+* 	A text narrower than the window is padded to its width, so one copy
+* 	is on the wall at a time.
+***********************************************************************/
+void scroll_set_text(struct scroll *s, const char *text)
+{
+	char buf[SCROLL_TEXT_MAX + 1];
+
+	strncpy(buf, text, SCROLL_TEXT_MAX);
+	buf[SCROLL_TEXT_MAX] = '\0';
+
+	memset(s->strip, 0, sizeof(s->strip));
+	s->len = font_width(buf) + SCROLL_GAP;
+	if(s->len < s->width)
+		s->len = s->width;
+	font_render(s->strip, SCROLL_STRIP_WORDS, 0, buf);
+	font_render(s->strip, SCROLL_STRIP_WORDS, s->len, buf);
+	s->pos %= s->len;
+}
+
+/***********************************************************************
+* scroll_step - Function to advance a marquee.
+* @s: Marquee
+* @cols: Columns to move the text left by
+*
+* Returns nothing.
+*
+* Description: Function to advance a marquee.
+***********************************************************************/
+void scroll_step(struct scroll *s, unsigned int cols)
+{
+	s->pos = (s->pos + cols) % s->len;
+}
+
+/***********************************************************************
+* scroll_window - Function to cut the visible part out of a marquee.
+* @s: Marquee
+* @out: Column packed words, one per module
+* @words: Number of words to fill
+*
+* Returns nothing.
+*
+* Description: Function to cut the visible part out of a marquee. Each
+* 	output word is two strip words shifted together, so the cost is
+* 	per module, not per pixel.
+***********************************************************************/
+void scroll_window(const struct scroll *s, uint64_t *out, unsigned int words)
+{
+	unsigned int i = s->pos / 8, sh = (s->pos % 8) * 8, k;
+
+	for(k = 0; k < words; k++, i++)
+	{
+		if(sh == 0)
+			out[k] = s->strip[i];
+		else
+			out[k] = (s->strip[i] >> sh) | (s->strip[i + 1] << (64 - sh));
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef __SCROLL_H__
+#define __SCROLL_H__
+
+#include <stdint.h>
+#include "max7219.h"
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define SCROLL_TEXT_MAX 24		/* characters of text */
+#define SCROLL_GAP 8			/* blank columns before the text repeats */
+#define SCROLL_WALL_COLS (MAX7219_CHAIN_MAX * 8)
+/* text, gap and one wall width repeated after them, plus a guard word */
+#define SCROLL_STRIP_WORDS ((SCROLL_TEXT_MAX * 6 + SCROLL_GAP + 2 * SCROLL_WALL_COLS) / 8 + 1)
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * Column packed bitmaps. A uint64_t holds eight columns of eight pixels,
+ * byte c being column c from the left and bit r of it row r from the
+ * top, which is exactly one 8x8 module as its digit registers hold it
+ * (see sprites.h). A bitmap wider than a module is an array of them, so
+ * moving an image by one column is a shift by 8 bits carried across
+ * words, and drawing is OR and AND-NOT with masks.
+ */
+
+/*
+ * Marquee of one line of text. @strip holds the rendered text followed
+ * by a gap, @len columns in all, and then its first wall width again, so
+ * the visible window never has to wrap: it is always @width columns
+ * starting at @pos.
+ */
+struct scroll {
+	uint64_t strip[SCROLL_STRIP_WORDS];
+	unsigned int width;		/* columns shown */
+	unsigned int len;		/* columns before the text repeats */
+	unsigned int pos;		/* first column shown, below @len */
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+unsigned int font_render(uint64_t *bits, unsigned int words, unsigned int x,
+	const char *text);
+unsigned int font_width(const char *text);
+void scroll_init(struct scroll *s, unsigned int width);
+void scroll_set_text(struct scroll *s, const char *text);
+void scroll_step(struct scroll *s, unsigned int cols);
+void scroll_window(const struct scroll *s, uint64_t *out, unsigned int words);
+
+/* Column packed word of a pre-encoded sprite, for compositing */
+static __inline__ uint64_t scroll_sprite_word(const struct max7219_sprite *sprite)
+{
+	uint64_t w = 0;
+	unsigned int i;
+
+	for(i = 0; i < MAX7219_DIGITS; i++)
+		w |= (uint64_t)sprite->wire[i][1] << (8 * (sprite->wire[i][0] - 1));
+	return w;
+}
+
+
+#endif /* __SCROLL_H__ */
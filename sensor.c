@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include "led.h"
+#include "tsc.h"
+#include "stats.h"
+#include "sensor.h"
+
+
+/***********************************************************************
+* echo_open - Function to set up an ultrasonic sensor.
+* @s: Sensor
+* @trig_gpio: GPIO wired to TRIG
+* @echo_gpio: GPIO wired to ECHO
+*
+* Returns 0 on success.
+*
+* Description: Function to set up an ultrasonic sensor. The trigger is
+* 	driven low and the echo line is opened for edge capture by the
+* 	hardware backend, kernel timestamped when it can be.
+***********************************************************************/
+int echo_open(struct echo_sensor *s, unsigned int trig_gpio,
+	unsigned int echo_gpio)
+{
+	int fd;
+
+	memset(s, 0, sizeof(*s));
+	s->trig_gpio = trig_gpio;
+	s->echo_gpio = echo_gpio;
+	s->value_fd = -1;
+	s->line_fd = -1;
+	s->rt_cpu = -1;
+
+	if(gpio_set_value(trig_gpio, GPIO_VALUE_LOW) < 0)
+		return -1;
+
+	fd = gpio_edge_open(echo_gpio, &s->use_cdev);
+	if(fd < 0)
+		return -1;
+	if(s->use_cdev)
+		s->line_fd = fd;
+	else
+		s->value_fd = fd;
+	return 0;
+}
+
+/***********************************************************************
+* echo_close - Function to release an ultrasonic sensor.
+* @s: Sensor
+*
+* Returns nothing.
+*
+* Description: Function to release an ultrasonic sensor.
+***********************************************************************/
+void echo_close(struct echo_sensor *s)
+{
+	if(s->line_fd >= 0)
+		close(s->line_fd);
+	if(s->value_fd >= 0)
+		gpio_fd_close(s->value_fd);
+	s->line_fd = s->value_fd = -1;
+}
+
+/***********************************************************************
+* echo_set_trigger_rt - Function to protect the trigger pulse.
+* @s: Sensor
+* @enable: Non zero to raise the thread to SCHED_FIFO during the pulse
+* @cpu: CPU to pin the triggering thread to, -1 to leave it
+*
+* Returns 0 on success.
+*
+* Description: Function to protect the trigger pulse from preemption.
+* 	The thread calling echo_trigger() is moved to SCHED_FIFO priority
+* 	ECHO_TRIGGER_RT_PRIO for the pulse only, so nothing but interrupts
+* 	can stretch it; pinning keeps it off CPUs that other real time
+* 	threads use. Needs CAP_SYS_NICE; without it the pulse falls back
+* 	to normal scheduling.
+***********************************************************************/
+int echo_set_trigger_rt(struct echo_sensor *s, int enable, int cpu)
+{
+	s->rt_trigger = enable;
+	s->rt_cpu = cpu;
+	s->rt_pinned = 0;
+	return 0;
+}
+
+/*
+ * Raises the calling thread to SCHED_FIFO for a trigger pulse. Returns 1
+ * if the old policy in *policy and *param has to be restored afterwards.
+ */
+static int echo_rt_enter(struct echo_sensor *s, int *policy,
+	struct sched_param *param)
+{
+	struct sched_param rt;
+	cpu_set_t set;
+	int ret;
+
+	if(s->rt_cpu >= 0 && !s->rt_pinned)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(s->rt_cpu, &set);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			printf("echo: can not pin the trigger to cpu %d\n", s->rt_cpu);
+		s->rt_pinned = 1;
+	}
+
+	if(pthread_getschedparam(pthread_self(), policy, param) != 0)
+		return 0;
+	if(*policy == SCHED_FIFO && param->sched_priority >= ECHO_TRIGGER_RT_PRIO)
+		return 0;
+
+	rt.sched_priority = ECHO_TRIGGER_RT_PRIO;
+	ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &rt);
+	if(ret != 0)
+	{
+		printf("echo: no SCHED_FIFO for the trigger pulse (%s)\n", strerror(ret));
+		s->rt_trigger = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/***********************************************************************
+* echo_trigger - Function to send the trigger pulse.
+* @s: Sensor
+*
+* Returns the achieved pulse width in ns.
+*
+* Description: Function to send the ECHO_TRIGGER_NS trigger pulse. The
+* 	pin is held high with a TSC timed spin rather than usleep(), which
+* 	under load can oversleep by milliseconds. The line goes high
+* 	somewhere inside the first GPIO write and low somewhere inside the
+* 	second, so the width is taken between the midpoints of the two
+* 	writes; it is kept in @trigger_width_ns and the stats.
+***********************************************************************/
+unsigned long long echo_trigger(struct echo_sensor *s)
+{
+	struct sched_param param;
+	unsigned long long t0, t1, t2, t3, end;
+	int policy, boosted = 0;
+
+	if(s->rt_trigger)
+		boosted = echo_rt_enter(s, &policy, &param);
+
+	t0 = my_rdtsc();
+	gpio_set_value(s->trig_gpio, GPIO_VALUE_HIGH);
+	t1 = my_rdtsc();
+	end = t1 + tsc_from_ns(ECHO_TRIGGER_NS);
+	while((t2 = my_rdtsc()) < end)
+		__asm__ __volatile__("rep; nop");
+	gpio_set_value(s->trig_gpio, GPIO_VALUE_LOW);
+	t3 = my_rdtsc();
+
+	if(boosted)
+		pthread_setschedparam(pthread_self(), policy, &param);
+
+	s->trigger_width_ns = tsc_to_ns((t2 + t3) / 2 - (t0 + t1) / 2);
+	stats_record_ns(STAT_TRIGGER_WIDTH, s->trigger_width_ns);
+	return s->trigger_width_ns;
+}
+
+/***********************************************************************
+* echo_timeout_ns - Function to compute how long an echo can take.
+* @range_cm: Farthest distance of interest
+*
+* Returns time from trigger to the end of the echo pulse, in ns.
+*
+* Description: Function to compute how long an echo can take for a
+* 	target at @range_cm: the burst set up time plus the round trip at
+* 	the speed of sound, with 10% margin. Anything later is out of
+* 	range and is reported as a timeout.
+***********************************************************************/
+unsigned long long echo_timeout_ns(unsigned int range_cm)
+{
+	unsigned long long ns = ECHO_SETUP_NS + (unsigned long long)range_cm * ECHO_NS_PER_CM;
+
+	return ns + ns / 10;
+}
+
+/* echo_timeout_ns() rounded up to a poll() timeout */
+#define ECHO_TIMEOUT_MS ((int)((echo_timeout_ns(ECHO_MAX_RANGE_CM) + 999999) / 1000000))
+
+/***********************************************************************
+* echo_level - Function to read the sysfs echo level.
+* @s: Sensor
+*
+* Returns 1 if the echo is high, 0 if low, negative on failure.
+*
+* Description: Function to read the sysfs echo level. The read also
+* 	acknowledges the edge notification, so the next POLLPRI is for
+* 	an edge after it.
+***********************************************************************/
+int echo_level(struct echo_sensor *s)
+{
+	char ch;
+
+	if(pread(s->value_fd, &ch, 1, 0) != 1)
+		return -1;
+	return ch != '0';
+}
+
+/***********************************************************************
+* echo_arm - Function to get the sysfs echo line ready for a cycle.
+* @s: Sensor
+*
+* Returns nothing.
+*
+* Description: Function to get the sysfs echo line ready for a cycle,
+* 	right before the trigger. Edges of earlier cycles still pending
+* 	are acknowledged. If the echo is still high, the sensor has not
+* 	finished its last ping and the next falling edge is that ping's,
+* 	which @stale_high tells the edge handler to skip.
+***********************************************************************/
+void echo_arm(struct echo_sensor *s)
+{
+	s->stale_high = (echo_level(s) == 1);
+	if(s->stale_high)
+		echo_edge_error(s, 1);
+}
+
+/***********************************************************************
+* echo_edge_error - Function to count an edge that did not fit.
+* @s: Sensor
+* @spurious: Non zero for an unexpected edge, 0 for a lost one
+*
+* Returns nothing.
+*
+* Description: Function to count an edge that did not fit the cycle,
+* 	per sensor and in the shared stats.
+***********************************************************************/
+void echo_edge_error(struct echo_sensor *s, int spurious)
+{
+	if(spurious)
+	{
+		s->spurious_edges++;
+		stats_count(STAT_SPURIOUS_EDGES);
+	}
+	else
+	{
+		s->missed_edges++;
+		stats_count(STAT_MISSED_EDGES);
+	}
+}
+
+/***********************************************************************
+* echo_check_seqno - Function to spot edges the kernel dropped.
+* @s: Sensor
+* @seqno: Line sequence number of the edge just read
+*
+* Returns nothing.
+*
+* Description: Function to spot edges the character device dropped,
+* 	from gaps in the line sequence numbers.
+***********************************************************************/
+void echo_check_seqno(struct echo_sensor *s, unsigned int seqno)
+{
+	unsigned int gap = seqno - s->last_seqno - 1;
+
+	if(s->last_seqno != 0 && gap != 0 && gap < 0x80000000U)
+	{
+		s->missed_edges += gap;
+		__atomic_fetch_add(&stats->counter[STAT_MISSED_EDGES], gap, __ATOMIC_RELAXED);
+	}
+	s->last_seqno = seqno;
+}
+
+/*
+ * sysfs path: the line interrupts on both edges, set up once by
+ * gpio_edge_open(). Each wakeup is stamped with rdtsc, so the width
+ * includes the wakeup latency of both edges, and the level read after
+ * it says which edge it was. If the echo is already low again when the
+ * rise is read, rise and fall came before the read and the width is
+ * lost; the cycle ends right there instead of waiting for a fall.
+ */
+static int echo_measure_sysfs(struct echo_sensor *s, struct echo_pulse *p)
+{
+	struct pollfd Echo_Pin;
+	unsigned long long now;
+	int retPoll, level, high = 0;
+
+	Echo_Pin.fd = s->value_fd;
+	Echo_Pin.events = POLLPRI;
+	Echo_Pin.revents = 0;
+
+	echo_arm(s);
+	echo_trigger(s);
+
+	while(1)
+	{
+		retPoll = poll(&Echo_Pin, 1, ECHO_TIMEOUT_MS);
+		if(retPoll < 0)
+		{
+			printf("Poll Error Ocurred\n");
+			return -1;
+		}
+		if(retPoll == 0 || !(Echo_Pin.revents & POLLPRI))
+			return 0;
+
+		now = my_rdtsc();
+		level = echo_level(s);
+		Echo_Pin.revents = 0;
+		if(level < 0)
+			return -1;
+
+		if(!high)
+		{
+			if(level)
+			{
+				p->rise = now;
+				high = 1;
+			}
+			else if(s->stale_high)
+			{
+				s->stale_high = 0;	/* the last ping ended */
+			}
+			else
+			{
+				echo_edge_error(s, 0);
+				return 0;
+			}
+		}
+		else if(!level)
+		{
+			p->fall = now;
+			p->width_ns = tsc_to_ns(p->fall - p->rise);
+			p->distance_um = tsc_to_um(p->fall - p->rise);
+			p->valid = 1;
+			return 0;
+		}
+		else
+		{
+			echo_edge_error(s, 1);
+		}
+	}
+}
+
+/*
+ * Character device path: both edges are enabled for good, the kernel
+ * timestamps them in the interrupt handler and they are read back in
+ * batches. Leftover events from an earlier cycle are drained first, and
+ * edges read in the same batch after the fall count as spurious.
+ */
+static int echo_measure_cdev(struct echo_sensor *s, struct echo_pulse *p)
+{
+	struct gpio_edge ev[GPIO_EDGE_BATCH];
+	int i, n, have_rise = 0;
+
+	while((n = gpio_cdev_read_edges(s->line_fd, ev, GPIO_EDGE_BATCH, 0)) > 0)
+		s->last_seqno = ev[n - 1].seqno;
+
+	echo_trigger(s);
+
+	while(1)
+	{
+		n = gpio_cdev_read_edges(s->line_fd, ev, GPIO_EDGE_BATCH,
+			ECHO_TIMEOUT_MS);
+		if(n < 0)
+		{
+			printf("Poll Error Ocurred\n");
+			return -1;
+		}
+		if(n == 0)
+			return 0;
+
+		for(i = 0; i < n; i++)
+		{
+			echo_check_seqno(s, ev[i].seqno);
+			if(ev[i].rising)
+			{
+				if(have_rise)
+					echo_edge_error(s, 1);
+				p->rise = ev[i].timestamp_ns;
+				have_rise = 1;
+			}
+			else if(!have_rise)
+			{
+				echo_edge_error(s, 1);
+			}
+			else
+			{
+				p->fall = ev[i].timestamp_ns;
+				p->width_ns = p->fall - p->rise;
+				p->distance_um = ECHO_NS_TO_UM(p->width_ns);
+				p->valid = 1;
+				while(++i < n)
+				{
+					echo_check_seqno(s, ev[i].seqno);
+					echo_edge_error(s, 1);
+				}
+				return 0;
+			}
+		}
+	}
+}
+
+/***********************************************************************
+* echo_measure - Function to take one distance measurement.
+* @s: Sensor
+* @p: Filled with the echo pulse
+*
+* Returns 0 when the cycle completed (check p->valid), negative on a
+* poll error.
+*
+* Description: Function to take one distance measurement: fire the
+* 	trigger and time the echo pulse with whichever backend is open.
+***********************************************************************/
+int echo_measure(struct echo_sensor *s, struct echo_pulse *p)
+{
+	memset(p, 0, sizeof(*p));
+	if(s->use_cdev)
+		return echo_measure_cdev(s, p);
+	return echo_measure_sysfs(s, p);
+}
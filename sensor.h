@@ -0,0 +1,77 @@
+#ifndef __SENSOR_FUNC_H__
+#define __SENSOR_FUNC_H__
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define ECHO_MAX_RANGE_CM 400	/* HC-SR04 datasheet range */
+#define ECHO_SOUND_M_PER_S 343ULL	/* speed of sound in air at 20 C */
+#define ECHO_UM_TO_NS(um) ((um) * 2000 / ECHO_SOUND_M_PER_S)	/* target distance to echo width */
+#define ECHO_NS_TO_UM(ns) ((ns) * ECHO_SOUND_M_PER_S / 2000)	/* echo width to target distance */
+#define ECHO_NS_PER_CM ECHO_UM_TO_NS(10000)	/* echo round trip, 58309 ns */
+#define ECHO_SETUP_NS 500000ULL	/* trigger to echo rise, 8 cycle burst */
+#define ECHO_RECOVERY_NS 10000000ULL	/* let the ping die out before retriggering */
+#define ECHO_TRIGGER_NS 12000ULL	/* datasheet minimum is 10 us */
+#define ECHO_TRIGGER_RT_PRIO 90	/* SCHED_FIFO priority around the pulse */
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * One echo pulse. @rise and @fall are raw timestamps in the backend's
+ * own clock (TSC ticks for sysfs, kernel nanoseconds for the character
+ * device); @width_ns and @distance_um are converted without rounding
+ * to whole microseconds first.
+ */
+struct echo_pulse {
+	unsigned long long rise;
+	unsigned long long fall;
+	unsigned long long width_ns;
+	unsigned long long distance_um;
+	int valid;
+};
+
+/*
+ * An HC-SR04. The echo line is captured through the GPIO character
+ * device when available, which gives kernel edge timestamps, and
+ * otherwise through sysfs edge polling stamped with rdtsc. The sysfs
+ * line interrupts on both edges; each edge is told by the level read
+ * after it, so nothing is reconfigured between rise and fall.
+ */
+struct echo_sensor {
+	unsigned int trig_gpio;
+	unsigned int echo_gpio;
+	int use_cdev;
+	int value_fd;	/* sysfs: echo value, polled for POLLPRI */
+	int line_fd;	/* cdev: line request fd */
+	int rt_trigger;	/* run the pulse under SCHED_FIFO */
+	int rt_cpu;	/* CPU to pin the triggering thread to, or -1 */
+	int rt_pinned;
+	unsigned long long trigger_width_ns;	/* achieved by the last pulse */
+	int stale_high;		/* sysfs: echo was still high at the trigger */
+	unsigned int last_seqno;	/* cdev: of the last edge read */
+	unsigned long long missed_edges;	/* lost, or rise and fall run together */
+	unsigned long long spurious_edges;	/* fitting no cycle, ignored */
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+int echo_open(struct echo_sensor *s, unsigned int trig_gpio,
+	unsigned int echo_gpio);
+void echo_close(struct echo_sensor *s);
+int echo_set_trigger_rt(struct echo_sensor *s, int enable, int cpu);
+unsigned long long echo_trigger(struct echo_sensor *s);
+unsigned long long echo_timeout_ns(unsigned int range_cm);
+int echo_measure(struct echo_sensor *s, struct echo_pulse *p);
+int echo_level(struct echo_sensor *s);
+void echo_arm(struct echo_sensor *s);
+void echo_edge_error(struct echo_sensor *s, int spurious);
+void echo_check_seqno(struct echo_sensor *s, unsigned int seqno);
+
+
+#endif /* __SENSOR_FUNC_H__ */
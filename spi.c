@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "led.h"
+#include "hw.h"
+#include "stats.h"
+#include "spi.h"
+
+
+/***********************************************************************
+* spidev_open - Function to open a spidev device.
+* @device: Device node
+*
+* Returns fd on success, negative on failure.
+*
+* Description: Function to open a spidev device, the spidev backend of
+* 	spi_open().
+***********************************************************************/
+int spidev_open(const char *device)
+{
+	return open(device, O_RDWR);
+}
+
+/***********************************************************************
+* spidev_message - Function to run a spidev message.
+* @fd: spidev file descriptor
+* @tr: Transfers
+* @n: Number of transfers
+*
+* Returns 0 on success.
+*
+* Description: Function to run @n transfers as one SPI_IOC_MESSAGE, the
+* 	spidev backend of spi_frame_submit().
+***********************************************************************/
+int spidev_message(int fd, struct spi_ioc_transfer *tr, unsigned int n)
+{
+	if(ioctl(fd, SPI_IOC_MESSAGE(n), tr) < 1)
+		return -1;
+	return 0;
+}
+
+/***********************************************************************
+* spi_frame_init - Function to prepare a reusable SPI frame.
+* @frame: Frame to initialise
+* @fd: Open spidev file descriptor
+* @cs_gpio: GPIO used as chip select, or SPI_CS_NATIVE
+*
+* Returns 0 on success.
+*
+* Description: Function to prepare a reusable SPI frame. Every transfer
+* 	slot is pointed at its own preallocated 2 byte tx buffer. With
+* 	SPI_CS_NATIVE, cs_change makes spidev release chip select after
+* 	each register so the MAX7219 latches it, and the whole frame goes
+* 	out in one SPI_IOC_MESSAGE(N).
+***********************************************************************/
+int spi_frame_init(struct spi_frame *frame, int fd, int cs_gpio)
+{
+	int i;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->fd = fd;
+	frame->cs_gpio = cs_gpio;
+
+	for(i = 0; i < SPI_FRAME_MAX; i++)
+	{
+		frame->tr[i].tx_buf = (unsigned long)frame->tx[i];
+		frame->tr[i].len = 2;
+		frame->tr[i].delay_usecs = 1;
+		frame->tr[i].speed_hz = SPI_SPEED_HZ;
+		frame->tr[i].bits_per_word = 8;
+		frame->tr[i].cs_change = 1;
+	}
+
+	/* chip select idles high */
+	if(cs_gpio != SPI_CS_NATIVE && gpio_set_value(cs_gpio, GPIO_VALUE_HIGH) < 0)
+		return -1;
+	return 0;
+}
+
+/***********************************************************************
+* spi_frame_reset - Function to empty a frame.
+* @frame: Frame
+*
+* Returns nothing.
+*
+* Description: Function to empty a frame.
+***********************************************************************/
+void spi_frame_reset(struct spi_frame *frame)
+{
+	frame->count = 0;
+}
+
+/***********************************************************************
+* spi_frame_add - Function to queue a register write.
+* @frame: Frame
+* @address: Address
+* @data: data
+*
+* Returns 0 on success.
+*
+* Description: Function to queue a register write into the next
+* 	preallocated slot of the frame.
+***********************************************************************/
+int spi_frame_add(struct spi_frame *frame, uint8_t address, uint8_t data)
+{
+	if(frame->count >= SPI_FRAME_MAX)
+		return -ENOSPC;
+
+	frame->tx[frame->count][0] = address;
+	frame->tx[frame->count][1] = data;
+	frame->tr[frame->count].tx_buf = (unsigned long)frame->tx[frame->count];
+	frame->tr[frame->count].len = 2;
+	frame->count++;
+	return 0;
+}
+
+/***********************************************************************
+* spi_frame_add_wire - Function to queue a pre-encoded register write.
+* @frame: Frame
+* @wire: Address/data pair as it goes on the wire
+*
+* Returns 0 on success.
+*
+* Description: Function to queue a pre-encoded register write. The slot
+* 	points straight at @wire, nothing is copied, so @wire must stay
+* 	valid until the frame is submitted.
+***********************************************************************/
+int spi_frame_add_wire(struct spi_frame *frame, const uint8_t wire[2])
+{
+	if(frame->count >= SPI_FRAME_MAX)
+		return -ENOSPC;
+
+	frame->tr[frame->count].tx_buf = (unsigned long)wire;
+	frame->tr[frame->count].len = 2;
+	frame->count++;
+	return 0;
+}
+
+/***********************************************************************
+* spi_frame_add_buf - Function to queue a pre-encoded message.
+* @frame: Frame
+* @buf: Bytes as they go on the wire
+* @len: Number of bytes
+*
+* Returns 0 on success.
+*
+* Description: Function to queue a pre-encoded message of any length,
+* 	sent under one chip select pulse, such as one register write
+* 	for each device of a daisy chain. Like spi_frame_add_wire(),
+* 	@buf is not copied.
+***********************************************************************/
+int spi_frame_add_buf(struct spi_frame *frame, const uint8_t *buf, unsigned int len)
+{
+	if(frame->count >= SPI_FRAME_MAX)
+		return -ENOSPC;
+
+	frame->tr[frame->count].tx_buf = (unsigned long)buf;
+	frame->tr[frame->count].len = len;
+	frame->count++;
+	return 0;
+}
+
+/***********************************************************************
+* spi_frame_submit - Function to send the queued register writes.
+* @frame: Frame
+*
+* Returns 0 on success.
+*
+* Description: Function to send the queued register writes and empty
+* 	the frame. In native chip select mode this is a single message.
+* 	Otherwise each transfer is framed by the chip select GPIO and sent
+* 	with its own message, as the latch needs a GPIO edge in between.
+***********************************************************************/
+int spi_frame_submit(struct spi_frame *frame)
+{
+	unsigned int i, n = frame->count;
+	int ret = 0;
+
+	if(n == 0)
+		return 0;
+	frame->count = 0;
+
+	if(frame->cs_gpio == SPI_CS_NATIVE)
+	{
+		/* cs_change on the last transfer would keep CS asserted */
+		frame->tr[n - 1].cs_change = 0;
+		if(hw->spi_message(frame->fd, frame->tr, n) < 0)
+		{
+			printf("can't send spi message\n");
+			stats_count(STAT_SPI_ERRORS);
+			ret = -1;
+		}
+		frame->tr[n - 1].cs_change = 1;
+		return ret;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		gpio_set_value(frame->cs_gpio, GPIO_VALUE_LOW);
+		if(hw->spi_message(frame->fd, &frame->tr[i], 1) < 0)
+		{
+			printf("can't send spi message\n");
+			stats_count(STAT_SPI_ERRORS);
+			ret = -1;
+		}
+		gpio_set_value(frame->cs_gpio, GPIO_VALUE_HIGH);
+	}
+	return ret;
+}
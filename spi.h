@@ -0,0 +1,49 @@
+#ifndef __SPI_FUNC_H__
+#define __SPI_FUNC_H__
+
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define SPI_FRAME_MAX 64	/* register writes per frame */
+#define SPI_CS_NATIVE (-1)	/* let spidev drive chip select */
+#define SPI_SPEED_HZ 10000000
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * A batch of register writes, 2 bytes each, or longer messages for a
+ * chain of devices. The transfer array and the tx buffers are set up
+ * once by spi_frame_init() and reused for every frame, so filling and
+ * submitting a frame does not allocate.
+ */
+struct spi_frame {
+	int fd;
+	int cs_gpio;		/* GPIO framing each write, or SPI_CS_NATIVE */
+	unsigned int count;
+	struct spi_ioc_transfer tr[SPI_FRAME_MAX];
+	uint8_t tx[SPI_FRAME_MAX][2];
+};
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+int spi_open(const char *device);
+int spidev_open(const char *device);
+int spidev_message(int fd, struct spi_ioc_transfer *tr, unsigned int n);
+int spi_frame_init(struct spi_frame *frame, int fd, int cs_gpio);
+void spi_frame_reset(struct spi_frame *frame);
+int spi_frame_add(struct spi_frame *frame, uint8_t address, uint8_t data);
+int spi_frame_add_wire(struct spi_frame *frame, const uint8_t wire[2]);
+int spi_frame_add_buf(struct spi_frame *frame, const uint8_t *buf, unsigned int len);
+int spi_frame_submit(struct spi_frame *frame);
+
+
+#endif /* __SPI_FUNC_H__ */
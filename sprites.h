@@ -0,0 +1,70 @@
+#ifndef __SPRITES_H__
+#define __SPRITES_H__
+
+#include <stdint.h>
+#include "max7219.h"
+
+
+/****************************************************************
+ * Sprite generators
+ *
+ * A sprite is stored already encoded as the eight address/data pairs
+ * that go on the wire, so showing it costs no per-frame work. The
+ * macros below build those pairs from eight row bytes at compile time;
+ * on this matrix the digit registers are columns, so reversing their
+ * order mirrors the image left to right, and shifting the bits moves
+ * it up or down.
+ ****************************************************************/
+
+#define SPRITE_(r1, r2, r3, r4, r5, r6, r7, r8) \
+	{ { { 1, (r1) }, { 2, (r2) }, { 3, (r3) }, { 4, (r4) }, \
+	    { 5, (r5) }, { 6, (r6) }, { 7, (r7) }, { 8, (r8) } } }
+#define SPRITE(...) SPRITE_(__VA_ARGS__)
+
+#define SPRITE_MIRROR_(r1, r2, r3, r4, r5, r6, r7, r8) \
+	SPRITE_(r8, r7, r6, r5, r4, r3, r2, r1)
+#define SPRITE_MIRROR(...) SPRITE_MIRROR_(__VA_ARGS__)
+
+#define SPRITE_ROW_SHIFT(r, n) \
+	((uint8_t)((n) >= 0 ? ((r) << (n)) & 0xff : ((r) >> -(n)) & 0xff))
+#define SPRITE_SHIFT_(n, r1, r2, r3, r4, r5, r6, r7, r8) \
+	SPRITE_(SPRITE_ROW_SHIFT(r1, n), SPRITE_ROW_SHIFT(r2, n), \
+		SPRITE_ROW_SHIFT(r3, n), SPRITE_ROW_SHIFT(r4, n), \
+		SPRITE_ROW_SHIFT(r5, n), SPRITE_ROW_SHIFT(r6, n), \
+		SPRITE_ROW_SHIFT(r7, n), SPRITE_ROW_SHIFT(r8, n))
+#define SPRITE_SHIFT(n, ...) SPRITE_SHIFT_(n, __VA_ARGS__)
+
+#define ANIMATION(frames) { (frames), sizeof(frames) / sizeof((frames)[0]) }
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+struct animation {
+	const struct max7219_sprite *frames;
+	unsigned int count;
+};
+
+/****************************************************************
+ * Tables
+ ****************************************************************/
+
+/* Running dog, facing right */
+#define DOG_RUN_1 0x08, 0x90, 0xf0, 0x10, 0x10, 0x37, 0xdf, 0x98
+#define DOG_RUN_2 0x20, 0x10, 0x70, 0xd0, 0x10, 0x97, 0xff, 0x18
+
+static const struct max7219_sprite dog_right_frames[] = {
+	SPRITE(DOG_RUN_1),
+	SPRITE(DOG_RUN_2),
+};
+
+static const struct max7219_sprite dog_left_frames[] = {
+	SPRITE_MIRROR(DOG_RUN_1),
+	SPRITE_MIRROR(DOG_RUN_2),
+};
+
+static const struct animation dog_right = ANIMATION(dog_right_frames);
+static const struct animation dog_left = ANIMATION(dog_left_frames);
+
+
+#endif /* __SPRITES_H__ */
@@ -0,0 +1,34 @@
+/*
+ * Prints the live stats of a running output process from its shared
+ * memory segment.
+ *
+ * Usage: ./statdump [interval_s]   (repeats every interval_s seconds)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "stats.h"
+
+
+int main(int argc, char **argv)
+{
+	struct stats *st;
+	int interval = (argc > 1) ? atoi(argv[1]) : 0;
+
+	st = stats_attach();
+	if(st == NULL)
+	{
+		printf("No stats segment %s, is output running?\n", STATS_SHM_NAME);
+		return 1;
+	}
+
+	while(1)
+	{
+		stats_print(stdout, st);
+		if(interval <= 0)
+			break;
+		sleep(interval);
+		printf("\n");
+	}
+	return 0;
+}
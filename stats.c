@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "tsc.h"
+#include "stats.h"
+
+
+static const char *stage_names[STAT_STAGES] = {
+	[STAT_TRIGGER_WIDTH] = "trigger width",
+	[STAT_TRIGGER_ECHO] = "trigger->echo",
+	[STAT_PULSE_WIDTH] = "pulse width",
+	[STAT_SAMPLE_DISPLAY] = "sample->display",
+	[STAT_FRAME_PUSH] = "frame push",
+	[STAT_FRAME_JITTER] = "frame jitter",
+	[STAT_PREDICT_AHEAD] = "predict ahead",
+};
+
+static const char *counter_names[STAT_COUNTERS] = {
+	[STAT_SAMPLES] = "samples",
+	[STAT_TIMEOUTS] = "timeouts",
+	[STAT_POLL_ERRORS] = "poll errors",
+	[STAT_SPI_ERRORS] = "spi errors",
+	[STAT_FRAMES] = "frames",
+	[STAT_MISSED_FRAMES] = "missed frames",
+	[STAT_MISSED_EDGES] = "missed edges",
+	[STAT_SPURIOUS_EDGES] = "spurious edges",
+};
+
+/* Used until stats_init() maps the shared segment, and if that fails */
+static struct stats stats_local = {
+	.magic = STATS_MAGIC,
+	.version = STATS_VERSION,
+	.hist = {
+		[0 ... STAT_STAGES - 1] = { .min_ns = ~0ULL },
+	},
+};
+
+struct stats *stats = &stats_local;
+
+/***********************************************************************
+* stats_bucket - Function to map a latency to its histogram bucket.
+* @ns: Latency
+*
+* Returns the bucket index.
+*
+* Description: Function to map a latency to its histogram bucket: the
+* 	position of the top bit picks the power of two, the STATS_SUB_BITS
+* 	bits below it the linear bucket inside it.
+***********************************************************************/
+unsigned int stats_bucket(unsigned long long ns)
+{
+	unsigned int msb, shift;
+
+	if(ns < STATS_SUB)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	if(msb >= STATS_MAX_BITS)
+		return STATS_BUCKETS - 1;
+	shift = msb - STATS_SUB_BITS;
+	return (shift + 1) * STATS_SUB + ((ns >> shift) & (STATS_SUB - 1));
+}
+
+/***********************************************************************
+* stats_bucket_ns - Function to get the lower bound of a bucket.
+* @bucket: Bucket index
+*
+* Returns the smallest latency counted in @bucket, in ns.
+*
+* Description: Function to get the lower bound of a bucket, the inverse
+* 	of stats_bucket().
+***********************************************************************/
+unsigned long long stats_bucket_ns(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if(bucket < STATS_SUB)
+		return bucket;
+	shift = bucket / STATS_SUB - 1;
+	return (unsigned long long)(STATS_SUB + bucket % STATS_SUB) << shift;
+}
+
+/***********************************************************************
+* stats_record_ns - Function to add one latency to a stage histogram.
+* @stage: Stage
+* @ns: Latency
+*
+* Returns nothing.
+*
+* Description: Function to add one latency to a stage histogram. Lock
+* 	free and wait free but for the rare min/max update.
+***********************************************************************/
+void stats_record_ns(enum stats_stage stage, unsigned long long ns)
+{
+	struct stats_hist *h = &stats->hist[stage];
+	unsigned long long old;
+
+	__atomic_fetch_add(&h->bucket[stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+	old = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+	while(ns > old && !__atomic_compare_exchange_n(&h->max_ns, &old, ns, 1,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	old = __atomic_load_n(&h->min_ns, __ATOMIC_RELAXED);
+	while(ns < old && !__atomic_compare_exchange_n(&h->min_ns, &old, ns, 1,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/***********************************************************************
+* stats_reset - Function to clear a stats block.
+* @st: Stats block
+*
+* Returns nothing.
+*
+* Description: Function to clear a stats block and stamp its header.
+***********************************************************************/
+void stats_reset(struct stats *st)
+{
+	unsigned int i;
+
+	memset(st, 0, sizeof(*st));
+	for(i = 0; i < STAT_STAGES; i++)
+		st->hist[i].min_ns = ~0ULL;
+	st->tsc_hz = tsc_calib.hz;
+	st->version = STATS_VERSION;
+	__atomic_store_n(&st->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Latency at which @pct percent of the samples of @h are below */
+static unsigned long long stats_percentile(const struct stats_hist *h,
+	unsigned long long count, unsigned int pct)
+{
+	unsigned long long want = (count * pct + 99) / 100, seen = 0;
+	unsigned int i;
+
+	for(i = 0; i < STATS_BUCKETS; i++)
+	{
+		seen += h->bucket[i];
+		if(seen >= want)
+			return stats_bucket_ns(i);
+	}
+	return h->max_ns;
+}
+
+/***********************************************************************
+* stats_print - Function to print counters and stage latencies.
+* @out: Stream
+* @st: Stats block, local or attached
+*
+* Returns nothing.
+*
+* Description: Function to print the counters and, for every stage
+* 	that saw samples, its latency percentiles in microseconds.
+***********************************************************************/
+void stats_print(FILE *out, const struct stats *st)
+{
+	const struct stats_hist *h;
+	unsigned long long count;
+	unsigned int i;
+
+	for(i = 0; i < STAT_COUNTERS; i++)
+		fprintf(out, "%s%s %llu", i ? ", " : "", counter_names[i],
+			st->counter[i]);
+	fprintf(out, "\n%-16s %8s %9s %9s %9s %9s %9s\n", "stage (us)", "count",
+		"min", "p50", "p90", "p99", "max");
+
+	for(i = 0; i < STAT_STAGES; i++)
+	{
+		h = &st->hist[i];
+		count = h->count;
+		if(count == 0)
+			continue;
+		fprintf(out, "%-16s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+			stage_names[i], count, h->min_ns / 1e3,
+			stats_percentile(h, count, 50) / 1e3,
+			stats_percentile(h, count, 90) / 1e3,
+			stats_percentile(h, count, 99) / 1e3, h->max_ns / 1e3);
+	}
+	fflush(out);
+}
+
+/*
+ * SIGUSR1 is blocked in every thread and taken here synchronously, so
+ * the dump runs in normal thread context instead of a signal handler.
+ */
+static void *stats_dumper(void *arg)
+{
+	sigset_t *set = arg;
+	int sig;
+
+	while(sigwait(set, &sig) == 0)
+		stats_print(stdout, stats);
+	return NULL;
+}
+
+/***********************************************************************
+* stats_init - Function to publish the stats in shared memory.
+*
+* Returns 0 on success.
+*
+* Description: Function to publish the stats in the STATS_SHM_NAME
+* 	shared memory segment, readable live by statdump, and to start
+* 	the thread printing them on SIGUSR1. Must run before any other
+* 	thread is created, as they inherit the blocked SIGUSR1. If the
+* 	segment can not be created the stats stay process local.
+***********************************************************************/
+int stats_init(void)
+{
+	static sigset_t set;
+	pthread_attr_t attr;
+	pthread_t thread;
+	void *map;
+	int fd, ret = 0;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	/* a small stack, it ends up locked in full under mlockall() */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STATS_DUMPER_STACK);
+	if(pthread_create(&thread, &attr, stats_dumper, &set) == 0)
+		pthread_detach(thread);
+	pthread_attr_destroy(&attr);
+
+	fd = shm_open(STATS_SHM_NAME, O_RDWR | O_CREAT, 0644);
+	if(fd < 0 || ftruncate(fd, sizeof(struct stats)) < 0)
+	{
+		perror("stats/shm");
+		ret = -1;
+		goto out;
+	}
+
+	map = mmap(NULL, sizeof(struct stats), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		perror("stats/mmap");
+		ret = -1;
+		goto out;
+	}
+	stats = map;
+
+out:
+	if(fd >= 0)
+		close(fd);
+	stats_reset(stats);
+	return ret;
+}
+
+/***********************************************************************
+* stats_attach - Function to map the stats of a running process.
+*
+* Returns the stats block, NULL on failure.
+*
+* Description: Function to map the stats of a running process read only.
+***********************************************************************/
+struct stats *stats_attach(void)
+{
+	struct stats *st;
+	int fd;
+
+	fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+	if(fd < 0)
+		return NULL;
+	st = mmap(NULL, sizeof(struct stats), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(st == MAP_FAILED)
+		return NULL;
+	if(st->magic != STATS_MAGIC || st->version != STATS_VERSION)
+	{
+		munmap(st, sizeof(struct stats));
+		return NULL;
+	}
+	return st;
+}
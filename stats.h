@@ -0,0 +1,115 @@
+#ifndef __STATS_FUNC_H__
+#define __STATS_FUNC_H__
+
+#include <stdio.h>
+#include "tsc.h"
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define STATS_SHM_NAME "/hcsr04-stats"
+#define STATS_MAGIC 0x48535453	/* "STSH" */
+#define STATS_VERSION 5
+#define STATS_DUMPER_STACK (64 * 1024)
+
+/*
+ * Log-linear buckets: values below STATS_SUB get a bucket each, above
+ * that every power of two is split into STATS_SUB linear buckets, which
+ * bounds the bucket error to 1/STATS_SUB (12.5%). Values of 2^40 ns
+ * (~18 minutes) and more land in the last bucket.
+ */
+#define STATS_SUB_BITS 3
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS 40
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB)
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+enum stats_stage {
+	STAT_TRIGGER_WIDTH,	/* achieved trigger pulse width */
+	STAT_TRIGGER_ECHO,	/* trigger -> rising echo edge */
+	STAT_PULSE_WIDTH,	/* rising -> falling echo edge */
+	STAT_SAMPLE_DISPLAY,	/* sample published -> frame started with it */
+	STAT_FRAME_PUSH,	/* frame started -> frame submitted */
+	STAT_FRAME_JITTER,	/* frame deadline -> display thread awake */
+	STAT_PREDICT_AHEAD,	/* sample -> frame shown, bridged by prediction */
+	STAT_STAGES,
+};
+
+enum stats_counter {
+	STAT_SAMPLES,
+	STAT_TIMEOUTS,
+	STAT_POLL_ERRORS,
+	STAT_SPI_ERRORS,
+	STAT_FRAMES,
+	STAT_MISSED_FRAMES,
+	STAT_MISSED_EDGES,	/* echo edges lost or run together */
+	STAT_SPURIOUS_EDGES,	/* echo edges that fit no cycle */
+	STAT_COUNTERS,
+};
+
+/*
+ * Histogram of one stage, in ns. Updated with relaxed atomics only, so
+ * recording never blocks and a reader in another process sees at worst
+ * a sample counted in @count but not yet in its bucket.
+ */
+struct stats_hist {
+	unsigned long long count;
+	unsigned long long sum_ns;
+	unsigned long long min_ns;
+	unsigned long long max_ns;
+	unsigned long long bucket[STATS_BUCKETS];
+};
+
+/* Layout of the shared memory segment */
+struct stats {
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long tsc_hz;
+	unsigned long long counter[STAT_COUNTERS];
+	struct stats_hist hist[STAT_STAGES];
+};
+
+/****************************************************************
+ * Globals
+ ****************************************************************/
+
+/* Shared segment once stats_init() succeeded, process local before */
+extern struct stats *stats;
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+int stats_init(void);
+void stats_reset(struct stats *st);
+void stats_record_ns(enum stats_stage stage, unsigned long long ns);
+void stats_print(FILE *out, const struct stats *st);
+struct stats *stats_attach(void);
+unsigned int stats_bucket(unsigned long long ns);
+unsigned long long stats_bucket_ns(unsigned int bucket);
+
+/* Hot path stamp, a raw TSC read */
+static __inline__ unsigned long long stats_stamp(void)
+{
+	return my_rdtsc();
+}
+
+/* Records the time between two stats_stamp() values */
+static __inline__ void stats_record_ticks(enum stats_stage stage,
+	unsigned long long from, unsigned long long to)
+{
+	stats_record_ns(stage, tsc_to_ns(to - from));
+}
+
+static __inline__ void stats_count(enum stats_counter c)
+{
+	__atomic_fetch_add(&stats->counter[c], 1, __ATOMIC_RELAXED);
+}
+
+
+#endif /* __STATS_FUNC_H__ */
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sensor.h"
+#include "tsc.h"
+
+
+struct tsc_calib tsc_calib;
+
+static unsigned long long tsc_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Fills in the fixed point multipliers for a given frequency.
+ */
+static void tsc_set_hz(unsigned long long hz)
+{
+	tsc_calib.hz = hz;
+	tsc_calib.ns_mult = (1000000000ULL << TSC_FRAC_BITS) / hz;
+	tsc_calib.um_mult = ((ECHO_SOUND_M_PER_S * 500000ULL) << TSC_FRAC_BITS) / hz;
+}
+
+static int tsc_cmp(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/***********************************************************************
+* tsc_calibrate - Function to measure the TSC frequency.
+*
+* Returns 0 on success.
+*
+* Description: Function to measure the TSC frequency against
+* 	CLOCK_MONOTONIC_RAW over TSC_CALIB_ROUNDS short intervals. The
+* 	median is used; if the rounds disagree by more than TSC_STABLE_PPM
+* 	the TSC is flagged unstable (frequency scaling, no constant_tsc).
+* 	Without a usable clock CPU_CLOCK_SPEED is kept.
+***********************************************************************/
+int tsc_calibrate(void)
+{
+	unsigned long long hz[TSC_CALIB_ROUNDS];
+	unsigned long long t0, t1, c0, c1;
+	struct timespec delay = { 0, TSC_CALIB_MS * 1000000L };
+	int i;
+
+	tsc_set_hz(CPU_CLOCK_SPEED);
+	tsc_calib.stable = 0;
+
+	for(i = 0; i < TSC_CALIB_ROUNDS; i++)
+	{
+		t0 = tsc_clock_ns();
+		c0 = my_rdtsc();
+		nanosleep(&delay, NULL);
+		c1 = my_rdtsc();
+		t1 = tsc_clock_ns();
+		if(t1 <= t0)
+			return -1;
+		hz[i] = (c1 - c0) * 1000000000ULL / (t1 - t0);
+	}
+
+	qsort(hz, TSC_CALIB_ROUNDS, sizeof(hz[0]), tsc_cmp);
+	if(hz[TSC_CALIB_ROUNDS / 2] == 0)
+		return -1;
+
+	tsc_set_hz(hz[TSC_CALIB_ROUNDS / 2]);
+	tsc_calib.spread_ppm = (hz[TSC_CALIB_ROUNDS - 1] - hz[0]) * 1000000ULL /
+		tsc_calib.hz;
+	tsc_calib.stable = (tsc_calib.spread_ppm <= TSC_STABLE_PPM);
+	return 0;
+}
+
+/***********************************************************************
+* tsc_self_test - Function to report the calibration and its accuracy.
+*
+* Returns 0 if the TSC is stable.
+*
+* Description: Function to report the calibrated frequency and the worst
+* 	error of the fixed point tick to distance conversion over the
+* 	HC-SR04 range, compared with the exact floating point result.
+***********************************************************************/
+int tsc_self_test(void)
+{
+	unsigned long long ticks, max_ticks;
+	double exact, err, max_err = 0;
+
+	printf("tsc: %llu Hz, spread %llu ppm, %s\n", tsc_calib.hz,
+		tsc_calib.spread_ppm, tsc_calib.stable ? "stable" : "UNSTABLE");
+
+	/* 150 us to 38 ms of echo, the sensor's full span */
+	max_ticks = tsc_calib.hz / 1000 * 38;
+	for(ticks = tsc_calib.hz / 1000000 * 150; ticks <= max_ticks;
+		ticks += tsc_calib.hz / 100000 + 1)
+	{
+		exact = (double)ticks * ECHO_SOUND_M_PER_S * 5e5 / tsc_calib.hz;
+		err = exact - (double)tsc_to_um(ticks);
+		if(err < 0)
+			err = -err;
+		if(err > max_err)
+			max_err = err;
+	}
+
+	printf("tsc: tick to distance error <= %.3f um\n", max_err);
+	return tsc_calib.stable ? 0 : -1;
+}
@@ -0,0 +1,74 @@
+#ifndef __TSC_H__
+#define __TSC_H__
+
+#include <stdint.h>
+
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define CPU_CLOCK_SPEED 400000000 //400 MHz, used if calibration fails
+#define TSC_CALIB_ROUNDS 7
+#define TSC_CALIB_MS 20
+#define TSC_STABLE_PPM 500	/* max spread between calibration rounds */
+#define TSC_FRAC_BITS 32
+
+/****************************************************************
+ * Types
+ ****************************************************************/
+
+/*
+ * Result of the start up calibration. The multipliers are fixed point
+ * with TSC_FRAC_BITS fraction bits, so a tick count converts with one
+ * multiply and shift and keeps its sub-microsecond resolution.
+ */
+struct tsc_calib {
+	unsigned long long hz;
+	unsigned long long spread_ppm;	/* max - min over the rounds */
+	int stable;
+	uint64_t ns_mult;		/* nanoseconds per tick */
+	uint64_t um_mult;		/* micrometres of distance per tick */
+};
+
+extern struct tsc_calib tsc_calib;
+
+/****************************************************************
+ * Functions
+ ****************************************************************/
+
+/***********************************************************************
+ * rdtsc() function is used to calulcate the number of clock ticks
+ * and measure the time. TSC(time stamp counter) is incremented 
+ * every cpu tick (1/CPU_HZ).
+ **********************************************************************/
+static __inline__ unsigned long long my_rdtsc(void)
+ {
+     unsigned long lo, hi;
+     __asm__ __volatile__ ( "rdtsc" : "=a" (lo), "=d" (hi) ); 
+     return( (unsigned long long)lo | ((unsigned long long)hi << 32) );
+ }
+
+static __inline__ unsigned long long tsc_to_ns(unsigned long long ticks)
+{
+	return (ticks * tsc_calib.ns_mult) >> TSC_FRAC_BITS;
+}
+
+/* Ticks in @ns, for TSC timed waits; uses CPU_CLOCK_SPEED until calibrated */
+static __inline__ unsigned long long tsc_from_ns(unsigned long long ns)
+{
+	unsigned long long hz = tsc_calib.hz ? tsc_calib.hz : CPU_CLOCK_SPEED;
+
+	return ns * hz / 1000000000ULL;
+}
+
+static __inline__ unsigned long long tsc_to_um(unsigned long long ticks)
+{
+	return (ticks * tsc_calib.um_mult) >> TSC_FRAC_BITS;
+}
+
+int tsc_calibrate(void);
+int tsc_self_test(void);
+
+
+#endif /* __TSC_H__ */